@@ -19,6 +19,7 @@
 
 #include "debug.h"
 #include "qstat.h"
+#include "arena.h"
 #include "packet_manip.h"
 
 #define A2S_GETCHALLENGE		"\xFF\xFF\xFF\xFF\x57"
@@ -149,7 +150,7 @@ deal_with_a2s_packet(struct qserver *server, char *rawpkt, int pktlen)
 	unsigned cnt;
 
 	if (server->server_name == NULL) {
-		server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+		server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 		server->n_requests++;
 	}
 
@@ -699,7 +700,7 @@ deal_with_a2s_packet(struct qserver *server, char *rawpkt, int pktlen)
 			debug(3, "player index %d = %s", idx, name);
 			p = add_player(server, server->n_player_info);
 			if (p) {
-				p->name = strdup(name);
+				p->name = arena_strdup(&server->arena, name);
 				p->frags = swap_long_from_little(pkt);
 				p->connect_time = swap_float_from_little(pkt + 4);
 			}
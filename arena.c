@@ -0,0 +1,173 @@
+/*
+ * qstat
+ * by Steve Jankowski
+ *
+ * Per server memory arena
+ *
+ * A reply is parsed into dozens of small rules, players and strings which
+ * all live exactly as long as the server's result, so rather than a
+ * malloc and free for each they're carved out of a few blocks per server
+ * and freed together once it's shown.
+ *
+ * Licensed under the Artistic License, see LICENSE.txt for license terms
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "qstat.h"
+#include "arena.h"
+
+#define ARENA_ALIGN        8
+#define ARENA_BLOCK_MIN    1024
+#define ARENA_BLOCK_MAX    65536
+
+struct arena_block {
+	struct arena_block *next;
+	size_t size;
+	size_t used;
+};
+
+#define ALIGNED(n)         (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+#define BLOCK_DATA(b)      ((char *)(b) + ALIGNED(sizeof(struct arena_block)))
+
+
+void *
+arena_alloc(struct arena *arena, size_t size)
+{
+	struct arena_block *block = arena->blocks;
+	size_t block_size;
+	char *ptr;
+
+	size = ALIGNED(size ? size : 1);
+	if ((block == NULL) || (block->used + size > block->size)) {
+		block_size = block ? block->size * 2 : ARENA_BLOCK_MIN;
+		if (block_size > ARENA_BLOCK_MAX) {
+			block_size = ARENA_BLOCK_MAX;
+		}
+
+		if (size > block_size / 4) {
+			// too big to share, given a block to itself behind
+			// the current one so that carries on being used
+			block = (struct arena_block *)malloc(ALIGNED(sizeof(struct arena_block)) + size);
+			block->size = block->used = size;
+			if (arena->blocks != NULL) {
+				block->next = arena->blocks->next;
+				arena->blocks->next = block;
+			} else {
+				block->next = NULL;
+				arena->blocks = block;
+			}
+			return (BLOCK_DATA(block));
+		}
+
+		block = (struct arena_block *)malloc(ALIGNED(sizeof(struct arena_block)) + block_size);
+		block->size = block_size;
+		block->used = 0;
+		block->next = arena->blocks;
+		arena->blocks = block;
+	}
+
+	ptr = BLOCK_DATA(block) + block->used;
+	block->used += size;
+
+	return (ptr);
+}
+
+
+void *
+arena_calloc(struct arena *arena, size_t size)
+{
+	void *ptr = arena_alloc(arena, size);
+
+	memset(ptr, 0, size);
+
+	return (ptr);
+}
+
+
+char *
+arena_strndup(struct arena *arena, const char *string, size_t len)
+{
+	const char *end = memchr(string, '\0', len);
+	char *copy;
+
+	if (end != NULL) {
+		len = end - string;
+	}
+	copy = (char *)arena_alloc(arena, len + 1);
+	memcpy(copy, string, len);
+	copy[len] = '\0';
+
+	return (copy);
+}
+
+
+char *
+arena_strdup(struct arena *arena, const char *string)
+{
+	size_t len = strlen(string);
+	char *copy;
+
+	copy = (char *)arena_alloc(arena, len + 1);
+	memcpy(copy, string, len + 1);
+
+	return (copy);
+}
+
+
+int
+arena_owns(struct arena *arena, const void *ptr)
+{
+	struct arena_block *block;
+
+	for (block = arena->blocks; block != NULL; block = block->next) {
+		if (((const char *)ptr >= BLOCK_DATA(block)) && ((const char *)ptr < BLOCK_DATA(block) + block->size)) {
+			return (1);
+		}
+	}
+
+	return (0);
+}
+
+
+void
+arena_free(struct arena *arena, void *ptr)
+{
+	if ((ptr == NULL) || arena_owns(arena, ptr)) {
+		return;
+	}
+
+	free(ptr);
+}
+
+
+void
+arena_clear(struct arena *arena)
+{
+	struct arena_block *block, *next;
+
+	for (block = arena->blocks; block != NULL; block = next) {
+		next = block->next;
+		free(block);
+	}
+	arena->blocks = NULL;
+}
+
+
+void
+arena_reset(struct arena *arena)
+{
+	struct arena_block *keep = arena->blocks;
+
+	if (keep == NULL) {
+		return;
+	}
+
+	// the first block is the latest and largest shared one
+	arena->blocks = keep->next;
+	arena_clear(arena);
+	keep->next = NULL;
+	keep->used = 0;
+	arena->blocks = keep;
+}
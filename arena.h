@@ -0,0 +1,57 @@
+/*
+ * qstat
+ * by Steve Jankowski
+ *
+ * Per server memory arena
+ *
+ * Licensed under the Artistic License, see LICENSE.txt for license terms
+ */
+#ifndef QSTAT_ARENA_H
+#define QSTAT_ARENA_H
+
+#include <stddef.h>
+
+#include "qstat.h"
+
+/**
+ * \returns size bytes from arena, which last until it's cleared or reset
+ */
+void *arena_alloc(struct arena *arena, size_t size);
+
+/**
+ * Like arena_alloc, but zeroed
+ */
+void *arena_calloc(struct arena *arena, size_t size);
+
+/**
+ * \returns a copy of string from arena
+ */
+char *arena_strdup(struct arena *arena, const char *string);
+
+/**
+ * \returns a copy of at most len chars of string from arena
+ */
+char *arena_strndup(struct arena *arena, const char *string, size_t len);
+
+/**
+ * \returns non-zero if ptr came from arena
+ */
+int arena_owns(struct arena *arena, const void *ptr);
+
+/**
+ * Free ptr if it was malloced, as a lot of parsing still does, but not if
+ * it came from arena as that's freed as a whole
+ */
+void arena_free(struct arena *arena, void *ptr);
+
+/**
+ * Free everything allocated from arena
+ */
+void arena_clear(struct arena *arena);
+
+/**
+ * Like arena_clear, but keep a block to be used again
+ */
+void arena_reset(struct arena *arena);
+
+#endif
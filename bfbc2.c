@@ -70,7 +70,7 @@ deal_with_bfbc2_packet(struct qserver *server, char *rawpkt, int pktlen)
 	end = &rawpkt[pktlen - 1];
 	s = rawpkt;
 
-	server->ping_total = time_delta(&packet_recv_time, &server->packet_time1);
+	server->ping_total = time_delta(packet_recv_time, server->packet_time1);
 	server->n_requests++;
 
 	// Header Sequence
@@ -138,7 +138,7 @@ deal_with_bfbc2_packet(struct qserver *server, char *rawpkt, int pktlen)
 	}
 
 	server->challenge++;
-	gettimeofday(&server->packet_time1, NULL);
+	server->packet_time1 = qtime_now();
 
 	if (1 == server->challenge) {
 		send_bfbc2_request_packet(server);
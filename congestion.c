@@ -0,0 +1,134 @@
+/*
+ * qstat
+ * by Steve Jankowski
+ *
+ * Adaptive limit on simultaneous queries
+ *
+ * Licensed under the Artistic License, see LICENSE.txt for license terms
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "qstat.h"
+#include "congestion.h"
+#include "debug.h"
+
+// results in the sliding window the loss rate is taken over
+#define CONGESTION_WINDOW           64
+
+// the limit is never cut below this
+#define CONGESTION_MIN              4
+
+// loss this far above the lowest seen is taken as congestion
+#define CONGESTION_LOSS_MARGIN      0.1
+
+extern int max_simultaneous;
+
+static int enabled = 0;
+static double limit;
+static double ssthresh;
+
+static unsigned char window[CONGESTION_WINDOW];
+static int window_len = 0;
+static int window_pos = 0;
+static int window_timeouts = 0;
+
+// some paths lose packets however few are in flight, so it's loss above
+// the lowest rate seen which counts
+static double base_loss = 1.0;
+
+// results still due from queries sent before the last cut
+static int recovering = 0;
+
+
+void
+congestion_init(int initial)
+{
+	enabled = 1;
+	limit = initial;
+	ssthresh = max_simultaneous;
+}
+
+
+int
+congestion_limit()
+{
+	if (!enabled || ((int)limit > max_simultaneous)) {
+		return (max_simultaneous);
+	}
+
+	return ((int)limit);
+}
+
+
+void
+congestion_result(int timed_out, int in_flight)
+{
+	double loss;
+
+	if (!enabled) {
+		return;
+	}
+
+	if (window_len == CONGESTION_WINDOW) {
+		window_timeouts -= window[window_pos];
+	} else {
+		window_len++;
+	}
+	window[window_pos] = timed_out ? 1 : 0;
+	window_timeouts += window[window_pos];
+	window_pos = (window_pos + 1) % CONGESTION_WINDOW;
+
+	if (recovering > 0) {
+		recovering--;
+	}
+
+	if (window_len == CONGESTION_WINDOW) {
+		loss = (double)window_timeouts / window_len;
+		if (loss < base_loss) {
+			base_loss = loss;
+		}
+
+		if (loss > base_loss + CONGESTION_LOSS_MARGIN) {
+			if (recovering) {
+				// still hearing about queries sent at the old limit
+				return;
+			}
+
+			if (limit <= CONGESTION_MIN) {
+				// can't be down to us, the network is just worse
+				base_loss = loss;
+				return;
+			}
+
+			ssthresh = limit / 2;
+			if (ssthresh < CONGESTION_MIN) {
+				ssthresh = CONGESTION_MIN;
+			}
+			limit = ssthresh;
+			recovering = in_flight;
+
+			// judge the new limit on replies of its own
+			window_len = 0;
+			window_pos = 0;
+			window_timeouts = 0;
+			debug(2, "loss %.2f base %.2f, limit cut to %d", loss, base_loss, (int)limit);
+			return;
+		}
+	}
+
+	// one more per reply doubles the limit each round trip until the
+	// first cut, after that it's one more per round trip
+	if (limit < ssthresh) {
+		limit += 1;
+	} else {
+		limit += 1 / limit;
+	}
+	if (limit > max_simultaneous) {
+		limit = max_simultaneous;
+	}
+
+	debug(3, "limit %.1f", limit);
+}
@@ -0,0 +1,39 @@
+/*
+ * qstat
+ * by Steve Jankowski
+ *
+ * Adaptive limit on simultaneous queries
+ *
+ * Licensed under the Artistic License, see LICENSE.txt for license terms
+ */
+#ifndef QSTAT_CONGESTION_H
+#define QSTAT_CONGESTION_H
+
+#include "qstat.h"
+
+// ceiling for the adaptive limit when -maxsim isn't given
+#define CONGESTION_MAX_DEFAULT      1024
+
+/**
+ * Turn on adapting the number of simultaneous queries, starting from initial
+ *
+ * The limit is raised and cut TCP style (AIMD) from the share of queries
+ * which timed out and had to be resent, over a sliding window of recent
+ * replies. It never goes above max_simultaneous.
+ */
+void congestion_init(int initial);
+
+/**
+ * \returns the number of servers which may be queried at once
+ */
+int congestion_limit();
+
+/**
+ * Record a game server which answered, after resending if timed_out is set
+ *
+ * Servers which never answer aren't counted as they'd time out whatever
+ * the limit. in_flight is the number of queries still running.
+ */
+void congestion_result(int timed_out, int in_flight);
+
+#endif
@@ -149,7 +149,7 @@ deal_with_crysis_packet(struct qserver *server, char *rawpkt, int pktlen)
 		state = valid_crysis_response(server, rawpkt, pktlen);
 		server->retry1 = n_retries;
 		if (0 == server->n_requests) {
-			server->ping_total = time_delta(&packet_recv_time, &server->packet_time1);
+			server->ping_total = time_delta(packet_recv_time, server->packet_time1);
 			server->n_requests++;
 		}
 
@@ -258,7 +258,7 @@ deal_with_crysis_packet(struct qserver *server, char *rawpkt, int pktlen)
 		line = strtok(NULL, "\012");
 	}
 
-	gettimeofday(&server->packet_time1, NULL);
+	server->packet_time1 = qtime_now();
 
 	return (DONE_FORCE);
 }
@@ -169,7 +169,7 @@ deal_with_cube2_packet(struct qserver *server, char *rawpkt, int pktlen)
 	d.pos = 0;
 	d.len = pktlen;
 
-	server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+	server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 	getint(&d);             // we have the ping already
 	server->num_players = getint(&d);
 	numattr = getint(&d);
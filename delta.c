@@ -0,0 +1,326 @@
+/*
+ * qstat
+ * by Steve Jankowski
+ *
+ * Output only what changed since the previous run
+ *
+ * Most servers look the same from one run to the next, so with -delta
+ * a fingerprint of each server's result is kept in a file and a server
+ * is only shown when it's new, its fingerprint differs, or it has gone
+ * from the servers queried.
+ *
+ * Each line of the file is a server's type, address as given and
+ * fingerprint in hex:
+ *   q3s 192.168.1.1:27960 9f1c0e2b7a4d6e13
+ *
+ * Licensed under the Artistic License, see LICENSE.txt for license terms
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "qstat.h"
+#include "delta.h"
+#include "debug.h"
+
+#define HASH_SIZE_MIN    1024
+
+#define FNV_OFFSET       14695981039346656037ULL
+#define FNV_PRIME        1099511628211ULL
+
+typedef struct _delta_entry {
+	char *key;                      /* type and address */
+	unsigned long long fingerprint;
+	int seen;                       /* in this run, else it's gone */
+	struct _delta_entry *hash_next;
+} delta_entry;
+
+static char *state_filename = NULL;
+static delta_entry **hash;
+static unsigned int hash_size;
+static unsigned int n_hash;
+
+
+static unsigned int
+bucket(const char *key)
+{
+	unsigned int h = 2166136261u;
+
+	for ( ; *key; key++) {
+		h = (h ^ (unsigned char)*key) * 16777619u;
+	}
+
+	return (h & (hash_size - 1));
+}
+
+
+static delta_entry *
+find_entry(const char *key)
+{
+	delta_entry *entry;
+
+	if (n_hash == 0) {
+		return (NULL);
+	}
+
+	for (entry = hash[bucket(key)]; entry != NULL; entry = entry->hash_next) {
+		if (strcmp(entry->key, key) == 0) {
+			return (entry);
+		}
+	}
+
+	return (NULL);
+}
+
+
+static delta_entry *
+add_entry(char *key, unsigned long long fingerprint)
+{
+	delta_entry **old_hash = hash, *entry, *next;
+	unsigned int i, old_size = hash_size, b;
+
+	if (n_hash >= hash_size) {
+		hash_size = hash_size ? hash_size * 2 : HASH_SIZE_MIN;
+		hash = (delta_entry **)calloc(hash_size, sizeof(delta_entry *));
+		for (i = 0; i < old_size; i++) {
+			for (entry = old_hash[i]; entry != NULL; entry = next) {
+				next = entry->hash_next;
+				b = bucket(entry->key);
+				entry->hash_next = hash[b];
+				hash[b] = entry;
+			}
+		}
+		free(old_hash);
+	}
+
+	entry = (delta_entry *)calloc(1, sizeof(delta_entry));
+	entry->key = key;
+	entry->fingerprint = fingerprint;
+	b = bucket(key);
+	entry->hash_next = hash[b];
+	hash[b] = entry;
+	n_hash++;
+
+	return (entry);
+}
+
+
+static char *
+make_key(server_type *type, const char *arg)
+{
+	char *key;
+
+	key = (char *)malloc(strlen(type->type_string) + strlen(arg) + 2);
+	sprintf(key, "%s %s", type->type_string, arg);
+
+	return (key);
+}
+
+
+int
+delta_open(char *filename)
+{
+	FILE *file;
+	char line[1024], type[64], arg[sizeof(line)];
+	unsigned long long fingerprint;
+	char *key;
+
+	state_filename = filename;
+	file = fopen(filename, "r");
+	if (file == NULL) {
+		if (errno == ENOENT) {
+			debug(2, "Creating new delta state \"%s\"\n", filename);
+			return (0);
+		}
+		perror(filename);
+		return (-1);
+	}
+
+	while (fgets(line, sizeof(line), file) != NULL) {
+		if (sscanf(line, "%63s %1023s %llx", type, arg, &fingerprint) != 3) {
+			continue;
+		}
+		key = (char *)malloc(strlen(type) + strlen(arg) + 2);
+		sprintf(key, "%s %s", type, arg);
+		if (find_entry(key) != NULL) {
+			free(key);
+			continue;
+		}
+		add_entry(key, fingerprint);
+	}
+	fclose(file);
+	debug(2, "%u servers in %s\n", n_hash, filename);
+
+	return (0);
+}
+
+
+static unsigned long long
+hash_string(unsigned long long h, const char *s)
+{
+	if (s != NULL) {
+		for ( ; *s; s++) {
+			h = (h ^ (unsigned char)*s) * FNV_PRIME;
+		}
+	}
+
+	// keeps "ab" + "c" apart from "a" + "bc"
+	return ((h ^ 0xff) * FNV_PRIME);
+}
+
+
+static unsigned long long
+hash_int(unsigned long long h, int value)
+{
+	int i;
+
+	for (i = 0; i < 4; i++, value >>= 8) {
+		h = (h ^ (value & 0xff)) * FNV_PRIME;
+	}
+
+	return (h);
+}
+
+
+unsigned long long
+delta_fingerprint(struct qserver *server)
+{
+	unsigned long long h = FNV_OFFSET;
+	struct player *player;
+	struct rule *rule;
+
+	h = hash_string(h, server->server_name);
+	h = hash_string(h, server->error);
+	h = hash_string(h, server->map_name);
+	h = hash_string(h, server->game);
+	h = hash_int(h, server->num_players);
+	h = hash_int(h, server->max_players);
+	h = hash_int(h, server->num_spectators);
+	h = hash_int(h, server->n_servers);
+
+	for (player = server->players; player != NULL; player = player->next) {
+		h = hash_string(h, player->name);
+	}
+
+	for (rule = server->rules; rule != NULL; rule = rule->next) {
+		h = hash_string(h, rule->name);
+		h = hash_string(h, rule->value);
+	}
+
+	return (h);
+}
+
+
+int
+delta_record(server_type *type, const char *arg, unsigned long long fingerprint)
+{
+	delta_entry *entry;
+	char *key;
+	int changed;
+
+	if (state_filename == NULL) {
+		return (1);
+	}
+
+	key = make_key(type, arg);
+	if ((entry = find_entry(key)) == NULL) {
+		entry = add_entry(key, fingerprint);
+		changed = 1;
+	} else {
+		free(key);
+		changed = (entry->fingerprint != fingerprint);
+		entry->fingerprint = fingerprint;
+	}
+	entry->seen = 1;
+
+	return (changed);
+}
+
+
+int
+delta_check(struct qserver *server)
+{
+	if (state_filename == NULL) {
+		return (1);
+	}
+
+	return (delta_record(server->type, server->arg, delta_fingerprint(server)));
+}
+
+
+void
+delta_keep(struct qserver *server)
+{
+	delta_entry *entry;
+	char *key;
+
+	if (state_filename == NULL) {
+		return;
+	}
+
+	key = make_key(server->type, server->arg);
+	if ((entry = find_entry(key)) != NULL) {
+		entry->seen = 1;
+	}
+	free(key);
+}
+
+
+void
+delta_finish()
+{
+	FILE *file;
+	char *tmpname, *arg;
+	delta_entry *entry;
+	server_type *type;
+	unsigned int i;
+
+	if (state_filename == NULL) {
+		return;
+	}
+
+	tmpname = (char *)malloc(strlen(state_filename) + 5);
+	sprintf(tmpname, "%s.tmp", state_filename);
+	file = fopen(tmpname, "w");
+	if (file == NULL) {
+		perror(tmpname);
+	}
+
+	for (i = 0; i < hash_size; i++) {
+		for (entry = hash[i]; entry != NULL; entry = entry->hash_next) {
+			if (entry->seen) {
+				if (file != NULL) {
+					fprintf(file, "%s %016llx\n", entry->key, entry->fingerprint);
+				}
+				continue;
+			}
+
+			// gone, shown once and then forgotten
+			arg = strchr(entry->key, ' ');
+			*arg = '\0';
+			type = find_server_type_string(entry->key);
+			*arg++ = ' ';
+			if (type != NULL) {
+				qserver_gone(type, arg);
+			}
+		}
+	}
+
+	if (file != NULL) {
+		if (fclose(file) != 0) {
+			perror(tmpname);
+			remove(tmpname);
+		} else {
+#ifdef _WIN32
+				remove(state_filename);
+#endif
+			if (rename(tmpname, state_filename) != 0) {
+				perror(state_filename);
+			}
+		}
+	}
+	free(tmpname);
+	state_filename = NULL;
+}
@@ -0,0 +1,58 @@
+/*
+ * qstat
+ * by Steve Jankowski
+ *
+ * Output only what changed since the previous run
+ *
+ * Licensed under the Artistic License, see LICENSE.txt for license terms
+ */
+#ifndef QSTAT_DELTA_H
+#define QSTAT_DELTA_H
+
+#include "qstat.h"
+
+/**
+ * Read the state of the previous run from filename, which needn't exist
+ * yet, and only show servers whose result differs from it
+ *
+ * \returns 0 on success, -1 if it can't be read
+ */
+int delta_open(char *filename);
+
+/**
+ * \returns the fingerprint of server's result: its name, map, player
+ * counts, player names and rules, but not its ping
+ */
+unsigned long long delta_fingerprint(struct qserver *server);
+
+/**
+ * Record the fingerprint of the result for the server given by arg
+ *
+ * \returns 1 if it's new or has changed and should be shown, 0 if not
+ */
+int delta_record(server_type *type, const char *arg, unsigned long long fingerprint);
+
+/**
+ * Record server's result, always 1 if -delta wasn't given
+ *
+ * \returns 1 if it should be shown, 0 if it's the same as last time
+ */
+int delta_check(struct qserver *server);
+
+/**
+ * Carry server's previous state over, it wasn't queried this time
+ */
+void delta_keep(struct qserver *server);
+
+/**
+ * Show the servers which were in the previous run but not this one,
+ * then write the state file out for the next run
+ */
+void delta_finish();
+
+/**
+ * Called by delta_finish for each server which has gone
+ */
+void qserver_gone(server_type *type, const char *arg);
+
+#endif
@@ -88,7 +88,7 @@ deal_with_dirtybomb_packet(struct qserver *server, char *rawpkt, int pktlen)
 
 		server->retry1 = n_retries;
 		if (0 == server->n_requests) {
-			server->ping_total = time_delta(&packet_recv_time, &server->packet_time1);
+			server->ping_total = time_delta(packet_recv_time, server->packet_time1);
 			server->n_requests++;
 		}
 
@@ -112,7 +112,7 @@ deal_with_dirtybomb_packet(struct qserver *server, char *rawpkt, int pktlen)
 
 	debug(3, "processing response...");
 
-	gettimeofday(&server->packet_time1, NULL);
+	server->packet_time1 = qtime_now();
 
 	l = (unsigned char *)rawpkt + pktlen - 1;
 	if (!unpack_msgpack(server, s, l)) {
@@ -16,6 +16,7 @@
 #include <stdlib.h>
 
 #include "qstat.h"
+#include "arena.h"
 #include "debug.h"
 #include "assert.h"
 
@@ -139,13 +140,13 @@ send_doom3master_request_packet(struct qserver *server)
 	packet_len = sizeof(query_buf);
 	packet = build_doom3_masterfilter(server, query_buf, (unsigned *)&packet_len, 0);
 
-	rc = send(server->fd, packet, packet_len, 0);
+	rc = qserver_send_raw(server, packet, packet_len);
 	if (rc == SOCKET_ERROR) {
 		return (send_error(server, rc));
 	}
 
 	if (server->retry1 == n_retries) {
-		gettimeofday(&server->packet_time1, NULL);
+		server->packet_time1 = qtime_now();
 		server->n_requests++;
 	} else {
 		server->n_retries++;
@@ -170,13 +171,13 @@ send_quake4master_request_packet(struct qserver *server)
 	packet_len = sizeof(query_buf);
 	packet = build_doom3_masterfilter(server, query_buf, (unsigned *)&packet_len, 1);
 
-	rc = send(server->fd, packet, packet_len, 0);
+	rc = qserver_send_raw(server, packet, packet_len);
 	if (rc == SOCKET_ERROR) {
 		return (send_error(server, rc));
 	}
 
 	if (server->retry1 == n_retries) {
-		gettimeofday(&server->packet_time1, NULL);
+		server->packet_time1 = qtime_now();
 		server->n_requests++;
 	} else {
 		server->n_retries++;
@@ -196,7 +197,7 @@ deal_with_doom3master_packet(struct qserver *server, char *rawpkt, int pktlen)
 	char *pkt, *dest;
 	int len;
 
-	server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+	server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 
 	if ((pktlen < sizeof(doom3_masterresponse) + 6) ||                                                     // at least one server
 	    (pktlen - sizeof(doom3_masterresponse)) % 6 ||
@@ -257,9 +258,9 @@ _deal_with_doom3_packet(struct qserver *server, char *rawpkt, int pktlen, unsign
 
 	server->n_servers++;
 	if (server->server_name == NULL) {
-		server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+		server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 	} else {
-		gettimeofday(&server->packet_time1, NULL);
+		server->packet_time1 = qtime_now();
 	}
 
 	// Check if correct reply
@@ -455,7 +456,7 @@ _deal_with_doom3_packet(struct qserver *server, char *rawpkt, int pktlen, unsign
 			malformed_packet(server, "player name not null terminated");
 			return (PKT_ERROR);
 		}
-		player->name = strdup(val);
+		player->name = arena_strdup(&server->arena, val);
 		ptr++;
 
 		switch (version) {
@@ -466,7 +467,7 @@ _deal_with_doom3_packet(struct qserver *server, char *rawpkt, int pktlen, unsign
 				malformed_packet(server, "player clan not null terminated");
 				return (PKT_ERROR);
 			}
-			player->tribe_tag = strdup(val);
+			player->tribe_tag = arena_strdup(&server->arena, val);
 			ptr++;
 			debug(2, "Player[%d] = %s, ping %hu, rate %u, id %hhu, clan %s",
 			    num_players, player->name, ping, rate, player_id, player->tribe_tag);
@@ -485,7 +486,7 @@ _deal_with_doom3_packet(struct qserver *server, char *rawpkt, int pktlen, unsign
 					malformed_packet(server, "player clan not null terminated");
 					return (PKT_ERROR);
 				}
-				player->tribe_tag = strdup(val);
+				player->tribe_tag = arena_strdup(&server->arena, val);
 				ptr++;
 			}
 
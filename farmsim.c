@@ -138,7 +138,7 @@ deal_with_farmsim_packet(struct qserver *server, char *rawpkt, int pktlen)
 		state = valid_farmsim_response(server, rawpkt, pktlen);
 		server->retry1 = n_retries;
 		if (server->n_requests == 0) {
-			server->ping_total = time_delta(&packet_recv_time, &server->packet_time1);
+			server->ping_total = time_delta(packet_recv_time, server->packet_time1);
 			server->n_requests++;
 		}
 
@@ -248,7 +248,7 @@ deal_with_farmsim_packet(struct qserver *server, char *rawpkt, int pktlen)
 		line = strtok(NULL, "\012");
 	}
 
-	gettimeofday(&server->packet_time1, NULL);
+	server->packet_time1 = qtime_now();
 
 	return (DONE_FORCE);
 }
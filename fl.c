@@ -23,6 +23,7 @@
 
 #include "debug.h"
 #include "qstat.h"
+#include "arena.h"
 #include "packet_manip.h"
 
 #define FL_GETCHALLENGE		"\xFF\xFF\xFF\xFF\x57"
@@ -126,7 +127,7 @@ deal_with_fl_packet(struct qserver *server, char *rawpkt, int pktlen)
 	unsigned short tmp_short;
 
 	if (server->server_name == NULL) {
-		server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+		server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 		server->n_requests++;
 	}
 
@@ -454,7 +455,7 @@ deal_with_fl_packet(struct qserver *server, char *rawpkt, int pktlen)
 				}
 				temp;
 
-				p->name = strdup(name);
+				p->name = arena_strdup(&server->arena, name);
 
 				// Score
 				p->frags = ntohl(*(unsigned int *)pkt);
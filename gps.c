@@ -19,6 +19,8 @@
 
 #include "debug.h"
 #include "qstat.h"
+#include "arena.h"
+#include "intern.h"
 #include "packet_manip.h"
 
 int
@@ -80,9 +82,9 @@ deal_with_gps_packet(struct qserver *server, char *rawpkt, int pktlen)
 
 	server->n_servers++;
 	if (server->server_name == NULL) {
-		server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+		server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 	} else {
-		gettimeofday(&server->packet_time1, NULL);
+		server->packet_time1 = qtime_now();
 	}
 
 	/*
@@ -246,10 +248,10 @@ deal_with_gps_packet(struct qserver *server, char *rawpkt, int pktlen)
 			}
 
 			if (player && (player->number == no)) {
-				player->name = strdup(value);
+				player->name = arena_strdup(&server->arena, value);
 				player = NULL;
 			} else if (NULL != (player = get_player_by_number(server, no))) {
-				player->name = strdup(value);
+				player->name = arena_strdup(&server->arena, value);
 				player = NULL;
 			} else if (gps_max_players(server)) {
 				// gps_max_players( server ) due to bf1942 issue
@@ -257,7 +259,7 @@ deal_with_gps_packet(struct qserver *server, char *rawpkt, int pktlen)
 				// details are returned
 				player = add_player(server, no);
 				if (player) {
-					player->name = strdup(value);
+					player->name = arena_strdup(&server->arena, value);
 					// init to -1 so we can tell if
 					// we have team info
 					player->team = -1;
@@ -283,7 +285,7 @@ deal_with_gps_packet(struct qserver *server, char *rawpkt, int pktlen)
 			player = get_player_by_number(server, atoi(key + 5));
 			if (NULL != player) {
 				if (!isdigit((unsigned char)*value)) {
-					player->team_name = strdup(value);
+					player->team_name = intern_strdup(&server->arena, value);
 				} else {
 					player->team = atoi(value);
 				}
@@ -292,12 +294,12 @@ deal_with_gps_packet(struct qserver *server, char *rawpkt, int pktlen)
 		} else if (strncmp(key, "skin_", 5) == 0) {
 			player = get_player_by_number(server, atoi(key + 5));
 			if (NULL != player) {
-				player->skin = strdup(value);
+				player->skin = arena_strdup(&server->arena, value);
 			}
 		} else if (strncmp(key, "mesh_", 5) == 0) {
 			player = get_player_by_number(server, atoi(key + 5));
 			if (NULL != player) {
-				player->mesh = strdup(value);
+				player->mesh = arena_strdup(&server->arena, value);
 			}
 		} else if (strncmp(key, "ping_", 5) == 0) {
 			player = get_player_by_number(server, atoi(key + 5));
@@ -307,7 +309,7 @@ deal_with_gps_packet(struct qserver *server, char *rawpkt, int pktlen)
 		} else if (strncmp(key, "face_", 5) == 0) {
 			player = get_player_by_number(server, atoi(key + 5));
 			if (NULL != player) {
-				player->face = strdup(value);
+				player->face = arena_strdup(&server->arena, value);
 			}
 		} else if (strncmp(key, "deaths_", 7) == 0) {
 			player = get_player_by_number(server, atoi(key + 7));
@@ -322,9 +324,9 @@ deal_with_gps_packet(struct qserver *server, char *rawpkt, int pktlen)
 				player->score = atoi(value);
 			}
 		} else if (player && (strncmp(key, "playertype", 10) == 0)) {
-			player->team_name = strdup(value);
+			player->team_name = intern_strdup(&server->arena, value);
 		} else if (player && (strncmp(key, "charactername", 13) == 0)) {
-			player->face = strdup(value);
+			player->face = arena_strdup(&server->arena, value);
 		} else if (player && (strncmp(key, "characterlevel", 14) == 0)) {
 			player->ship = atoi(value);
 		} else if (strncmp(key, "keyhash_", 8) == 0) {
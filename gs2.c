@@ -18,6 +18,7 @@
 
 #include "debug.h"
 #include "qstat.h"
+#include "arena.h"
 #include "packet_manip.h"
 
 query_status_t
@@ -61,9 +62,9 @@ deal_with_gs2_packet(struct qserver *server, char *rawpkt, int pktlen)
 
 	server->n_servers++;
 	if (server->server_name == NULL) {
-		server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+		server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 	} else {
-		gettimeofday(&server->packet_time1, NULL);
+		server->packet_time1 = qtime_now();
 	}
 
 	// Could check the header here should
@@ -205,7 +206,7 @@ deal_with_gs2_packet(struct qserver *server, char *rawpkt, int pktlen)
 
 				// lets see what we got
 				if (0 == strcmp(header, "player_")) {
-					player->name = strdup(val);
+					player->name = arena_strdup(&server->arena, val);
 				} else if (0 == strcmp(header, "score_")) {
 					player->score = atoi(val);
 				} else if (0 == strcmp(header, "deaths_")) {
@@ -19,6 +19,7 @@
 
 #include "debug.h"
 #include "qstat.h"
+#include "arena.h"
 #include "packet_manip.h"
 
 int process_gs3_packet(struct qserver *server);
@@ -60,8 +61,8 @@ deal_with_gs3_packet(struct qserver *server, char *rawpkt, int pktlen)
 	unsigned char flag;
 	unsigned int pkti, final;
 
-	debug(2, "packet n_requests %d, retry1 %d, n_retries %d, delta %d", server->n_requests, server->retry1, n_retries, time_delta(&packet_recv_time, &server->packet_time1));
-	server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+	debug(2, "packet n_requests %d, retry1 %d, n_retries %d, delta %d", server->n_requests, server->retry1, n_retries, time_delta(packet_recv_time, server->packet_time1));
+	server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 
 	if ((7 == pktlen) && (0x09 == *ptr)) {
 		// gs4 query sent to a gs3 server
@@ -534,7 +535,7 @@ process_gs3_packet(struct qserver *server)
 				// lets see what we got
 				switch (header_type) {
 				case PLAYER_NAME_HEADER:
-					player->name = strdup(val);
+					player->name = arena_strdup(&server->arena, val);
 					break;
 
 				case PLAYER_SCORE_HEADER:
@@ -19,6 +19,7 @@
 
 #include "debug.h"
 #include "qstat.h"
+#include "arena.h"
 #include "packet_manip.h"
 
 // Format:
@@ -98,9 +99,9 @@ deal_with_haze_packet(struct qserver *server, char *rawpkt, int pktlen)
 
 	server->n_servers++;
 	if (server->server_name == NULL) {
-		server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+		server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 	} else {
-		gettimeofday(&server->packet_time1, NULL);
+		server->packet_time1 = qtime_now();
 	}
 
 	// Query version ID
@@ -390,7 +391,7 @@ process_haze_packet(struct qserver *server)
 				// lets see what we got
 				switch (header_type) {
 				case PLAYER_NAME_HEADER:
-					player->name = strdup(val);
+					player->name = arena_strdup(&server->arena, val);
 					break;
 
 				case PLAYER_SCORE_HEADER:
@@ -20,6 +20,7 @@
 #include <ctype.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 
 #include "qstat.h"
 #include "debug.h"
@@ -46,34 +47,99 @@
 	#define INADDR_NONE    ~0
 #endif
 
+#define HASH_SIZE_MIN    256
+
+/* the loader takes lines shorter than 500, long entries are split */
+#define WRITE_LINE_MAX    400
+
+/* the file is rewritten once over half its lines are out of date */
+#define COMPACT_MIN       1000
+
+typedef struct _cache_name {
+	char *hostname;
+	struct _cache_entry *entry;
+	struct _cache_name *next;       /* the entry's next name */
+	struct _cache_name *hash_next;
+	time_t resolved;                /* when it was looked up, 0 never expires */
+	int written;                    /* in the file already */
+} cache_name;
+
 typedef struct _cache_entry {
 	unsigned long ipaddr;
-	char *hostname[5];
+	cache_name *names;              /* the first is the one shown */
+	cache_name **last_name;
+	int index;                      /* in hcache */
+	int dirty;                      /* 1 + index in dirty, 0 if clean */
+	time_t resolved;                /* when it was found to have no name */
+	int written;                    /* resolved is in the file already */
+	struct _cache_entry *hash_next;
 } cache_entry;
 
-static cache_entry *hcache;
+/*
+ * Names of an entry without an address are host names which weren't
+ * found. Negative entries, those and addresses without a name, expire
+ * after hcache_negative_ttl and the rest after hcache_ttl. Entries from
+ * lines without a time never expire, so they can be pinned by hand.
+ */
+int hcache_ttl = HCACHE_TTL_DEFAULT;
+int hcache_negative_ttl = HCACHE_NEGATIVE_TTL_DEFAULT;
+
+/* entries in the order they were added, freed ones are NULL */
+static cache_entry **hcache;
 static int n_entry;
 static int max_entry;
+static int n_live;
 static char *last_filename;
-static int n_changes;
 
-static void write_file(FILE *file);
-static cache_entry *init_entry(unsigned long ipaddr, char *hostname,
-    cache_entry *known);
+/*
+ * The file is a journal, changed entries are appended as lines of their
+ * own which the loader merges. Appends are only a few lines each, so the
+ * cache survives a crash part way through a run.
+ */
+static cache_entry **dirty;
+static int n_dirty;
+static int max_dirty;
+static int n_records;                   /* lines in the file */
+static int torn;                        /* the last line was cut short */
+static int loading;
+
+/*
+ * Entries with an address by address, and every name, both chained with
+ * a power of two number of buckets
+ */
+static cache_entry **ip_hash;
+static unsigned int ip_hash_size;
+static unsigned int n_ip_hash;
+static cache_name **name_hash;
+static unsigned int name_hash_size;
+static unsigned int n_name_hash;
+
+static int write_file(FILE *file);
+static int write_entry(FILE *file, cache_entry *entry, int all);
+static void compact_file();
+static void end_line(FILE *file, time_t resolved);
+static void mark_dirty(cache_entry *entry);
+static int expired(time_t resolved, int negative);
+static int name_expired(cache_name *name);
+static cache_entry *init_entry(unsigned long ipaddr);
+static cache_entry *new_entry(unsigned long ipaddr);
 static cache_entry *find_entry(unsigned long ipaddr);
+static void set_ipaddr(cache_entry *entry, unsigned long ipaddr);
 static void free_entry(cache_entry *entry);
+static void free_names(cache_entry *entry);
 static cache_entry *validate_entry(cache_entry *entry);
-static cache_entry *find_host_entry(char *hostname);
-static void add_hostname(cache_entry *entry, const char *hostname);
+static cache_name *find_name(const char *hostname);
+static void add_hostname(cache_entry *entry, const char *hostname, time_t resolved);
+static cache_entry *add_not_found(const char *hostname, time_t resolved);
 
 int
 hcache_open(char *filename, int update)
 {
 	FILE *file;
-	char line[500], ipstr[500], hostname[500];
-	char *l;
-	int line_no, end;
-	unsigned long ip1, ip2, ip3, ip4, ipaddr;
+	char line[500];
+	char *l, *token, *names[250];
+	int line_no, n_names, i;
+	unsigned long ip1, ip2, ip3, ip4, ipaddr, resolved;
 	cache_entry *entry;
 
 	file = fopen(filename, update ? "r+" : "r");
@@ -87,132 +153,180 @@ hcache_open(char *filename, int update)
 		return (-1);
 	}
 	last_filename = filename;
+	loading = 1;
 
+	/*
+	 * Lines are an address or host name, then any names, then the time
+	 * they were looked up as "#<seconds>", which older versions skip as
+	 * a comment
+	 */
 	for (line_no = 1; fgets(line, sizeof(line), file) != NULL; line_no++) {
 		if (strlen(line) < 2) {
 			continue;
 		}
 		if (line[strlen(line) - 1] != '\n') {
-			printf("%d: line too long\n", line_no);
+			if (feof(file)) {
+				// an append cut short by a crash, dropped when the
+				// file is next written
+				debug(1, "%d: incomplete last line\n", line_no);
+				torn = 1;
+			} else {
+				printf("%d: line too long\n", line_no);
+			}
 			continue;
 		}
-		l = line;
-		while (isspace((unsigned char)*l)) {
-			l++;
-		}
-		if ((*l == '#') || (*l == '\0')) {
-			continue;
+		n_records++;
+
+		n_names = 0;
+		resolved = 0;
+		for (l = line; ; ) {
+			while (isspace((unsigned char)*l)) {
+				l++;
+			}
+			if (*l == '\0') {
+				break;
+			}
+			token = l;
+			while (*l && !isspace((unsigned char)*l)) {
+				l++;
+			}
+			if (*l) {
+				*l++ = '\0';
+			}
+			if (*token == '#') {
+				resolved = strtoul(token + 1, NULL, 10);
+				break;
+			}
+			names[n_names++] = token;
 		}
-		if (sscanf(l, "%s%n", ipstr, &end) != 1) {
-			printf("%d: parse error\n", line_no);
+		if (n_names == 0) {
 			continue;
 		}
-		if (sscanf(ipstr, "%lu.%lu.%lu.%lu", &ip1, &ip2, &ip3, &ip4) != 4) {
-			init_entry(0, ipstr, NULL);
+
+		if (sscanf(names[0], "%lu.%lu.%lu.%lu", &ip1, &ip2, &ip3, &ip4) != 4) {
+			add_not_found(names[0], resolved);
 			continue;
 		}
 
 		if ((ip1 & 0xffffff00) || (ip2 & 0xffffff00) ||
 		    (ip3 & 0xffffff00) || (ip4 & 0xffffff00)) {
-			printf("%d: invalid IP address \"%s\"\n", line_no, ipstr);
+			printf("%d: invalid IP address \"%s\"\n", line_no, names[0]);
 			continue;
 		}
 		ipaddr = (ip1 << 24) | (ip2 << 16) | (ip3 << 8) | ip4;
 
-		entry = init_entry(ipaddr, NULL, NULL);
-		while (1) {
-			l += end;
-			while (isspace((unsigned char)*l)) {
-				l++;
-			}
-			if ((*l == '#') || (*l == '\0')) {
-				break;
-			}
-			hostname[0] = '\0';
-			if (sscanf(l, "%s%n", hostname, &end) != 1) {
-				printf("%d: parse error\n", line_no);
-				continue;
-			}
-			init_entry(ipaddr, hostname, entry);
+		entry = init_entry(ipaddr);
+		if (n_names == 1) {
+			entry->resolved = resolved;
+			entry->written = 1;
+		}
+		for (i = 1; i < n_names; i++) {
+			add_hostname(entry, names[i], resolved);
 		}
 	}
 	fclose(file);
+	loading = 0;
 	return (0);
 }
 
 
 STATIC cache_entry *
-init_entry(unsigned long ipaddr, char *hostname, cache_entry *known)
+init_entry(unsigned long ipaddr)
+{
+	cache_entry *entry;
+
+	if ((entry = find_entry(ipaddr)) == NULL) {
+		entry = new_entry(ipaddr);
+	}
+	return (entry);
+}
+
+
+STATIC cache_entry *
+new_entry(unsigned long ipaddr)
 {
 	cache_entry *entry;
-	int e = 0, h;
 
 	if (n_entry == max_entry) {
-		if (max_entry == 0) {
-			max_entry = 50;
-			hcache = (cache_entry *)malloc(sizeof(cache_entry) * max_entry * 2);
-		} else {
-			hcache = (cache_entry *)realloc(hcache,
-				sizeof(cache_entry) * max_entry * 2);
-		}
-		memset(hcache + n_entry, 0, sizeof(cache_entry) * max_entry *
-		    (n_entry == 0 ? 2 : 1));
-		max_entry *= 2;
+		max_entry = max_entry ? max_entry * 2 : 100;
+		hcache = (cache_entry **)realloc(hcache, sizeof(cache_entry *) * max_entry);
 	}
 
-	if (ipaddr == 0) {
-		entry = find_host_entry(hostname);
-		if (entry == NULL) {
-			hcache[n_entry].hostname[0] = strdup(hostname);
-			return (&hcache[n_entry++]);
-		}
-		return (entry);
+	entry = (cache_entry *)calloc(1, sizeof(cache_entry));
+	entry->last_name = &entry->names;
+	entry->index = n_entry;
+	hcache[n_entry++] = entry;
+	n_live++;
+
+	if (ipaddr != 0) {
+		set_ipaddr(entry, ipaddr);
 	}
+	return (entry);
+}
 
-	if (known != NULL) {
-		entry = known;
-	} else {
-		for (e = 0; e < n_entry; e++) {
-			if (hcache[e].ipaddr == ipaddr) {
-				break;
-			}
-		}
-		entry = &hcache[e];
-		entry->ipaddr = ipaddr;
+
+STATIC unsigned int
+name_bucket(const char *hostname)
+{
+	unsigned int hash = 2166136261u;
+
+	for ( ; *hostname; hostname++) {
+		hash = (hash ^ (unsigned char)*hostname) * 16777619u;
 	}
+	return (hash & (name_hash_size - 1));
+}
 
-	if (hostname && (hostname[0] != '\0')) {
-		for (h = 0; h < 5; h++) {
-			if (entry->hostname[h] == NULL) {
-				entry->hostname[h] = strdup(hostname);
-				break;
-			}
-		}
+
+STATIC unsigned int
+ip_bucket(unsigned long ipaddr)
+{
+	return (((unsigned int)ipaddr * 2654435761u) & (ip_hash_size - 1));
+}
+
+
+/*
+ * A name can be in several entries, from a host name that moved or
+ * addresses sharing a name, so one which never expires wins, then the
+ * latest lookup. Host names listed without an address or time are still
+ * to be looked up, so aren't found.
+ */
+STATIC cache_name *
+find_name(const char *hostname)
+{
+	cache_name *name, *found = NULL;
+
+	if (n_name_hash == 0) {
+		return (NULL);
 	}
-	if (e == n_entry) {
-		n_entry++;
+	for (name = name_hash[name_bucket(hostname)]; name != NULL; name = name->hash_next) {
+		if ((strcmp(hostname, name->hostname) != 0) || ((name->entry->ipaddr == 0) && (name->resolved == 0))) {
+			continue;
+		}
+		if ((found == NULL) || (name->resolved == 0) || ((found->resolved != 0) && (name->resolved > found->resolved))) {
+			found = name;
+		}
+		if (found->resolved == 0) {
+			break;
+		}
 	}
-	return (entry);
+	return (found);
 }
 
 
-STATIC cache_entry *
-find_host_entry(char *hostname)
+STATIC int
+expired(time_t resolved, int negative)
 {
-	cache_entry *entry = &hcache[0];
-	char **ehost;
-	int e, h;
-	char first = *hostname;
-
-	for (e = 0; e < n_entry; e++, entry++) {
-		ehost = &entry->hostname[0];
-		for (h = 0; h < 5; h++, ehost++) {
-			if (*ehost && (first == **ehost) && (strcmp(hostname, *ehost) == 0)) {
-				return (entry);
-			}
-		}
+	if (resolved == 0) {
+		return (0);
 	}
-	return (NULL);
+	return (time(NULL) - resolved >= (negative ? hcache_negative_ttl : hcache_ttl));
+}
+
+
+STATIC int
+name_expired(cache_name *name)
+{
+	return (expired(name->resolved, name->entry->ipaddr == 0));
 }
 
 
@@ -238,42 +352,188 @@ void
 hcache_update_file()
 {
 	FILE *file;
+	cache_entry *entry;
+	int i;
+
+	if ((last_filename == NULL) || (n_dirty == 0)) {
+		return;
+	}
 
-	if ((last_filename == NULL) || (n_changes == 0)) {
+	if (torn || ((n_records + n_dirty > COMPACT_MIN) && (n_records + n_dirty > 2 * n_live))) {
+		compact_file();
 		return;
 	}
 
-	file = fopen(last_filename, "w");
+	file = fopen(last_filename, "a");
 	if (file == NULL) {
 		perror(last_filename);
 		return;
 	}
-	write_file(file);
+
+	for (i = 0; i < n_dirty; i++) {
+		entry = dirty[i];
+		if (entry == NULL) {
+			continue;
+		}
+		entry->dirty = 0;
+		n_records += write_entry(file, entry, 0);
+	}
+	n_dirty = 0;
+	fclose(file);
 }
 
 
+/*
+ * Write the live entries to a new file and move it over the old one, so
+ * a crash leaves one or the other
+ */
 STATIC void
+compact_file()
+{
+	FILE *file;
+	cache_name *name;
+	char *tmpname;
+	int e, i;
+
+	tmpname = (char *)malloc(strlen(last_filename) + 5);
+	sprintf(tmpname, "%s.tmp", last_filename);
+	file = fopen(tmpname, "w");
+	if (file == NULL) {
+		perror(tmpname);
+		free(tmpname);
+		return;
+	}
+	debug(2, "compacting host cache, %d lines for %d entries\n", n_records + n_dirty, n_live);
+	n_records = write_file(file);
+
+#ifdef _WIN32
+		remove(last_filename);
+#endif
+	if (rename(tmpname, last_filename) != 0) {
+		perror(last_filename);
+	}
+	free(tmpname);
+	torn = 0;
+
+	for (e = 0; e < n_entry; e++) {
+		if (hcache[e] != NULL) {
+			for (name = hcache[e]->names; name != NULL; name = name->next) {
+				name->written = 1;
+			}
+			hcache[e]->written = 1;
+		}
+	}
+	for (i = 0; i < n_dirty; i++) {
+		if (dirty[i] != NULL) {
+			dirty[i]->dirty = 0;
+		}
+	}
+	n_dirty = 0;
+}
+
+
+STATIC void
+mark_dirty(cache_entry *entry)
+{
+	if (loading || entry->dirty) {
+		return;
+	}
+	if (n_dirty == max_dirty) {
+		max_dirty = max_dirty ? max_dirty * 2 : 64;
+		dirty = (cache_entry **)realloc(dirty, sizeof(cache_entry *) * max_dirty);
+	}
+	dirty[n_dirty++] = entry;
+	entry->dirty = n_dirty;
+}
+
+
+STATIC int
 write_file(FILE *file)
 {
-	int e, h;
+	int e, lines = 0;
 
 	for (e = 0; e < n_entry; e++) {
-		unsigned long ipaddr = hcache[e].ipaddr;
-		if (ipaddr == 0) {
-			continue;
+		if (hcache[e] != NULL) {
+			lines += write_entry(file, hcache[e], 1);
 		}
-		fprintf(file, "%lu.%lu.%lu.%lu", (ipaddr & 0xff000000) >> 24,
-		    (ipaddr & 0xff0000) >> 16, (ipaddr & 0xff00) >> 8, ipaddr & 0xff);
-		if (hcache[e].hostname[0]) {
-			for (h = 0; h < 5; h++) {
-				if (hcache[e].hostname[h] != NULL) {
-					fprintf(file, "%c%s", h ? ' ' : '\t', hcache[e].hostname[h]);
-				}
+	}
+	fclose(file);
+	return (lines);
+}
+
+
+STATIC int
+write_entry(FILE *file, cache_entry *entry, int all)
+{
+	cache_name *name;
+	char ipstr[16];
+	int len = 0, lines = 0;
+	time_t resolved = 0;
+
+	sprintf(ipstr, "%lu.%lu.%lu.%lu", (entry->ipaddr & 0xff000000) >> 24,
+	    (entry->ipaddr & 0xff0000) >> 16, (entry->ipaddr & 0xff00) >> 8, entry->ipaddr & 0xff);
+
+	for (name = entry->names; name != NULL; name = name->next) {
+		if (all) {
+			if (name_expired(name)) {
+				continue;
 			}
+		} else {
+			if (name->written) {
+				continue;
+			}
+			name->written = 1;
+		}
+
+		if (entry->ipaddr == 0) {
+			// a host name that wasn't found
+			fprintf(file, "%s", name->hostname);
+			end_line(file, name->resolved);
+			lines++;
+			continue;
+		}
+
+		// names looked up at different times go on different lines
+		if (len && ((name->resolved != resolved) || (len + 1 + strlen(name->hostname) > WRITE_LINE_MAX))) {
+			end_line(file, resolved);
+			lines++;
+			len = 0;
+		}
+		if (len == 0) {
+			len = fprintf(file, "%s\t%s", ipstr, name->hostname);
+			resolved = name->resolved;
+		} else {
+			len += fprintf(file, " %s", name->hostname);
 		}
-		fprintf(file, "\n");
 	}
-	fclose(file);
+	if (len) {
+		end_line(file, resolved);
+		lines++;
+	}
+
+	// an address without a name
+	if (entry->ipaddr != 0) {
+		if (all ? ((entry->resolved != 0) ? !expired(entry->resolved, 1) : (entry->names == NULL)) : (!entry->written && (entry->resolved != 0))) {
+			fprintf(file, "%s", ipstr);
+			end_line(file, entry->resolved);
+			lines++;
+		}
+	}
+	if (!all) {
+		entry->written = 1;
+	}
+
+	return (lines);
+}
+
+
+STATIC void
+end_line(FILE *file, time_t resolved)
+{
+	if (resolved != 0) {
+		fprintf(file, "\t#%lu", (unsigned long)resolved);
+	}
+	fprintf(file, "\n");
 }
 
 
@@ -283,8 +543,8 @@ hcache_invalidate()
 	int e;
 
 	for (e = 0; e < n_entry; e++) {
-		if (hcache[e].ipaddr != 0) {
-			memset(&hcache[e].hostname[0], 0, sizeof(hcache[e].hostname));
+		if ((hcache[e] != NULL) && (hcache[e]->ipaddr != 0)) {
+			free_names(hcache[e]);
 		}
 	}
 }
@@ -297,28 +557,34 @@ hcache_validate()
 	char **alias;
 	struct hostent *ent;
 	unsigned long ipaddr;
-	cache_entry *entry;
+	cache_entry *entry, *tmp;
+	time_t now = time(NULL);
 
 	for (e = 0; e < n_entry; e++) {
+		entry = hcache[e];
+		if (entry == NULL) {
+			continue;
+		}
 		fprintf(stderr, "\r%d / %d  validating ", e, n_entry);
-		if (hcache[e].ipaddr != 0) {
-			ipaddr = hcache[e].ipaddr;
+		if (entry->ipaddr != 0) {
+			ipaddr = entry->ipaddr;
 			fprintf(stderr, "%lu.%lu.%lu.%lu", (ipaddr & 0xff000000) >> 24,
 			    (ipaddr & 0xff0000) >> 16, (ipaddr & 0xff00) >> 8, ipaddr & 0xff);
 			ipaddr = htonl(ipaddr);
 			ent = gethostbyaddr((char *)&ipaddr, sizeof(unsigned long),
 				AF_INET);
-		} else if (hcache[e].hostname[0] != NULL) {
-			fprintf(stderr, "%s", hcache[e].hostname[0]);
-			ent = gethostbyname(hcache[e].hostname[0]);
+		} else if (entry->names != NULL) {
+			fprintf(stderr, "%s", entry->names->hostname);
+			ent = gethostbyname(entry->names->hostname);
 			if (ent != NULL) {
 				memcpy(&ipaddr, ent->h_addr_list[0], sizeof(ipaddr));
 				ipaddr = ntohl(ipaddr);
-				if ((entry = find_entry(ipaddr)) != NULL) {
-					add_hostname(entry, hcache[e].hostname[0]);
-					free_entry(&hcache[e]);
+				if ((tmp = find_entry(ipaddr)) != NULL) {
+					add_hostname(tmp, entry->names->hostname, now);
+					free_entry(entry);
+					entry = tmp;
 				} else {
-					hcache[e].ipaddr = ipaddr;
+					set_ipaddr(entry, ipaddr);
 				}
 			}
 		} else {
@@ -329,12 +595,12 @@ hcache_validate()
 		}
 
 		if (ent->h_name && (ent->h_name[0] != '\0')) {
-			add_hostname(&hcache[e], ent->h_name);
+			add_hostname(entry, ent->h_name, now);
 		}
 		printf("h_name %s\n", ent->h_name ? ent->h_name : "NULL");
 		alias = ent->h_aliases;
 		while (*alias) {
-			add_hostname(&hcache[e], *alias);
+			add_hostname(entry, *alias, now);
 			printf("h_aliases %s\n", *alias);
 			alias++;
 		}
@@ -346,30 +612,34 @@ STATIC cache_entry *
 validate_entry(cache_entry *entry)
 {
 	struct hostent *ent;
+	struct in_addr addr;
 	char **alias;
 	cache_entry *tmp;
 	unsigned long ipaddr;
+	time_t now = time(NULL);
 
 	if (entry->ipaddr != 0) {
-		ipaddr = htonl(entry->ipaddr);
-
-/*	    fprintf( stderr, "%u.%u.%u.%u", (ipaddr&0xff000000)>>24,
- *      (ipaddr&0xff0000)>>16, (ipaddr&0xff00)>>8, ipaddr&0xff);
- */
-		ent = gethostbyaddr((char *)&ipaddr, sizeof(unsigned long), AF_INET);
-	} else if (entry->hostname[0] != NULL) {
-/*      fprintf( stderr, "%s", entry->hostname[0]);
- */
-		ent = gethostbyname(entry->hostname[0]);
+		addr.s_addr = htonl(entry->ipaddr);
+		ent = gethostbyaddr((char *)&addr, sizeof(addr), AF_INET);
+		if (ent == NULL) {
+			// remembered as having no name until it expires
+			entry->resolved = now;
+			entry->written = 0;
+			mark_dirty(entry);
+			return (NULL);
+		}
+	} else if (entry->names != NULL) {
+		// left as not found if it isn't
+		ent = gethostbyname(entry->names->hostname);
 		if (ent != NULL) {
 			memcpy(&ipaddr, ent->h_addr_list[0], sizeof(ipaddr));
 			ipaddr = ntohl(ipaddr);
 			if ((tmp = find_entry(ipaddr)) != NULL) {
-				add_hostname(tmp, entry->hostname[0]);
+				add_hostname(tmp, entry->names->hostname, now);
 				free_entry(entry);
 				entry = tmp;
 			} else {
-				entry->ipaddr = ipaddr;
+				set_ipaddr(entry, ipaddr);
 			}
 		}
 	} else {
@@ -381,11 +651,11 @@ validate_entry(cache_entry *entry)
 	}
 
 	if (ent->h_name && (ent->h_name[0] != '\0')) {
-		add_hostname(entry, ent->h_name);
+		add_hostname(entry, ent->h_name, now);
 	}
 	alias = ent->h_aliases;
 	while (*alias) {
-		add_hostname(entry, *alias);
+		add_hostname(entry, *alias, now);
 		alias++;
 	}
 	return (entry);
@@ -396,23 +666,14 @@ unsigned long
 hcache_lookup_hostname(char *hostname)
 {
 	cache_entry *entry;
-	int e, h;
+	unsigned long ipaddr;
 
 	debug(1, "looking up %s\n", hostname);
-	for (e = 0; e < n_entry; e++) {
-		for (h = 0; h < 5; h++) {
-			if (hcache[e].hostname[h] &&
-			    (strcmp(hostname, hcache[e].hostname[h]) == 0)) {
-				return (hcache[e].ipaddr);
-			}
-		}
-	}
-	entry = init_entry(0, hostname, NULL);
-	if (entry->ipaddr == 0) {
-		debug(2, "validating %s\n", hostname);
-		entry = validate_entry(entry);
-		n_changes++;
+	if (hcache_find_hostname(hostname, &ipaddr)) {
+		return (ipaddr ? ipaddr : INADDR_NONE);
 	}
+	debug(2, "validating %s\n", hostname);
+	entry = validate_entry(add_not_found(hostname, time(NULL)));
 	if ((entry != NULL) && entry->ipaddr) {
 		debug(2, "returning %lx\n", entry->ipaddr);
 		return (entry->ipaddr);
@@ -424,67 +685,247 @@ hcache_lookup_hostname(char *hostname)
 
 char *
 hcache_lookup_ipaddr(unsigned long ipaddr)
+{
+	char *hostname;
+
+	if (hcache_find_ipaddr(ipaddr, &hostname)) {
+		return (hostname);
+	}
+	debug(1, "validating %lx\n", ipaddr);
+	validate_entry(init_entry(ipaddr));
+	return (hcache_find_ipaddr(ipaddr, &hostname) ? hostname : NULL);
+}
+
+
+int
+hcache_find_hostname(char *hostname, unsigned long *ipaddr)
+{
+	cache_name *name = find_name(hostname);
+
+	if ((name == NULL) || name_expired(name)) {
+		return (0);
+	}
+	*ipaddr = name->entry->ipaddr;
+	return (1);
+}
+
+
+void
+hcache_add_hostname(char *hostname, unsigned long ipaddr, char *canonical)
 {
 	cache_entry *entry;
-	int e;
+	time_t now = time(NULL);
 
-	for (e = 0; e < n_entry; e++) {
-		if (hcache[e].ipaddr == ipaddr) {
-			return (hcache[e].hostname[0]);
+	if (ipaddr == 0) {
+		add_not_found(hostname, now);
+		return;
+	}
+
+	// any older entries for the name lose to this one until they expire
+	entry = init_entry(ipaddr);
+	add_hostname(entry, hostname, now);
+	if (canonical && (canonical[0] != '\0')) {
+		add_hostname(entry, canonical, now);
+	}
+}
+
+
+int
+hcache_find_ipaddr(unsigned long ipaddr, char **hostname)
+{
+	cache_entry *entry = find_entry(ipaddr);
+	cache_name *name;
+
+	if (entry == NULL) {
+		return (0);
+	}
+	for (name = entry->names; name != NULL; name = name->next) {
+		if (!name_expired(name)) {
+			*hostname = name->hostname;
+			return (1);
 		}
 	}
-	entry = init_entry(ipaddr, 0, NULL);
-	debug(1, "validating %lx\n", ipaddr);
-	validate_entry(entry);
-	n_changes++;
-	return (entry ? entry->hostname[0] : NULL);
+	if ((entry->resolved != 0) ? !expired(entry->resolved, 1) : (entry->names == NULL)) {
+		*hostname = NULL;
+		return (1);
+	}
+	return (0);
+}
+
+
+void
+hcache_add_ipaddr(unsigned long ipaddr, char *hostname)
+{
+	cache_entry *entry = init_entry(ipaddr);
+
+	if (hostname && (hostname[0] != '\0')) {
+		add_hostname(entry, hostname, time(NULL));
+	} else {
+		entry->resolved = time(NULL);
+		entry->written = loading;
+		mark_dirty(entry);
+	}
 }
 
 
 STATIC cache_entry *
 find_entry(unsigned long ipaddr)
 {
-	int e;
+	cache_entry *entry;
 
-	for (e = 0; e < n_entry; e++) {
-		if (hcache[e].ipaddr == ipaddr) {
-			return (&hcache[e]);
+	if (n_ip_hash == 0) {
+		return (NULL);
+	}
+	for (entry = ip_hash[ip_bucket(ipaddr)]; entry != NULL; entry = entry->hash_next) {
+		if (entry->ipaddr == ipaddr) {
+			return (entry);
 		}
 	}
 	return (NULL);
 }
 
 
+STATIC void
+set_ipaddr(cache_entry *entry, unsigned long ipaddr)
+{
+	cache_entry **old_hash = ip_hash, *e, *next;
+	unsigned int i, old_size = ip_hash_size, bucket;
+
+	if (n_ip_hash >= ip_hash_size) {
+		ip_hash_size = ip_hash_size ? ip_hash_size * 2 : HASH_SIZE_MIN;
+		ip_hash = (cache_entry **)calloc(ip_hash_size, sizeof(cache_entry *));
+		for (i = 0; i < old_size; i++) {
+			for (e = old_hash[i]; e != NULL; e = next) {
+				next = e->hash_next;
+				bucket = ip_bucket(e->ipaddr);
+				e->hash_next = ip_hash[bucket];
+				ip_hash[bucket] = e;
+			}
+		}
+		free(old_hash);
+	}
+
+	entry->ipaddr = ipaddr;
+	bucket = ip_bucket(ipaddr);
+	entry->hash_next = ip_hash[bucket];
+	ip_hash[bucket] = entry;
+	n_ip_hash++;
+	mark_dirty(entry);
+}
+
+
 STATIC void
 free_entry(cache_entry *entry)
 {
-	int h;
+	cache_entry **prev;
 
-	for (h = 0; h < 5; h++) {
-		if (entry->hostname[h] != NULL) {
-			free(entry->hostname[h]);
+	if (entry->ipaddr != 0) {
+		for (prev = &ip_hash[ip_bucket(entry->ipaddr)]; *prev != entry; prev = &(*prev)->hash_next) {
 		}
+		*prev = entry->hash_next;
+		n_ip_hash--;
+	}
+	free_names(entry);
+	if (entry->dirty) {
+		dirty[entry->dirty - 1] = NULL;
 	}
-	memset(entry, 0, sizeof(*entry));
+	hcache[entry->index] = NULL;
+	n_live--;
+	free(entry);
 }
 
 
 STATIC void
-add_hostname(cache_entry *entry, const char *hostname)
+free_names(cache_entry *entry)
 {
-	int h;
+	cache_name *name, *next, **prev;
 
-	for (h = 0; h < 5; h++) {
-		if (entry->hostname[h] == NULL) {
-			break;
+	for (name = entry->names; name != NULL; name = next) {
+		next = name->next;
+		for (prev = &name_hash[name_bucket(name->hostname)]; *prev != name; prev = &(*prev)->hash_next) {
 		}
-		if (strcmp(entry->hostname[h], hostname) == 0) {
+		*prev = name->hash_next;
+		n_name_hash--;
+		free(name->hostname);
+		free(name);
+	}
+	entry->names = NULL;
+	entry->last_name = &entry->names;
+}
+
+
+/*
+ * Adds hostname to entry or refreshes it if it's there. Names go on the
+ * end of their bucket so of names which never expire, the first given
+ * for an address keeps being found.
+ */
+STATIC void
+add_hostname(cache_entry *entry, const char *hostname, time_t resolved)
+{
+	cache_name **old_hash = name_hash, *name, *next, **tail;
+	unsigned int i, old_size = name_hash_size;
+
+	for (name = entry->names; name != NULL; name = name->next) {
+		if (strcmp(name->hostname, hostname) == 0) {
+			if ((name->resolved != 0) && (resolved > name->resolved)) {
+				name->resolved = resolved;
+				name->written = loading;
+				mark_dirty(entry);
+			}
 			return;
 		}
 	}
-	if (h < 5) {
-		entry->hostname[h] = strdup(hostname);
+
+	if (n_name_hash >= name_hash_size) {
+		name_hash_size = name_hash_size ? name_hash_size * 2 : HASH_SIZE_MIN;
+		name_hash = (cache_name **)calloc(name_hash_size, sizeof(cache_name *));
+		for (i = 0; i < old_size; i++) {
+			for (name = old_hash[i]; name != NULL; name = next) {
+				next = name->hash_next;
+				name->hash_next = NULL;
+				for (tail = &name_hash[name_bucket(name->hostname)]; *tail != NULL; tail = &(*tail)->hash_next) {
+				}
+				*tail = name;
+			}
+		}
+		free(old_hash);
+	}
+
+	name = (cache_name *)calloc(1, sizeof(cache_name));
+	name->hostname = strdup(hostname);
+	name->entry = entry;
+	name->resolved = resolved;
+	name->written = loading;
+	*entry->last_name = name;
+	entry->last_name = &name->next;
+
+	for (tail = &name_hash[name_bucket(hostname)]; *tail != NULL; tail = &(*tail)->hash_next) {
+	}
+	*tail = name;
+	n_name_hash++;
+	mark_dirty(entry);
+}
+
+
+/*
+ * Records that hostname wasn't found, in the entry of an earlier failure
+ * if it has one
+ */
+STATIC cache_entry *
+add_not_found(const char *hostname, time_t resolved)
+{
+	cache_name *name = find_name(hostname);
+	cache_entry *entry;
+
+	if ((name != NULL) && (name->entry->ipaddr == 0)) {
+		name->resolved = resolved;
+		name->written = loading;
+		mark_dirty(name->entry);
+		return (name->entry);
 	}
+	entry = new_entry(0);
+	add_hostname(entry, hostname, resolved);
+	return (entry);
 }
 
 
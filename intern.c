@@ -0,0 +1,130 @@
+/*
+ * qstat
+ * by Steve Jankowski
+ *
+ * Shared copies of repeated strings
+ *
+ * Every server of a type sends the same rule names and a lot of the same
+ * values and team names, so rather than a copy per server they share one
+ * which lives until exit. Being shared they must never be changed or
+ * freed. The table is capped so a stream of unique strings, as in daemon
+ * mode, can't grow it without bound; once it's full callers copy again.
+ *
+ * Licensed under the Artistic License, see LICENSE.txt for license terms
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "qstat.h"
+#include "arena.h"
+#include "intern.h"
+
+#define INTERN_SIZE_MIN    1024
+#define INTERN_MAX         65536
+
+static struct arena strings;
+static char **table;
+static unsigned int table_size;
+static unsigned int n_strings;
+
+
+static unsigned int
+hash_string(const char *string, size_t len)
+{
+	unsigned int h = 2166136261u;
+
+	for ( ; len; len--, string++) {
+		h = (h ^ (unsigned char)*string) * 16777619u;
+	}
+
+	return (h);
+}
+
+
+static void
+grow_table()
+{
+	char **old_table = table;
+	unsigned int i, old_size = table_size, slot;
+
+	table_size = table_size ? table_size * 2 : INTERN_SIZE_MIN;
+	table = (char **)calloc(table_size, sizeof(char *));
+	for (i = 0; i < old_size; i++) {
+		if (old_table[i] == NULL) {
+			continue;
+		}
+		slot = hash_string(old_table[i], strlen(old_table[i])) & (table_size - 1);
+		while (table[slot] != NULL) {
+			slot = (slot + 1) & (table_size - 1);
+		}
+		table[slot] = old_table[i];
+	}
+	free(old_table);
+}
+
+
+char *
+intern_n(const char *string, size_t len)
+{
+	const char *end = memchr(string, '\0', len);
+	unsigned int slot;
+	char *copy;
+
+	if (end != NULL) {
+		len = end - string;
+	}
+
+	// kept at most half full so probes stay short
+	if ((n_strings * 2 >= table_size) && (n_strings < INTERN_MAX)) {
+		grow_table();
+	}
+
+	slot = hash_string(string, len) & (table_size - 1);
+	for ( ; table[slot] != NULL; slot = (slot + 1) & (table_size - 1)) {
+		if ((strncmp(table[slot], string, len) == 0) && (table[slot][len] == '\0')) {
+			return (table[slot]);
+		}
+	}
+	if (n_strings >= INTERN_MAX) {
+		return (NULL);
+	}
+
+	copy = arena_strndup(&strings, string, len);
+	table[slot] = copy;
+	n_strings++;
+
+	return (copy);
+}
+
+
+char *
+intern(const char *string)
+{
+	return (intern_n(string, strlen(string)));
+}
+
+
+char *
+intern_strdup(struct arena *arena, const char *string)
+{
+	char *copy = intern(string);
+
+	return (copy ? copy : arena_strdup(arena, string));
+}
+
+
+char *
+intern_strndup(struct arena *arena, const char *string, size_t len)
+{
+	char *copy = intern_n(string, len);
+
+	return (copy ? copy : arena_strndup(arena, string, len));
+}
+
+
+int
+interned(const void *string)
+{
+	return (arena_owns(&strings, string));
+}
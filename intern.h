@@ -0,0 +1,46 @@
+/*
+ * qstat
+ * by Steve Jankowski
+ *
+ * Shared copies of repeated strings
+ *
+ * Licensed under the Artistic License, see LICENSE.txt for license terms
+ */
+#ifndef QSTAT_INTERN_H
+#define QSTAT_INTERN_H
+
+#include <stddef.h>
+
+#include "qstat.h"
+
+/* Longer values than this are likely one off, such as a server's name */
+#define INTERN_VALUE_MAX    32
+
+/**
+ * \returns the one shared copy of string, which must not be changed or
+ * freed, or NULL if the table is full and the caller should copy it
+ */
+char *intern(const char *string);
+
+/**
+ * Like intern, but of at most len chars of string
+ */
+char *intern_n(const char *string, size_t len);
+
+/**
+ * \returns the shared copy of string, or a copy from arena if the table
+ * is full
+ */
+char *intern_strdup(struct arena *arena, const char *string);
+
+/**
+ * Like intern_strdup, but of at most len chars of string
+ */
+char *intern_strndup(struct arena *arena, const char *string, size_t len);
+
+/**
+ * \returns non-zero if string is a shared copy from intern
+ */
+int interned(const void *string);
+
+#endif
@@ -0,0 +1,297 @@
+/*
+ * qstat
+ * by Steve Jankowski
+ *
+ * Master server list cache
+ *
+ * Master lists change slowly but can take several round trips to fetch,
+ * so the lists masters send are kept in a file and reused by later runs
+ * until they're older than mcache_ttl.
+ *
+ * The file starts with MCACHE_MAGIC, then for each master:
+ *   4 bytes   when the list was fetched, seconds since the epoch
+ *   2 bytes   key length
+ *   key       master type, address and query argument
+ *   4 bytes   number of servers
+ *   6 bytes   for each server, its address and port as in master_pkt
+ * Numbers are in network byte order.
+ *
+ * Licensed under the Artistic License, see LICENSE.txt for license terms
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "qstat.h"
+#include "mcache.h"
+#include "debug.h"
+
+#define MCACHE_MAGIC      "QSTATMC1"
+#define MCACHE_KEY_MAX    1024
+#define MCACHE_LIST_MAX   (1 << 24)
+
+typedef struct _mcache_entry {
+	char *key;
+	time_t fetched;
+	char *list;
+	int len;
+} mcache_entry;
+
+int mcache_ttl = MCACHE_TTL_DEFAULT;
+
+static char *cache_filename = NULL;
+static mcache_entry *entries = NULL;
+static int n_entries = 0;
+static int max_entries = 0;
+static int changed = 0;
+
+
+static char *
+master_key(struct qserver *server)
+{
+	char *key;
+
+	key = (char *)malloc(strlen(server->type->type_string) + strlen(server->arg) + (server->query_arg ? strlen(server->query_arg) : 0) + 3);
+	sprintf(key, "%s %s %s", server->type->type_string, server->arg, server->query_arg ? server->query_arg : "");
+
+	return (key);
+}
+
+
+static mcache_entry *
+find_entry(const char *key)
+{
+	int i;
+
+	for (i = 0; i < n_entries; i++) {
+		if (strcmp(entries[i].key, key) == 0) {
+			return (&entries[i]);
+		}
+	}
+
+	return (NULL);
+}
+
+
+static mcache_entry *
+add_entry(char *key)
+{
+	mcache_entry *entry;
+
+	if (n_entries == max_entries) {
+		max_entries = max_entries ? max_entries * 2 : 16;
+		entries = (mcache_entry *)realloc(entries, max_entries * sizeof(mcache_entry));
+	}
+	entry = &entries[n_entries++];
+	memset(entry, 0, sizeof(mcache_entry));
+	entry->key = key;
+
+	return (entry);
+}
+
+
+static int
+read_number(FILE *file, int size, unsigned long *value)
+{
+	unsigned char buf[4];
+	int i;
+
+	if (fread(buf, 1, size, file) != (size_t)size) {
+		return (-1);
+	}
+	for (*value = 0, i = 0; i < size; i++) {
+		*value = (*value << 8) | buf[i];
+	}
+
+	return (0);
+}
+
+
+static void
+write_number(FILE *file, int size, unsigned long value)
+{
+	unsigned char buf[4];
+	int i;
+
+	for (i = size - 1; i >= 0; i--, value >>= 8) {
+		buf[i] = value & 0xff;
+	}
+	fwrite(buf, 1, size, file);
+}
+
+
+int
+mcache_open(char *filename)
+{
+	FILE *file;
+	char magic[sizeof(MCACHE_MAGIC) - 1];
+	unsigned long fetched, key_len, n_servers;
+	mcache_entry *entry;
+	char *key;
+
+	cache_filename = filename;
+	file = fopen(filename, "rb");
+	if (file == NULL) {
+		if (errno == ENOENT) {
+			debug(2, "Creating new master cache \"%s\"\n", filename);
+			return (0);
+		}
+		perror(filename);
+		return (-1);
+	}
+
+	if ((fread(magic, 1, sizeof(magic), file) != sizeof(magic)) || (memcmp(magic, MCACHE_MAGIC, sizeof(magic)) != 0)) {
+		fprintf(stderr, "%s: not a master cache file\n", filename);
+		fclose(file);
+		return (-1);
+	}
+
+	for ( ; ; ) {
+		if ((read_number(file, 4, &fetched) != 0) || (read_number(file, 2, &key_len) != 0) || (key_len > MCACHE_KEY_MAX)) {
+			break;
+		}
+		key = (char *)malloc(key_len + 1);
+		if ((fread(key, 1, key_len, file) != key_len) || (read_number(file, 4, &n_servers) != 0) || (n_servers > MCACHE_LIST_MAX)) {
+			free(key);
+			break;
+		}
+		key[key_len] = '\0';
+
+		// a later list for the same master replaces it
+		if ((entry = find_entry(key)) != NULL) {
+			free(key);
+			free(entry->list);
+		} else {
+			entry = add_entry(key);
+		}
+		entry->fetched = fetched;
+		entry->len = n_servers * 6;
+		entry->list = (char *)malloc(entry->len ? entry->len : 1);
+		if (fread(entry->list, 1, entry->len, file) != (size_t)entry->len) {
+			// cut short, the master is queried again
+			entry->fetched = 0;
+			break;
+		}
+	}
+	fclose(file);
+	debug(2, "%d master lists in %s\n", n_entries, filename);
+
+	return (0);
+}
+
+
+int
+mcache_fill(struct qserver *server)
+{
+	mcache_entry *entry;
+	char *key;
+	time_t age;
+
+	if (cache_filename == NULL) {
+		return (0);
+	}
+
+	key = master_key(server);
+	entry = find_entry(key);
+	free(key);
+	if (entry == NULL) {
+		return (0);
+	}
+	age = time(NULL) - entry->fetched;
+	if ((age < 0) || (age >= mcache_ttl)) {
+		return (0);
+	}
+
+	debug(1, "using list of %d servers cached %lds ago for %s\n", entry->len / 6, (long)age, server->arg);
+	server->master_pkt = (char *)malloc(entry->len ? entry->len : 1);
+	memcpy(server->master_pkt, entry->list, entry->len);
+	server->master_pkt_len = entry->len;
+	server->n_servers = entry->len / 6;
+	server->flags |= FLAG_MASTER_CACHED;
+
+	// it wasn't asked, so it's shown as answering at once rather than
+	// with the 999 of a master that never replied
+	server->n_requests = 1;
+	server->ping_total = 0;
+
+	return (1);
+}
+
+
+void
+mcache_store(struct qserver *server)
+{
+	mcache_entry *entry;
+	char *key;
+
+	if ((cache_filename == NULL) || (server->flags & FLAG_MASTER_CACHED) || (server->master_pkt == NULL)) {
+		return;
+	}
+
+	key = master_key(server);
+	if ((entry = find_entry(key)) != NULL) {
+		free(key);
+		free(entry->list);
+	} else {
+		entry = add_entry(key);
+	}
+	entry->fetched = time(NULL);
+	entry->len = server->master_pkt_len - server->master_pkt_len % 6;
+	entry->list = (char *)malloc(entry->len ? entry->len : 1);
+	memcpy(entry->list, server->master_pkt, entry->len);
+	changed = 1;
+}
+
+
+void
+mcache_write()
+{
+	FILE *file;
+	char *tmpname;
+	time_t now = time(NULL);
+	int i;
+
+	if ((cache_filename == NULL) || !changed) {
+		return;
+	}
+
+	tmpname = (char *)malloc(strlen(cache_filename) + 5);
+	sprintf(tmpname, "%s.tmp", cache_filename);
+	file = fopen(tmpname, "wb");
+	if (file == NULL) {
+		perror(tmpname);
+		free(tmpname);
+		return;
+	}
+
+	fwrite(MCACHE_MAGIC, 1, sizeof(MCACHE_MAGIC) - 1, file);
+	for (i = 0; i < n_entries; i++) {
+		if ((now - entries[i].fetched >= mcache_ttl) || (strlen(entries[i].key) > MCACHE_KEY_MAX)) {
+			// out of date, or too long to be read back
+			continue;
+		}
+		write_number(file, 4, entries[i].fetched);
+		write_number(file, 2, strlen(entries[i].key));
+		fwrite(entries[i].key, 1, strlen(entries[i].key), file);
+		write_number(file, 4, entries[i].len / 6);
+		fwrite(entries[i].list, 1, entries[i].len, file);
+	}
+
+	if (fclose(file) != 0) {
+		perror(tmpname);
+		remove(tmpname);
+		free(tmpname);
+		return;
+	}
+#ifdef _WIN32
+		remove(cache_filename);
+#endif
+	if (rename(tmpname, cache_filename) != 0) {
+		perror(cache_filename);
+	}
+	free(tmpname);
+	changed = 0;
+}
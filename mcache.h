@@ -0,0 +1,43 @@
+/*
+ * qstat
+ * by Steve Jankowski
+ *
+ * Master server list cache
+ *
+ * Licensed under the Artistic License, see LICENSE.txt for license terms
+ */
+#ifndef QSTAT_MCACHE_H
+#define QSTAT_MCACHE_H
+
+#include "qstat.h"
+
+#define MCACHE_TTL_DEFAULT    900
+
+/** \brief seconds a cached master list is used for, set by -mcachettl */
+extern int mcache_ttl;
+
+/**
+ * Read the master lists cached in filename, which needn't exist yet
+ *
+ * \returns 0 on success, -1 if it can't be read
+ */
+int mcache_open(char *filename);
+
+/**
+ * Give master the list cached for it, if it's not older than mcache_ttl
+ *
+ * \returns 1 if master_pkt was filled in, 0 if it must be queried
+ */
+int mcache_fill(struct qserver *server);
+
+/**
+ * Record the list master has just sent
+ */
+void mcache_store(struct qserver *server);
+
+/**
+ * Write the cache file out if any lists were stored since it was read
+ */
+void mcache_write();
+
+#endif
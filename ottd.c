@@ -15,6 +15,7 @@
 #include <stdlib.h>
 
 #include "qstat.h"
+#include "arena.h"
 #include "qserver.h"
 #include "debug.h"
 
@@ -45,7 +46,7 @@ deal_with_ottdmaster_packet(struct qserver *server, char *rawpkt, int pktlen)
 {
 	unsigned num;
 
-	server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+	server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 	server->server_name = MASTER;
 
 	if (swap_short_from_little(rawpkt) != pktlen) {
@@ -123,10 +124,10 @@ deal_with_ottd_packet(struct qserver *server, char *rawpkt, int pktlen)
 
 	server->n_servers++;
 	if (server->server_name == NULL) {
-		server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+		server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 		server->n_requests++;
 	} else {
-		gettimeofday(&server->packet_time1, NULL);
+		server->packet_time1 = qtime_now();
 	}
 
 	FAIL_IF(pktlen < 4 || swap_short_from_little(rawpkt) > pktlen, "invalid packet");
@@ -233,7 +234,7 @@ deal_with_ottd_packet(struct qserver *server, char *rawpkt, int pktlen)
 			FAIL_IF(!player, "can't allocate player");
 
 			GET_STRING;
-			player->name = strdup(str);
+			player->name = arena_strdup(&server->arena, str);
 			debug(3, "name %s", str);
 			player->frags = 0;
 
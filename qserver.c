@@ -10,6 +10,9 @@
 
 #include "qstat.h"
 #include "qserver.h"
+#include "ratelimit.h"
+#include "rtt.h"
+#include "uring.h"
 #include "debug.h"
 
 #ifndef _WIN32
@@ -31,7 +34,7 @@ qserver_send_initial(struct qserver *server, const char *data, size_t len)
 	status = send_packet_raw(server, data, len);
 
 	if ((server->retry1 == n_retries) || server->flags & FLAG_BROADCAST) {
-		gettimeofday(&server->packet_time1, NULL);
+		server->packet_time1 = qtime_now();
 	} else {
 		server->n_retries++;
 	}
@@ -50,7 +53,7 @@ qserver_send(struct qserver *server, const char *data, size_t len)
 	status = send_packet_raw(server, data, len);
 
 	server->retry1 = n_retries - 1;
-	gettimeofday(&server->packet_time1, NULL);
+	server->packet_time1 = qtime_now();
 	server->n_requests++;
 	server->n_packets++;
 
@@ -62,6 +65,12 @@ send_broadcast(struct qserver *server, const char *pkt, size_t pktlen)
 {
 	struct sockaddr_in addr;
 
+	// the send time recorded for the packet
+	qtime_update();
+
+	ratelimit_charge(ratelimit_for(server), pktlen);
+	rtt_sent(server);
+
 	addr.sin_family = AF_INET;
 	if (no_port_offset || server->flags & TF_NO_PORT_OFFSET) {
 		addr.sin_port = htons(server->port);
@@ -74,6 +83,307 @@ send_broadcast(struct qserver *server, const char *pkt, size_t pktlen)
 	return (sendto(server->fd, (const char *)pkt, pktlen, 0, (struct sockaddr *)&addr, sizeof(addr)));
 }
 
+#if defined(HAVE_SENDMMSG) || defined(USE_IO_URING)
+	#define DEFERRED_SENDS
+
+	/*
+	 * Queued packets only go out when they're handed to the kernel, so
+	 * send times recorded for their servers since the first was queued
+	 * are moved up to then. Otherwise time spent queueing a large batch
+	 * would be counted in the servers' pings.
+	 */
+	static struct qserver **deferred;
+	static int n_deferred;
+	static int max_deferred;
+	static qtime_t deferred_since;
+
+	static void
+	defer_send_time(struct qserver *server)
+	{
+		struct qserver **new_deferred;
+
+		if (n_deferred == max_deferred) {
+			new_deferred = (struct qserver **)realloc(deferred, (max_deferred + 1024) * sizeof(struct qserver *));
+			if (new_deferred == NULL) {
+				// its ping will just include the wait for the flush
+				return;
+			}
+			deferred = new_deferred;
+			max_deferred += 1024;
+		}
+
+		if (n_deferred == 0) {
+			deferred_since = qtime_now();
+		}
+		deferred[n_deferred++] = server;
+	}
+#endif
+
+
+void
+qserver_stamp_sends(void)
+{
+#ifdef DEFERRED_SENDS
+		struct qserver *server;
+		qtime_t now;
+		int i;
+
+		if (n_deferred == 0) {
+			return;
+		}
+
+		now = qtime_update();
+		for (i = 0; i < n_deferred; i++) {
+			server = deferred[i];
+			if (server == NULL) {
+				continue;
+			}
+			if (server->packet_time1 >= deferred_since) {
+				server->packet_time1 = now;
+			}
+			if (server->packet_time2 >= deferred_since) {
+				server->packet_time2 = now;
+			}
+			if (server->rtt_sends == 1) {
+				// the queued packet is the only one outstanding
+				server->rtt_sent = now;
+			}
+		}
+		n_deferred = 0;
+#endif
+}
+
+
+void
+qserver_forget_sends(struct qserver *server)
+{
+#ifdef DEFERRED_SENDS
+		int i;
+
+		for (i = 0; i < n_deferred; i++) {
+			if (deferred[i] == server) {
+				deferred[i] = NULL;
+			}
+		}
+#endif
+}
+
+#if defined(HAVE_SENDMMSG) && !defined(USE_IO_URING)
+	/*
+	 * Shared sockets aren't tied to a server so requests for many servers
+	 * can go out in a single sendmmsg call. Packet data is copied into one
+	 * buffer which may move as it grows, so entries hold offsets into it.
+	 */
+	#define SEND_QUEUE_LEN    1024
+
+	struct queued_packet {
+		int fd;
+		struct sockaddr_in addr;
+		struct iovec iov;
+		size_t offset;
+		size_t len;
+	};
+
+	static struct queued_packet send_queue[SEND_QUEUE_LEN];
+	static int n_send_queue;
+	static char *send_data;
+	static size_t send_data_len;
+	static size_t send_data_size;
+
+	static int
+	queue_send(int fd, struct sockaddr_in *addr, const char *data, size_t len)
+	{
+		struct queued_packet *qp;
+
+		if (n_send_queue == SEND_QUEUE_LEN) {
+			qserver_flush_send_queue();
+			if (n_send_queue == SEND_QUEUE_LEN) {
+				// the socket buffers are still full
+				return (sendto(fd, data, len, 0, (struct sockaddr *)addr, sizeof(*addr)));
+			}
+		}
+
+		if (send_data_len + len > send_data_size) {
+			char *new_data;
+			size_t new_size = send_data_size ? send_data_size : 16384;
+			while (new_size < send_data_len + len) {
+				new_size *= 2;
+			}
+			new_data = (char *)realloc(send_data, new_size);
+			if (new_data == NULL) {
+				return (sendto(fd, data, len, 0, (struct sockaddr *)addr, sizeof(*addr)));
+			}
+			send_data = new_data;
+			send_data_size = new_size;
+		}
+
+		qp = &send_queue[n_send_queue++];
+		qp->fd = fd;
+		qp->addr = *addr;
+		qp->offset = send_data_len;
+		qp->len = len;
+		memcpy(send_data + send_data_len, data, len);
+		send_data_len += len;
+
+		return ((int)len);
+	}
+#endif
+
+
+int
+qserver_send_raw(struct qserver *server, const char *data, size_t len)
+{
+	struct sockaddr_in addr;
+#ifdef DEFERRED_SENDS
+		int rc;
+#endif
+
+	// every query, follow up and retry comes through here, so this
+	// is the send time recorded for the packet
+	qtime_update();
+
+	ratelimit_charge(ratelimit_for(server), len);
+	rtt_sent(server);
+
+	if (!(server->flags & FLAG_SHARED_SOCKET)) {
+#ifdef USE_IO_URING
+			// TCP stays synchronous as some protocols also write to the
+			// stream directly and the two mustn't be reordered
+			if (!(server->type->flags & TF_TCP_CONNECT)) {
+				rc = uring_send(server->fd, data, len, NULL);
+				defer_send_time(server);
+				return (rc);
+			}
+#endif
+		return (send(server->fd, data, len, 0));
+	}
+
+	// Shared sockets aren't connected so address the packet explicitly,
+	// using the port the server was added with just as connect would have
+	addr.sin_family = AF_INET;
+	if (no_port_offset || server->flags & TF_NO_PORT_OFFSET) {
+		addr.sin_port = htons(server->orig_port);
+	} else {
+		addr.sin_port = htons((unsigned short)(server->orig_port + server->type->port_offset));
+	}
+	addr.sin_addr.s_addr = server->ipaddr;
+	memset(&(addr.sin_zero), 0, sizeof(addr.sin_zero));
+
+#if defined(USE_IO_URING)
+		// after queueing, as a full queue is submitted first
+		rc = uring_send(server->fd, data, len, &addr);
+		defer_send_time(server);
+		return (rc);
+#elif defined(HAVE_SENDMMSG)
+		// after queueing, as a full queue is flushed first
+		rc = queue_send(server->fd, &addr, data, len);
+		defer_send_time(server);
+		return (rc);
+#else
+		return (sendto(server->fd, data, len, 0, (struct sockaddr *)&addr, sizeof(addr)));
+#endif
+}
+
+
+int
+qserver_flush_send_queue(void)
+{
+#if defined(HAVE_SENDMMSG) && !defined(USE_IO_URING)
+		struct mmsghdr msgs[SEND_QUEUE_LEN];
+		int queued[SEND_QUEUE_LEN], keep_fd[SEND_QUEUE_LEN];
+		struct queued_packet *qp;
+		int i, j, n, rc, sent, fd, n_kept = 0;
+		size_t data_len = 0;
+
+		// taken before sending as replies to the first packets may
+		// arrive before the last have gone
+		qserver_stamp_sends();
+
+		// Packets for all of a pool's sockets are queued together so send
+		// each socket's in turn, marking them done by clearing the fd
+		for (i = 0; i < n_send_queue; i++) {
+			keep_fd[i] = -1;
+		}
+		for (i = 0; i < n_send_queue; i++) {
+			fd = send_queue[i].fd;
+			if (fd == -1) {
+				continue;
+			}
+
+			n = 0;
+			for (j = i; j < n_send_queue; j++) {
+				qp = &send_queue[j];
+				if (qp->fd != fd) {
+					continue;
+				}
+				qp->iov.iov_base = send_data + qp->offset;
+				qp->iov.iov_len = qp->len;
+				memset(&msgs[n], 0, sizeof(msgs[n]));
+				msgs[n].msg_hdr.msg_name = &qp->addr;
+				msgs[n].msg_hdr.msg_namelen = sizeof(qp->addr);
+				msgs[n].msg_hdr.msg_iov = &qp->iov;
+				msgs[n].msg_hdr.msg_iovlen = 1;
+				qp->fd = -1;
+				queued[n] = j;
+				n++;
+			}
+
+			for (sent = 0; sent < n; ) {
+				rc = sendmmsg(fd, &msgs[sent], n - sent, 0);
+				if (rc == SOCKET_ERROR) {
+					if (errno == EINTR) {
+						continue;
+					}
+					if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == ENOBUFS)) {
+						// The socket buffer is full, keep the rest
+						// for the next flush rather than lose them
+						for ( ; sent < n; sent++) {
+							keep_fd[queued[sent]] = fd;
+							n_kept++;
+						}
+						break;
+					}
+					// Skip the packet which failed, its server will be
+					// retried or time out
+					if (show_errors) {
+						perror("sendmmsg");
+					}
+					sent++;
+				} else {
+					sent += rc;
+				}
+			}
+		}
+
+		// Move what's kept to the front, in order so its data can't be
+		// overwritten before it's moved
+		if (n_kept) {
+			for (i = 0, j = 0; i < n_send_queue; i++) {
+				if (keep_fd[i] == -1) {
+					continue;
+				}
+				qp = &send_queue[j++];
+				*qp = send_queue[i];
+				qp->fd = keep_fd[i];
+				memmove(send_data + data_len, send_data + qp->offset, qp->len);
+				qp->offset = data_len;
+				data_len += qp->len;
+			}
+		}
+		n_send_queue = n_kept;
+		send_data_len = data_len;
+
+		return (n_kept);
+#elif defined(USE_IO_URING)
+		if (n_deferred) {
+			uring_submit();
+		}
+#endif
+
+	return (0);
+}
+
+
 int
 register_send(struct qserver *server)
 {
@@ -84,8 +394,9 @@ register_send(struct qserver *server)
 	}
 
 	// New request so reset the sent time. This ensures
-	// that we record an accurate ping time even on retry
-	gettimeofday(&server->packet_time1, NULL);
+	// that we record an accurate ping time even on retry.
+	// The clock was read just before the packet was sent.
+	server->packet_time1 = qtime_now();
 	server->retry1--;
 	server->n_packets++;
 
@@ -105,7 +416,7 @@ send_packet_raw(struct qserver *server, const char *data, size_t len)
 		if (server->flags & FLAG_BROADCAST) {
 			ret = send_broadcast(server, data, len);
 		} else {
-			ret = send(server->fd, data, len, 0);
+			ret = qserver_send_raw(server, data, len);
 		}
 
 		if (ret == SOCKET_ERROR) {
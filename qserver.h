@@ -27,6 +27,22 @@ typedef struct SavedData {
 	struct SavedData *next;
 } SavedData;
 
+/**
+ * Smoothed round trip time, see rtt.h
+ */
+struct rtt_estimate {
+	int srtt;               /* microseconds */
+	int rttvar;             /* microseconds */
+	int samples;
+};
+
+/**
+ * Memory for what's parsed from a server's replies, see arena.h
+ */
+struct arena {
+	struct arena_block *blocks;
+};
+
 typedef enum {
 	STATE_INIT = 0,
 	STATE_CONNECTING = 1,
@@ -71,8 +87,8 @@ struct qserver {
 	/** \brief how much retry packets were sent */
 	int n_retries;
 	/** \brief time when the last packet to the server was sent */
-	struct timeval packet_time1;
-	struct timeval packet_time2;
+	qtime_t packet_time1;
+	qtime_t packet_time2;
 
 	/** \brief sum of packet deltas
 	 *
@@ -107,6 +123,12 @@ struct qserver {
 	 */
 	char *master_pkt;
 
+	/** \brief bytes of master_pkt already added as servers */
+	int master_pkt_added;
+
+	/** \brief servers added from master_pkt which weren't already known */
+	int master_n_added;
+
 	/** \brief state info
 	 *
 	 * used for progressive master 4 bytes for WON 22 for Steam
@@ -155,6 +177,32 @@ struct qserver {
 	struct rule **last_rule;
 	int missing_rules;
 
+	/** \brief when send_packets next needs to look at the server */
+	qtime_t deadline;
+
+	/** \brief index into the timer heap, -1 if not connected */
+	int timer_index;
+
+	/** \brief position in the servers handed out to workers, -1 if none */
+	int worker_index;
+
+	/** \brief output rendered by a worker process for the parent to write */
+	char *worker_output;
+	int worker_output_len;
+
+	/** \brief round trip estimate used to time retries */
+	struct rtt_estimate rtt;
+
+	/** \brief packets sent since the last reply and when the first went */
+	int rtt_sends;
+	qtime_t rtt_sent;
+
+	/** \brief local address the server is queried from, NULL if not bound */
+	struct source *source;
+
+	/** \brief rules, players and their strings, freed together once shown */
+	struct arena arena;
+
 	struct qserver *next;
 	struct qserver *prev;
 };
@@ -205,6 +253,40 @@ query_status_t qserver_send(struct qserver *server, const char *data, size_t len
 
 int send_broadcast(struct qserver *server, const char *pkt, size_t pktlen);
 
+/** \brief send data on the server's socket
+ *
+ * Uses send on a connected socket and sendto for servers which share
+ * an unconnected socket (FLAG_SHARED_SOCKET).
+ *
+ * \returns number of bytes sent or SOCKET_ERROR
+ */
+int qserver_send_raw(struct qserver *server, const char *data, size_t len);
+
+/**
+ * Send any packets queued for servers on shared sockets
+ *
+ * Where sendmmsg is available packets for shared servers are queued by
+ * qserver_send_raw and sent in batches, this must be called before
+ * waiting for replies. Send times recorded for queued packets are moved
+ * up to when they actually went out.
+ *
+ * \returns the number of packets kept queued as their socket's buffer
+ * was full, which should be flushed again shortly
+ */
+int qserver_flush_send_queue(void);
+
+/**
+ * Move send times recorded for queued packets up to now, called just before
+ * they're handed to the kernel
+ */
+void qserver_stamp_sends(void);
+
+/**
+ * Drop server's queued packets from the send time fix up, called when it's
+ * disconnected as it may be freed before the queue is flushed
+ */
+void qserver_forget_sends(struct qserver *server);
+
 /**
  * Registers the send of a request packet.
  *
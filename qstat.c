@@ -37,6 +37,18 @@
 #define QUERY_PACKETS
 #include "qstat.h"
 #include "packet_manip.h"
+#include "ratelimit.h"
+#include "rtt.h"
+#include "congestion.h"
+#include "source.h"
+#include "resolve.h"
+#include "timestamp.h"
+#include "worker.h"
+#include "mcache.h"
+#include "requery.h"
+#include "delta.h"
+#include "arena.h"
+#include "intern.h"
 #include "config.h"
 #include "xform.h"
 
@@ -48,6 +60,7 @@
   #include <sys/param.h>
  #endif
  #include <sys/time.h>
+ #include <sys/mman.h>
  #include <netinet/in.h>
  #include <netinet/tcp.h>
  #include <netdb.h>
@@ -90,8 +103,28 @@
 	#define FD_SETSIZE    64
 #endif
 
-/* Figure out whether to use poll() or select()
+/* Figure out whether to use io_uring, epoll(), poll() or select()
  */
+#ifdef USE_IO_URING
+ #include <poll.h>
+ #include "uring.h"
+#else
+#ifndef USE_EPOLL
+ #ifndef USE_POLL
+  #ifndef USE_SELECT
+   #ifdef HAVE_SYS_EPOLL_H
+			#define USE_EPOLL
+   #endif
+  #endif
+ #endif
+#endif
+
+#ifdef USE_EPOLL
+ #include <sys/epoll.h>
+ #include <poll.h>
+#endif
+
+#ifndef USE_EPOLL
 #ifndef USE_POLL
  #ifndef USE_SELECT
 
@@ -131,14 +164,18 @@
 
  #endif         /* USE_SELECT */
 #endif  /* USE_POLL */
+#endif  /* USE_EPOLL */
 
 /* If did not chose, then use select()
  */
-#ifndef USE_POLL
- #ifndef USE_SELECT
+#ifndef USE_EPOLL
+ #ifndef USE_POLL
+  #ifndef USE_SELECT
 		#define USE_SELECT
+  #endif
  #endif
 #endif
+#endif  /* USE_IO_URING */
 
 #include "debug.h"
 
@@ -168,6 +205,7 @@ char *multi_delimiter = "|";
 int player_address = 0;
 int max_simultaneous = MAXFD_DEFAULT;
 int sendinterval = 5;
+int udp_socket_pool = 0;
 extern int xform_names;
 extern int xform_strip_unprintable;
 extern int xform_hex_player_names;
@@ -186,10 +224,8 @@ int num_servers_timed_out = 0;
 int num_servers_down = 0;
 server_type *default_server_type = NULL;
 FILE *OF;       /* output file */
-unsigned int source_ip = INADDR_ANY;
 unsigned short source_port_low = 0;
 unsigned short source_port_high = 0;
-unsigned short source_port = 0;
 int show_game_port = 0;
 int no_port_offset = 0;
 
@@ -231,18 +267,40 @@ struct qserver *servers = NULL;
 struct qserver **last_server = &servers;
 struct qserver **connmap = NULL;
 int max_connmap;
+#ifndef _WIN32
+	// bumped each time an fd is given to a server, see packet_server
+	static unsigned int *connmap_generation = NULL;
+#endif
 struct qserver *last_server_bind = NULL;
-struct qserver *first_server_bind = NULL;
 int connected = 0;
+int masters_only = 0;
 time_t run_timeout = 0;
 time_t start_time;
 int waiting_for_masters;
 
-#define ADDRESS_HASH_LENGTH    2999
+#define SERVER_HASH_MIN    1024
 static unsigned num_servers;/* current number of servers in memory */
-static struct qserver **server_hash[ADDRESS_HASH_LENGTH];
-static unsigned int server_hash_len[ADDRESS_HASH_LENGTH];
+
+/*
+ * Servers by address and the port they were added with, open addressed
+ * with linear probing. Servers sharing an address, like TS2 and TS3
+ * virtual servers, sit in the same run of slots.
+ */
+static struct qserver **server_hash;
+static unsigned int server_hash_size;   /* a power of 2 */
+static unsigned int server_hash_count;
+static unsigned int server_hash_slot(unsigned int ipaddr, unsigned short port);
 static void free_server_hash();
+
+/*
+ * Every address masters have sent this run, kept the same way, as the
+ * server hash forgets servers once they're shown.
+ */
+static unsigned long long *master_seen;
+static unsigned int master_seen_size;   /* a power of 2 */
+static unsigned int master_seen_count;
+static int master_seen_add(unsigned int ipaddr, unsigned short port);
+static void free_master_seen();
 static void xml_display_player_info_info(struct player *player);
 
 char *DOWN = "DOWN";
@@ -259,8 +317,14 @@ char *current_filename;
 int current_fileline;
 
 int count_bits(int n);
-
-static int qserver_get_timeout(struct qserver *server, struct timeval *now);
+int parse_source_port(char *port, unsigned short *low, unsigned short *high);
+
+static int qserver_get_timeout(struct qserver *server, qtime_t now);
+static void timer_schedule(struct qserver *server, qtime_t deadline);
+static void timer_remove(struct qserver *server);
+static void register_qserver(struct qserver *server);
+static void connect_finished(struct qserver *server);
+static void connect_timeout(struct qserver *server);
 static int wait_for_timeout(unsigned int ms);
 static void finish_output();
 static int decode_stefmaster_packet(struct qserver *server, char *pkt, int pktlen);
@@ -269,8 +333,8 @@ static int decode_q3master_packet(struct qserver *server, char *ikt, int pktlen)
 char *ut2003_strdup(const char *string, const char *end, char **next);
 
 void free_server(struct qserver *server);
-void free_player(struct player *player);
-void free_rule(struct rule *rule);
+void free_player(struct player *player, struct arena *arena);
+void free_rule(struct rule *rule, struct arena *arena);
 void standard_display_server(struct qserver *server);
 
 /* MODIFY HERE
@@ -283,6 +347,29 @@ display_server(struct qserver *server)
 		sort_players(server);
 	}
 
+	if (worker_id != -1) {
+		// workers hand their output to the parent
+		worker_send_server(server);
+	} else if (server->worker_output != NULL) {
+		worker_write_output(server);
+	} else if (delta_check(server)) {
+		output_server(server);
+	}
+
+	if ((worker_id == -1) && requery_schedule(server)) {
+		// kept for its next query, which counts it back in
+		fflush(OF);
+		num_servers--;
+		return;
+	}
+
+	free_server(server);
+}
+
+
+void
+output_server(struct qserver *server)
+{
 	if (raw_display) {
 		raw_display_server(server);
 	} else if (xml_display) {
@@ -294,8 +381,6 @@ display_server(struct qserver *server)
 	} else {
 		standard_display_server(server);
 	}
-
-	free_server(server);
 }
 
 
@@ -1134,16 +1219,19 @@ raw_display_server_rules(struct qserver *server)
 
 	rule = server->rules;
 	for ( ; rule != NULL; rule = rule->next) {
-		if (server->type->id == TRIBES2_SERVER) {
-			char *v;
-			for (v = rule->value; *v; v++) {
+		if ((server->type->id == TRIBES2_SERVER) && (strchr(rule->value, '\n') != NULL)) {
+			// value may be shared so change a copy
+			char *value = strdup(rule->value), *v;
+			for (v = value; *v; v++) {
 				if (*v == '\n') {
 					*v = ' ';
 				}
 			}
+			xform_printf(OF, "%s%s=%s", (printed) ? RD : "", rule->name, value);
+			free(value);
+		} else {
+			xform_printf(OF, "%s%s=%s", (printed) ? RD : "", rule->name, rule->value);
 		}
-
-		xform_printf(OF, "%s%s=%s", (printed) ? RD : "", rule->name, rule->value);
 		printed++;
 	}
 	if (server->missing_rules) {
@@ -2520,20 +2608,15 @@ xml_display_tee_player_info(struct qserver *server)
 void
 display_progress()
 {
-	static struct timeval rate_start =
-	{
-		0, 0
-	};
+	static qtime_t rate_start = 0;
 	char rate[32];
-	struct timeval now;
-
-	gettimeofday(&now, NULL);
+	qtime_t now = qtime_now();
 
-	if (!rate_start.tv_sec) {
+	if (!rate_start) {
 		rate_start = now;
 		rate[0] = '\0';
 	} else {
-		int delta = time_delta(&now, &rate_start);
+		int delta = time_delta(now, rate_start);
 		if (delta > 1500) {
 			sprintf(rate, "  %d servers/sec  ", (num_servers_returned + num_servers_timed_out) * 1000 / delta);
 		} else {
@@ -2551,17 +2634,23 @@ display_progress()
 /* ----- END MODIFICATION ----- Don't need to change anything below here. */
 
 void set_non_blocking(int fd);
-int set_fds(fd_set *fds);
-void get_next_timeout(struct timeval *timeout);
+int set_fds(fd_set *read_fds, fd_set *write_fds);
+int get_next_timeout();
 
 void set_file_descriptors();
-int wait_for_file_descriptors(struct timeval *timeout);
+int wait_for_file_descriptors(int ms);
 struct qserver *get_next_ready_server();
+void add_file_descriptor(struct qserver *server);
+void update_file_descriptor(struct qserver *server);
+void remove_file_descriptor(struct qserver *server);
+void reset_file_descriptors();
+void free_socket_pools();
+static struct qserver *find_shared_server(struct qserver *pool_socket, struct sockaddr_in *addr);
 
 /* Misc flags
  */
 
-struct timeval packet_recv_time;
+qtime_t packet_recv_time;
 int one_server_type_id = ~MASTER_SERVER;
 static int one = 1;
 static int little_endian;
@@ -2686,6 +2775,7 @@ usage(char *msg, char **argv, char *a1)
 	printf("Output options:\n");
 	printf_opt("-of", "Output file");
 	printf_opt("-af", "Like -of, but append to the file");
+	printf_opt("-delta <file>", "Only output servers which changed since the run that wrote <file>");
 	printf("\n");
 
 	printf("Query options:\n");
@@ -2696,12 +2786,26 @@ usage(char *msg, char **argv, char *a1)
 	printf_opt("-mi", "Interval between master server retries, default is %.2f seconds", (DEFAULT_RETRY_INTERVAL * 4) / 1000.0);
 	printf_opt("-timeout", "Total time in seconds before giving up");
 	printf_opt("-maxsim", "Set maximum simultaneous queries");
+	printf_opt("-adaptivesim", "Adjust simultaneous queries to packet loss, up to -maxsim");
 	printf_opt("-sendinterval", "Set time in ms between sending packets, default %u", sendinterval);
+	printf_opt("-sendrate <n>[:<burst>]", "Limit sending to <n> packets per second, replaces -sendinterval");
+	printf_opt("-sendbytes <n>[:<burst>]", "Limit sending to <n> bytes per second, replaces -sendinterval");
+	printf_opt("-msendrate <n>[:<burst>]", "Like -sendrate, but a separate limit for master servers");
+	printf_opt("-msendbytes <n>[:<burst>]", "Like -sendbytes, but a separate limit for master servers");
+	printf_opt("-udpsockets <n>", "Query UDP servers over a pool of <n> shared sockets per server type");
+	printf_opt("-workers <n>", "Split the servers between <n> worker processes");
+	printf_opt("-daemon <secs>", "Keep running, querying each server again about every <secs>");
 	printf_opt("-allowserverdups", "Allow adding multiple servers with same ip:port (needed for ts2)");
 	printf_opt("-srcport <range>", "Send packets from these network ports");
-	printf_opt("-srcip <IP>", "Send packets using this IP address");
+	printf_opt("-srcip <IP>[:<range>][,...]", "Send packets using these IP addresses, spreading queries across them");
+	printf_opt("-kernelts", "Time replies by when the kernel received them");
 	printf_opt("-H", "Resolve host names");
 	printf_opt("-Hcache", "Host name cache file");
+	printf_opt("-Httl <secs>", "Look up cached host names again after <secs>, default 86400");
+	printf_opt("-Hnegttl <secs>", "Look up host names which weren't found again after <secs>, default 3600");
+	printf_opt("-resolvers <n>", "Look up to <n> host names at once, default 16");
+	printf_opt("-mcache <file>", "Master server list cache file");
+	printf_opt("-mcachettl <secs>", "Query masters again once their cached lists are <secs> old, default 900");
 	printf("\n");
 
 	printf("Advanced options:\n");
@@ -2926,19 +3030,23 @@ get_param_ui_value(struct qserver *server, char *key, unsigned int default_value
 
 
 int
-parse_source_address(char *addr, unsigned int *ip, unsigned short *port)
+parse_source_address(char *addr, unsigned int *ip, unsigned short *port_low, unsigned short *port_high)
 {
 	char *colon;
 
+	*ip = INADDR_ANY;
 	colon = strchr(addr, ':');
 	if (colon) {
 		*colon = '\0';
-		*port = atoi(colon + 1);
+		if (parse_source_port(colon + 1, port_low, port_high) == -1) {
+			return (-1);
+		}
 		if (colon == addr) {
 			return (0);
 		}
 	} else {
-		*port = 0;
+		*port_low = 0;
+		*port_high = 0;
 	}
 
 	*ip = inet_addr(addr);
@@ -3041,7 +3149,7 @@ revert_server_types()
 		int i;
 		struct stat statbuf;
 
-		gettimeofday(&packet_recv_time, NULL);
+		packet_recv_time = qtime_update();
 
 		for (i = 0; i < pkt_dump_pos; i++) {
 			if ((fd = open(pkt_dumps[i], O_RDONLY)) == -1) {
@@ -3077,37 +3185,366 @@ out:            fd = 0; // NOP
 
 #endif  // ENABLE_DUMP
 
+#define MAX_RECV_BUFFERS    1024
+
+// ms to wait before retrying sends kept back by full socket buffers
+#define SEND_QUEUE_WAIT     5
+
+/*
+ * Packets are read into a slab of MTU sized slots rather than each buffer
+ * being big enough for the largest packet. A datagram which doesn't fit
+ * spills into a scratch overflow area and is then moved into a buffer of
+ * its own, TCP streams are read straight into a large buffer. Slots keep
+ * a byte spare as packet handlers terminate the data in place.
+ */
+#ifdef _WIN32
+	// no recvmsg to scatter into, so slots must take the largest packet
+	#define RECV_SLOT_LEN    (PACKET_LEN + 1)
+#else
+	#define RECV_SLOT_LEN        2048
+	#define RECV_OVERFLOW_LEN    (PACKET_LEN - (RECV_SLOT_LEN - 1))
+#endif
+
+#if !defined(_WIN32) && !defined(USE_IO_URING)
+	#define RECV_OVERFLOW
+	static char *recv_overflow;
+#endif
+
 struct rcv_pkt {
 	struct qserver *server;
+	int fd;                 /* server's, with its generation in connmap */
+	unsigned int generation;
 	struct sockaddr_in addr;
-	struct timeval recv_time;
-	char data[PACKET_LEN];
+	qtime_t recv_time;
+	char *data;             /* slot, or a large buffer which replaced it */
+	char *slot;
 	int len;
 	int _errno;
+#ifdef USE_IO_URING
+		int bid;        /* ring buffer data points into, -1 if none */
+#endif
 };
 
+#ifdef RECV_OVERFLOW
+	/*
+	 * Returns the i'th entry of the overflow area, which is only touched
+	 * by oversized datagrams so costs address space rather than memory.
+	 */
+	static char *
+	recv_overflow_area(unsigned i)
+	{
+		if (recv_overflow == NULL) {
+			recv_overflow = (char *)malloc(MAX_RECV_BUFFERS * RECV_OVERFLOW_LEN);
+			if (recv_overflow == NULL) {
+				return (NULL);
+			}
+		}
+
+		return (recv_overflow + i * RECV_OVERFLOW_LEN);
+	}
+
+
+	/*
+	 * Move a datagram of len bytes which spilled from pkt's slot into
+	 * overflow into a buffer of its own, returns the length kept.
+	 */
+	static int
+	recv_spilled(struct rcv_pkt *pkt, char *overflow, int len)
+	{
+		char *large;
+
+ #ifdef MADV_DONTNEED
+			static long page_size;
+			char *start, *end;
+ #endif
+
+		large = (char *)malloc(len + 1);
+		if (large == NULL) {
+			return (RECV_SLOT_LEN - 1);
+		}
+		memcpy(large, pkt->slot, RECV_SLOT_LEN - 1);
+		memcpy(large + RECV_SLOT_LEN - 1, overflow, len - (RECV_SLOT_LEN - 1));
+		pkt->data = large;
+
+ #ifdef MADV_DONTNEED
+			// hand back the pages written so the overflow area doesn't
+			// become resident over a long scan
+			if (page_size == 0) {
+				page_size = sysconf(_SC_PAGESIZE);
+			}
+			start = (char *)(((unsigned long)overflow + page_size - 1) & ~(page_size - 1));
+			end = (char *)(((unsigned long)overflow + len - (RECV_SLOT_LEN - 1)) & ~(page_size - 1));
+			if (end > start) {
+				madvise(start, end - start, MADV_DONTNEED);
+			}
+ #endif
+
+		return (len);
+	}
+#endif
+
+/*
+ * Return pkt to its slot once the packet has been processed
+ */
+static void
+release_packet(struct rcv_pkt *pkt)
+{
+	if (pkt->data == pkt->slot) {
+		return;
+	}
+
+#ifdef USE_IO_URING
+		if (pkt->bid != -1) {
+			uring_release_buffer(pkt->bid);
+			pkt->bid = -1;
+			pkt->data = pkt->slot;
+			return;
+		}
+#endif
+
+	free(pkt->data);
+	pkt->data = pkt->slot;
+}
+
+#ifdef USE_IO_URING
+	static int recv_packet(struct qserver *server, struct rcv_pkt *pkt);
+#else
+	/*
+	 * Read the packet waiting on server's socket into pkt, returns its
+	 * length or SOCKET_ERROR.
+	 */
+	static int
+	recv_packet(struct qserver *server, struct rcv_pkt *pkt)
+	{
+ #ifdef _WIN32
+			int addrlen = sizeof(pkt->addr);
+
+			pkt->recv_time = qtime_now();
+			return (recvfrom(server->fd, pkt->data, RECV_SLOT_LEN - 1, 0, (struct sockaddr *)&pkt->addr, (void *)&addrlen));
+ #else
+			struct msghdr msg;
+			struct iovec iov[2];
+			union {
+				struct cmsghdr align;
+				char buf[TIMESTAMP_CONTROL_LEN];
+			} control;
+			char *overflow;
+			int len;
+
+			pkt->recv_time = qtime_now();
+
+			if (server->type->flags & TF_TCP_CONNECT) {
+				char *large = (char *)malloc(PACKET_LEN + 1);
+				if (large != NULL) {
+					len = recv(server->fd, large, PACKET_LEN, 0);
+					if (len > 0) {
+						pkt->data = large;
+					} else {
+						free(large);
+					}
+					return (len);
+				}
+			}
+
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_name = &pkt->addr;
+			msg.msg_namelen = sizeof(pkt->addr);
+			msg.msg_iov = iov;
+			msg.msg_iovlen = 1;
+			iov[0].iov_base = pkt->slot;
+			iov[0].iov_len = RECV_SLOT_LEN - 1;
+			overflow = recv_overflow_area(0);
+			if (overflow != NULL) {
+				iov[1].iov_base = overflow;
+				iov[1].iov_len = RECV_OVERFLOW_LEN;
+				msg.msg_iovlen = 2;
+			}
+			if (kernel_timestamps) {
+				msg.msg_control = control.buf;
+				msg.msg_controllen = sizeof(control.buf);
+			}
+
+			len = recvmsg(server->fd, &msg, 0);
+			if (len > RECV_SLOT_LEN - 1) {
+				len = recv_spilled(pkt, overflow, len);
+			}
+			if (len >= 0) {
+				timestamp_get(&msg, &pkt->recv_time);
+			}
+
+			return (len);
+ #endif
+	}
+#endif
+
+/*
+ * Read the replies queued on a shared socket into up to n entries of
+ * buffer, returns the number of packets read or SOCKET_ERROR.
+ */
+static int
+recv_shared_packets(struct qserver *pool_socket, struct rcv_pkt *buffer, unsigned n)
+{
+#if defined(USE_IO_URING)
+		// each completion holds a single packet, any more queued on the
+		// socket come back from get_next_ready_server in turn
+		int pktlen;
+
+		if (n == 0) {
+			return (0);
+		}
+
+		pktlen = recv_packet(pool_socket, buffer);
+		if (pktlen == SOCKET_ERROR) {
+			return (SOCKET_ERROR);
+		}
+		buffer->server = pool_socket;
+		buffer->len = pktlen;
+
+		return (1);
+#elif defined(HAVE_RECVMMSG)
+		static struct mmsghdr msgs[MAX_RECV_BUFFERS];
+		static struct iovec iov[MAX_RECV_BUFFERS][2];
+		static union {
+			struct cmsghdr align;
+			char buf[TIMESTAMP_CONTROL_LEN];
+		} control[MAX_RECV_BUFFERS];
+		qtime_t now;
+		unsigned i;
+		int rc;
+
+		if (n > MAX_RECV_BUFFERS) {
+			n = MAX_RECV_BUFFERS;
+		}
+
+		for (i = 0; i < n; i++) {
+			iov[i][0].iov_base = buffer[i].slot;
+			iov[i][0].iov_len = RECV_SLOT_LEN - 1;
+			memset(&msgs[i], 0, sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_name = &buffer[i].addr;
+			msgs[i].msg_hdr.msg_namelen = sizeof(buffer[i].addr);
+			msgs[i].msg_hdr.msg_iov = iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			// each packet gets its own overflow as the batch is
+			// only moved out of them once they've all been read
+			iov[i][1].iov_base = recv_overflow_area(i);
+			if (iov[i][1].iov_base != NULL) {
+				iov[i][1].iov_len = RECV_OVERFLOW_LEN;
+				msgs[i].msg_hdr.msg_iovlen = 2;
+			}
+			if (kernel_timestamps) {
+				msgs[i].msg_hdr.msg_control = control[i].buf;
+				msgs[i].msg_hdr.msg_controllen = sizeof(control[i].buf);
+			}
+		}
+
+		rc = recvmmsg(pool_socket->fd, msgs, n, MSG_DONTWAIT, NULL);
+		if (rc <= 0) {
+			return (rc);
+		}
+
+		// The whole batch was dequeued at once so it shares a receive time,
+		// unless the kernel stamped each packet as it arrived
+		now = qtime_now();
+		for (i = 0; i < (unsigned)rc; i++) {
+			buffer[i].server = pool_socket;
+			buffer[i].len = msgs[i].msg_len;
+			buffer[i].recv_time = now;
+			timestamp_get(&msgs[i].msg_hdr, &buffer[i].recv_time);
+			if (buffer[i].len > RECV_SLOT_LEN - 1) {
+				buffer[i].len = recv_spilled(&buffer[i], iov[i][1].iov_base, buffer[i].len);
+			}
+		}
+
+		return (rc);
+#else
+		unsigned i;
+		int pktlen;
+
+		for (i = 0; i < n; i++) {
+			pktlen = recv_packet(pool_socket, &buffer[i]);
+			if (pktlen == SOCKET_ERROR) {
+				break;
+			}
+			buffer[i].server = pool_socket;
+			buffer[i].len = pktlen;
+		}
+
+		return ((i == 0 && n != 0) ? SOCKET_ERROR : (int)i);
+#endif
+}
+
+
+/*
+ * Note which server's socket pkt was read from
+ */
+static void
+packet_from(struct rcv_pkt *pkt, struct qserver *server)
+{
+	pkt->server = server;
+#ifndef _WIN32
+		pkt->fd = server->fd;
+		pkt->generation = connmap_generation[server->fd];
+#endif
+}
+
+
+/*
+ * \returns the server pkt was read for, or NULL if it's been cleaned up
+ * since. Handling an earlier packet of the batch can free a server which
+ * has more packets to follow, an io_uring multishot receive can complete
+ * several times for one socket, so look it up again rather than trust
+ * the pointer.
+ */
+static struct qserver *
+packet_server(struct rcv_pkt *pkt)
+{
+#ifndef _WIN32
+		if ((pkt->fd < 0) || (pkt->fd >= max_connmap) || (connmap_generation[pkt->fd] != pkt->generation)) {
+			return (NULL);
+		}
+		return (connmap[pkt->fd]);
+#else
+		return (pkt->server);
+#endif
+}
+
+
 void
 do_work(void)
 {
-	int pktlen, rc;
+	int pktlen, rc, timeout;
 	char *pkt = NULL;
 	int bind_retry = 0;
-	struct timeval timeout;
 	struct rcv_pkt *buffer;
+	char *slab;
 	unsigned buffill = 0, i = 0;
 	unsigned bufsize = max_simultaneous * 2;
 
-	struct timeval t, ts;
+	if (bufsize > MAX_RECV_BUFFERS) {
+		bufsize = MAX_RECV_BUFFERS;
+	}
+
+	qtime_t t, ts;
 
-	gettimeofday(&t, NULL);
+	t = qtime_update();
 	ts = t;
 
 	buffer = malloc(sizeof(struct rcv_pkt) * bufsize);
+	slab = malloc(RECV_SLOT_LEN * bufsize);
 
-	if (!buffer) {
+	if (!buffer || !slab) {
+		free(buffer);
+		free(slab);
 		return;
 	}
 
+	for (i = 0; i < bufsize; i++) {
+		buffer[i].slot = buffer[i].data = slab + i * RECV_SLOT_LEN;
+#ifdef USE_IO_URING
+			buffer[i].bid = -1;
+#endif
+	}
+
 #ifdef ENABLE_DUMP
 		if (pkt_dump_pos) {
 			replay_pkt_dumps();
@@ -3121,9 +3558,33 @@ do_work(void)
 
 	debug(2, "connected: %d", connected);
 
-	while (connected || (!connected && bind_retry == -2)) {
-		if (!connected && (bind_retry == -2)) {
-			rc = wait_for_timeout(60);
+	while (connected || (bind_retry == -2) || (requery_wait() != -1)) {
+		if (!connected) {
+			int due = requery_wait();
+
+			// don't sleep past the point the send rate limit refills,
+			// or for long while host names are being looked up, or
+			// past when the next server is to be queried again
+			if (bind_retry == -2) {
+				rc = ratelimit_enabled() ? ratelimit_next() : 0;
+				if ((rc <= 0) || (rc > 60)) {
+					rc = resolve_pending() ? 10 : 60;
+				}
+			} else {
+				rc = 1000;
+			}
+			if ((due != -1) && (due < rc)) {
+				rc = due;
+			}
+			if (rc > 0) {
+				rc = wait_for_timeout(rc);
+			}
+			qtime_update();
+			if (run_timeout && (time(0) - start_time >= run_timeout)) {
+				debug(2, "run timeout reached");
+				break;
+			}
+			requery_due();
 			bind_retry = bind_sockets();
 			continue;
 		}
@@ -3135,9 +3596,17 @@ do_work(void)
 			display_progress();
 		}
 
-		get_next_timeout(&timeout);
+		timeout = get_next_timeout();
+		if (qserver_flush_send_queue() && (timeout > SEND_QUEUE_WAIT)) {
+			// packets are waiting for room in a socket's buffer
+			timeout = SEND_QUEUE_WAIT;
+		}
+
+		rc = wait_for_file_descriptors(timeout);
 
-		rc = wait_for_file_descriptors(&timeout);
+		// the one clock read for the rest of the pass, packets read
+		// below are timed by it unless the kernel stamped them
+		qtime_update();
 
 		debug(2, "rc %d", rc);
 
@@ -3152,15 +3621,36 @@ do_work(void)
 		}
 
 		for ( ; rc && buffill < bufsize; rc--) {
-			int addrlen = sizeof(buffer[buffill].addr);
 			struct qserver *server = get_next_ready_server();
 			if (server == NULL) {
 				break;
 			}
 
-			gettimeofday(&buffer[buffill].recv_time, NULL);
+			if (server->flags & FLAG_CONNECT_WAIT) {
+				// writable, so its connect has succeeded or failed
+				connect_finished(server);
+				continue;
+			}
+
+			if (server->flags & FLAG_SOCKET_POOL) {
+				// Shared sockets queue replies from many servers so
+				// drain them while we have room, routing happens below
+				// as servers may be freed while processing the batch.
+				int j;
+				do {
+					pktlen = recv_shared_packets(server, &buffer[buffill], bufsize - buffill);
+					debug(2, "shared recv: %d", pktlen);
+					for (j = 0; j < pktlen; j++) {
+						packet_from(&buffer[buffill + j], server);
+					}
+					if (pktlen > 0) {
+						buffill += pktlen;
+					}
+				} while (pktlen > 0 && buffill < bufsize);
+				continue;
+			}
 
-			pktlen = recvfrom(server->fd, buffer[buffill].data, sizeof(buffer[buffill].data), 0, (struct sockaddr *)&buffer[buffill].addr, (void *)&addrlen);
+			pktlen = recv_packet(server, &buffer[buffill]);
 
 			debug(2, "recvfrom: %d", pktlen);
 
@@ -3177,8 +3667,8 @@ do_work(void)
 			}
 
 			debug(1, "recv %3d %3d %d.%d.%d.%d:%hu\n",
-			    time_delta(&buffer[buffill].recv_time, &ts),
-			    time_delta(&buffer[buffill].recv_time, &t),
+			    time_delta(buffer[buffill].recv_time, ts),
+			    time_delta(buffer[buffill].recv_time, t),
 			    server->ipaddr & 0xff,
 			    (server->ipaddr >> 8) & 0xff,
 			    (server->ipaddr >> 16) & 0xff,
@@ -3188,7 +3678,7 @@ do_work(void)
 
 			t = buffer[buffill].recv_time;
 
-			buffer[buffill].server = server;
+			packet_from(&buffer[buffill], server);
 			buffer[buffill].len = pktlen;
 			++buffill;
 		}
@@ -3196,10 +3686,14 @@ do_work(void)
 		debug(2, "fill: %d < %d", buffill, bufsize);
 
 		for (i = 0; i < buffill; ++i) {
-			struct qserver *server = buffer[i].server;
+			struct qserver *server = packet_server(&buffer[i]);
+			if (server == NULL) {
+				debug(2, "dropping packet for server cleaned up earlier in the batch");
+				continue;
+			}
 			pkt = buffer[i].data;
 			pktlen = buffer[i].len;
-			memcpy(&packet_recv_time, &buffer[i].recv_time, sizeof(packet_recv_time));
+			packet_recv_time = buffer[i].recv_time;
 
 			if (get_debug_level() > 2) {
 				print_packet(server, pkt, pktlen);
@@ -3210,7 +3704,13 @@ do_work(void)
 				dump_packet(pkt, pktlen);
 			}
 #endif
-			if (server->flags & FLAG_BROADCAST) {
+			if (server->flags & FLAG_SOCKET_POOL) {
+				server = find_shared_server(server, &buffer[i].addr);
+				if (server == NULL) {
+					debug(2, "no server for reply from %s:%hu on shared socket", inet_ntoa(buffer[i].addr.sin_addr), ntohs(buffer[i].addr.sin_port));
+					continue;
+				}
+			} else if (server->flags & FLAG_BROADCAST) {
 				struct qserver *broadcast = server;
 				unsigned short port = ntohs(buffer[i].addr.sin_port);
 				/* create new server and init */
@@ -3244,10 +3744,28 @@ do_work(void)
 				}
 			}
 
+			if (kernel_timestamps && (buffer[i].recv_time < server->packet_time1)) {
+				// requests are timed once sent, so a quick enough reply
+				// can be stamped by the kernel before its request was
+				buffer[i].recv_time = server->packet_time1;
+				packet_recv_time = server->packet_time1;
+			}
+
+			rtt_received(server, buffer[i].recv_time);
+
+			if (server->timer_index != -1) {
+				// let send_packets follow up on the reply
+				timer_schedule(server, buffer[i].recv_time);
+			}
+
 			debug(2, "connected, pre-packet_func: %d", connected);
 			process_func_ret(server, server->type->packet_func(server, pkt, pktlen));
 			debug(2, "connected, post-packet_func: %d", connected);
 		}
+
+		for (i = 0; i < buffill; ++i) {
+			release_packet(&buffer[i]);
+		}
 		buffill = 0;
 
 		if (run_timeout && (time(0) - start_time >= run_timeout)) {
@@ -3256,7 +3774,8 @@ do_work(void)
 		}
 
 		send_packets();
-		if (connected < max_simultaneous) {
+		requery_due();
+		if (connected < congestion_limit()) {
 			bind_retry = bind_sockets();
 		}
 
@@ -3264,6 +3783,11 @@ do_work(void)
 	}
 
 	free(buffer);
+	free(slab);
+#ifdef RECV_OVERFLOW
+		free(recv_overflow);
+		recv_overflow = NULL;
+#endif
 }
 
 
@@ -3275,6 +3799,7 @@ main(int argc, char *argv[])
 	struct server_arg *server_args = NULL;
 	int n_server_args = 0, max_server_args = 0;
 	int default_server_type_id;
+	int adaptive_simultaneous = 0, maxsim_given = 0;
 
 #ifdef _WIN32
 		WORD version = MAKEWORD(1, 1);
@@ -3472,9 +3997,16 @@ main(int argc, char *argv[])
 			if (max_simultaneous <= 0) {
 				usage("value for -maxsimultaneous must be > 0\n", argv, NULL);
 			}
-			if (max_simultaneous > FD_SETSIZE) {
-				max_simultaneous = FD_SETSIZE;
-			}
+#ifdef USE_SELECT
+				if (max_simultaneous > FD_SETSIZE) {
+					max_simultaneous = FD_SETSIZE;
+				}
+#endif
+			maxsim_given = 1;
+		} else if (strcmp(argv[arg], "-adaptivesim") == 0) {
+			adaptive_simultaneous = 1;
+		} else if (strcmp(argv[arg], "-kernelts") == 0) {
+			kernel_timestamps = 1;
 		} else if (strcmp(argv[arg], "-sendinterval") == 0) {
 			arg++;
 			if (arg >= argc) {
@@ -3484,6 +4016,74 @@ main(int argc, char *argv[])
 			if (sendinterval < 0) {
 				usage("value for -sendinterval must be >= 0\n", argv, NULL);
 			}
+		} else if (strcmp(argv[arg], "-sendrate") == 0) {
+			arg++;
+			if (arg >= argc) {
+				usage("missing argument for %s\n", argv, argv[arg - 1]);
+			}
+			if (ratelimit_parse(argv[arg], &send_limit.packet_rate, &send_limit.packet_burst) == -1) {
+				usage("value for %s must be <rate>[:<burst>] with rate > 0 and burst >= 1\n", argv, argv[arg - 1]);
+			}
+		} else if (strcmp(argv[arg], "-sendbytes") == 0) {
+			arg++;
+			if (arg >= argc) {
+				usage("missing argument for %s\n", argv, argv[arg - 1]);
+			}
+			if (ratelimit_parse(argv[arg], &send_limit.byte_rate, &send_limit.byte_burst) == -1) {
+				usage("value for %s must be <rate>[:<burst>] with rate > 0 and burst >= 1\n", argv, argv[arg - 1]);
+			}
+		} else if (strcmp(argv[arg], "-msendrate") == 0) {
+			arg++;
+			if (arg >= argc) {
+				usage("missing argument for %s\n", argv, argv[arg - 1]);
+			}
+			if (ratelimit_parse(argv[arg], &master_send_limit.packet_rate, &master_send_limit.packet_burst) == -1) {
+				usage("value for %s must be <rate>[:<burst>] with rate > 0 and burst >= 1\n", argv, argv[arg - 1]);
+			}
+		} else if (strcmp(argv[arg], "-msendbytes") == 0) {
+			arg++;
+			if (arg >= argc) {
+				usage("missing argument for %s\n", argv, argv[arg - 1]);
+			}
+			if (ratelimit_parse(argv[arg], &master_send_limit.byte_rate, &master_send_limit.byte_burst) == -1) {
+				usage("value for %s must be <rate>[:<burst>] with rate > 0 and burst >= 1\n", argv, argv[arg - 1]);
+			}
+		} else if (strcmp(argv[arg], "-workers") == 0) {
+			arg++;
+			if (arg >= argc) {
+				usage("missing argument for -workers\n", argv, NULL);
+			}
+			n_workers = atoi(argv[arg]);
+			if (n_workers <= 0) {
+				usage("value for -workers must be > 0\n", argv, NULL);
+			}
+		} else if (strcmp(argv[arg], "-daemon") == 0) {
+			arg++;
+			if (arg >= argc) {
+				usage("missing argument for -daemon\n", argv, NULL);
+			}
+			requery_interval = atoi(argv[arg]);
+			if (requery_interval <= 0) {
+				usage("value for -daemon must be > 0\n", argv, NULL);
+			}
+		} else if (strcmp(argv[arg], "-resolvers") == 0) {
+			arg++;
+			if (arg >= argc) {
+				usage("missing argument for -resolvers\n", argv, NULL);
+			}
+			max_resolvers = atoi(argv[arg]);
+			if (max_resolvers <= 0) {
+				usage("value for -resolvers must be > 0\n", argv, NULL);
+			}
+		} else if (strcmp(argv[arg], "-udpsockets") == 0) {
+			arg++;
+			if (arg >= argc) {
+				usage("missing argument for -udpsockets\n", argv, NULL);
+			}
+			udp_socket_pool = atoi(argv[arg]);
+			if (udp_socket_pool <= 0) {
+				usage("value for -udpsockets must be > 0\n", argv, NULL);
+			}
 		} else if (strcmp(argv[arg], "-raw-arg") == 0) {
 			raw_arg = 1000;
 		} else if (strcmp(argv[arg], "-timeout") == 0) {
@@ -3509,6 +4109,49 @@ main(int argc, char *argv[])
 			if (hcache_open(argv[arg], 0) == -1) {
 				return (1);
 			}
+		} else if (strcmp(argv[arg], "-mcache") == 0) {
+			arg++;
+			if (arg >= argc) {
+				usage("missing argument for -mcache\n", argv, NULL);
+			}
+			if (mcache_open(argv[arg]) == -1) {
+				return (1);
+			}
+		} else if (strcmp(argv[arg], "-delta") == 0) {
+			arg++;
+			if (arg >= argc) {
+				usage("missing argument for -delta\n", argv, NULL);
+			}
+			if (delta_open(argv[arg]) == -1) {
+				return (1);
+			}
+		} else if (strcmp(argv[arg], "-mcachettl") == 0) {
+			arg++;
+			if (arg >= argc) {
+				usage("missing argument for -mcachettl\n", argv, NULL);
+			}
+			mcache_ttl = atoi(argv[arg]);
+			if (mcache_ttl <= 0) {
+				usage("value for -mcachettl must be > 0\n", argv, NULL);
+			}
+		} else if (strcmp(argv[arg], "-Httl") == 0) {
+			arg++;
+			if (arg >= argc) {
+				usage("missing argument for -Httl\n", argv, NULL);
+			}
+			hcache_ttl = atoi(argv[arg]);
+			if (hcache_ttl <= 0) {
+				usage("value for -Httl must be > 0\n", argv, NULL);
+			}
+		} else if (strcmp(argv[arg], "-Hnegttl") == 0) {
+			arg++;
+			if (arg >= argc) {
+				usage("missing argument for -Hnegttl\n", argv, NULL);
+			}
+			hcache_negative_ttl = atoi(argv[arg]);
+			if (hcache_negative_ttl <= 0) {
+				usage("value for -Hnegttl must be > 0\n", argv, NULL);
+			}
 		} else if (strcmp(argv[arg], "-default") == 0) {
 			arg++;
 			if (arg >= argc) {
@@ -3631,16 +4274,23 @@ main(int argc, char *argv[])
 		} else if (strcmp(argv[arg], "-noportoffset") == 0) {
 			no_port_offset = 1;
 		} else if (strcmp(argv[arg], "-srcip") == 0) {
+			char *addr, *comma;
+			unsigned int ip;
+			unsigned short port_low, port_high;
+
 			arg++;
 			if (arg >= argc) {
 				usage("missing argument for %s\n", argv, argv[arg - 1]);
 			}
-			if (parse_source_address(argv[arg], &source_ip, &source_port) == -1) {
-				return (1);
-			}
-			if (source_port) {
-				source_port_low = source_port;
-				source_port_high = source_port;
+			for (addr = argv[arg]; addr != NULL; addr = comma) {
+				comma = strchr(addr, ',');
+				if (comma) {
+					*comma++ = '\0';
+				}
+				if (parse_source_address(addr, &ip, &port_low, &port_high) == -1) {
+					return (1);
+				}
+				source_add(ip, port_low, port_high);
 			}
 		} else if (strcmp(argv[arg], "-syncconnect") == 0) {
 			syncconnect = 1;
@@ -3654,7 +4304,6 @@ main(int argc, char *argv[])
 			if (parse_source_port(argv[arg], &source_port_low, &source_port_high) == -1) {
 				return (1);
 			}
-			source_port = source_port_low;
 		} else if (strcmp(argv[arg], "-cfg") == 0) {
 			arg++;
 			if (arg >= argc) {
@@ -3723,6 +4372,13 @@ main(int argc, char *argv[])
 		}
 	}
 
+	if (requery_interval && server_sort) {
+		usage("cannot specify both -daemon and -sort\n", argv, NULL);
+	}
+	if (requery_interval && (n_workers > 1)) {
+		usage("cannot specify both -daemon and -workers\n", argv, NULL);
+	}
+
 	start_time = time(0);
 
 	default_server_type = find_server_type_id(default_server_type_id);
@@ -3746,8 +4402,25 @@ main(int argc, char *argv[])
 		exit(1);
 	}
 
+	if (adaptive_simultaneous) {
+		if (!maxsim_given) {
+			max_simultaneous = CONGESTION_MAX_DEFAULT;
+#ifdef USE_SELECT
+				if (max_simultaneous > FD_SETSIZE) {
+					max_simultaneous = FD_SETSIZE;
+				}
+#endif
+		}
+		congestion_init(MAXFD_DEFAULT);
+	}
+
+	source_init(source_port_low, source_port_high);
+
 	max_connmap = max_simultaneous + 10;
 	connmap = (struct qserver **)calloc(1, sizeof(struct qserver *) * max_connmap);
+#ifndef _WIN32
+		connmap_generation = (unsigned int *)calloc(max_connmap, sizeof(unsigned int));
+#endif
 
 	if (color_names == -1) {
 		color_names = (raw_display) ? DEFAULT_COLOR_NAMES_RAW : DEFAULT_COLOR_NAMES_DISPLAY;
@@ -3775,10 +4448,16 @@ main(int argc, char *argv[])
 	h2_serverinfo.length = htons(h2_serverinfo.length);
 	q_player.length = htons(q_player.length);
 
-	do_work();
+	if (n_workers > 1) {
+		run_workers();
+	} else {
+		do_work();
+	}
 
 	finish_output();
+	free_socket_pools();
 	free_server_hash();
+	free_master_seen();
 	free(files);
 	free(connmap);
 
@@ -3829,10 +4508,17 @@ finish_output()
 			next_server = server->next;
 			if (server->server_name == HOSTNOTFOUND) {
 				display_server(server);
+			} else {
+				// not finished, so it's not known to have changed
+				delta_keep(server);
 			}
 		}
 	}
 
+	if (worker_id == -1) {
+		delta_finish();
+	}
+
 	if (xml_display) {
 		xml_footer();
 	} else if (json_display) {
@@ -3934,8 +4620,9 @@ add_qserver(char *arg, server_type *type, char *outfilename, char *query_arg)
 	int flags = 0;
 	char *colon = NULL, *arg_copy, *hostname = NULL;
 	unsigned int ipaddr;
+	unsigned long cached;
 	unsigned short port, port_max;
-	int portrange = 0;
+	int portrange = 0, resolving = 0, name_wait = 0, h_err = 0;
 	unsigned colonpos = 0;
 
 	debug(4, "%s, %s, %s, %s\n", arg, (NULL != type) ? type->type_string : "unknown", outfilename, query_arg);
@@ -3976,19 +4663,33 @@ add_qserver(char *arg, server_type *type, char *outfilename, char *query_arg)
 		arg++;
 	}
 
+	// names not in the host cache are looked up in the background
 	ipaddr = inet_addr(arg);
 	if (ipaddr == INADDR_NONE) {
 		if (strcmp(arg, "255.255.255.255") != 0) {
-			ipaddr = htonl(hcache_lookup_hostname(arg));
+			if (hcache_find_hostname(arg, &cached)) {
+				ipaddr = htonl(cached);
+				if (cached == 0) {
+					// not found last time it was looked up
+					h_err = HOST_NOT_FOUND;
+				}
+			} else {
+				resolving = 1;
+			}
 		}
 	} else if (hostname_lookup && !(flags & FLAG_BROADCAST)) {
-		hostname = hcache_lookup_ipaddr(ntohl(ipaddr));
+		if (!hcache_find_ipaddr(ntohl(ipaddr), &hostname)) {
+			name_wait = 1;
+		}
 	}
 
-	if (((ipaddr == INADDR_NONE) || (ipaddr == 0)) && (strcmp(arg, "255.255.255.255") != 0)) {
+	if (!resolving && ((ipaddr == INADDR_NONE) || (ipaddr == 0)) && (strcmp(arg, "255.255.255.255") != 0)) {
+		if (h_err == 0) {
+			h_err = h_errno;
+		}
 		if (show_errors) {
 			print_file_location();
-			fprintf(stderr, "%s: %s\n", arg, strherror(h_errno));
+			fprintf(stderr, "%s: %s\n", arg, strherror(h_err));
 		}
 		server = (struct qserver *)calloc(1, sizeof(struct qserver));
 		// NOTE: 0 != port to prevent infinite loop due to lack of range on unsigned short
@@ -4001,8 +4702,9 @@ add_qserver(char *arg, server_type *type, char *outfilename, char *query_arg)
 			} else {
 				server->arg = arg_copy;
 			}
+			server->host_name = strdup(arg);
 			server->server_name = HOSTNOTFOUND;
-			server->error = strdup(strherror(h_errno));
+			server->error = strdup(strherror(h_err));
 			server->orig_port = server->query_port = server->port = port;
 			if (last_server != &servers) {
 				prev_server = (struct qserver *)((char *)last_server - ((char *)&server->next - (char *)server));
@@ -4021,7 +4723,7 @@ add_qserver(char *arg, server_type *type, char *outfilename, char *query_arg)
 
 	// NOTE: 0 != port to prevent infinite loop due to lack of range on unsigned short
 	for ( ; port <= port_max && 0 != port; ++port) {
-		if (noserverdups && (find_server_by_address(ipaddr, port) != NULL)) {
+		if (noserverdups && !resolving && (find_server_by_address(ipaddr, port) != NULL)) {
 			continue;
 		}
 
@@ -4037,7 +4739,7 @@ add_qserver(char *arg, server_type *type, char *outfilename, char *query_arg)
 			server->host_name = strdup((hostname) ? hostname : arg);
 		}
 
-		server->ipaddr = ipaddr;
+		server->ipaddr = resolving ? 0 : ipaddr;
 		server->orig_port = server->query_port = server->port = port;
 		server->type = type;
 		server->outfilename = outfilename;
@@ -4051,7 +4753,8 @@ add_qserver(char *arg, server_type *type, char *outfilename, char *query_arg)
 		}
 		init_qserver(server, type);
 
-		if (server->type->master) {
+		// masters being looked up are waited for once they're found
+		if (server->type->master && !resolving) {
 			waiting_for_masters++;
 		}
 
@@ -4066,7 +4769,17 @@ add_qserver(char *arg, server_type *type, char *outfilename, char *query_arg)
 		*last_server = server;
 		last_server = &server->next;
 
-		add_server_to_hash(server);
+		if (resolving) {
+			// hashed once its address is known
+			server->flags |= FLAG_RESOLVING;
+			resolve_hostname(arg, server);
+		} else {
+			add_server_to_hash(server);
+		}
+		if (name_wait) {
+			server->flags |= FLAG_NAME_WAIT;
+			resolve_ipaddr(ntohl(ipaddr), server);
+		}
 
 		if (one_server_type_id == ~MASTER_SERVER) {
 			one_server_type_id = type->id;
@@ -4086,6 +4799,7 @@ add_qserver_byaddr(unsigned int ipaddr, unsigned short port, server_type *type,
 	char arg[36];
 	struct qserver *server, *prev_server;
 	char *hostname = NULL;
+	int name_wait = 0;
 
 	if (run_timeout && (time(0) - start_time >= run_timeout)) {
 		finish_output();
@@ -4116,8 +4830,8 @@ add_qserver_byaddr(unsigned int ipaddr, unsigned short port, server_type *type,
 	sprintf(arg, "%d.%d.%d.%d:%hu", ipaddr >> 24, (ipaddr >> 16) & 0xff, (ipaddr >> 8) & 0xff, ipaddr & 0xff, port);
 	server->arg = strdup(arg);
 
-	if (hostname_lookup) {
-		hostname = hcache_lookup_ipaddr(ipaddr);
+	if (hostname_lookup && !hcache_find_ipaddr(ipaddr, &hostname)) {
+		name_wait = 1;
 	}
 
 	if (hostname) {
@@ -4142,6 +4856,10 @@ add_qserver_byaddr(unsigned int ipaddr, unsigned short port, server_type *type,
 	last_server = &server->next;
 
 	add_server_to_hash(server);
+	if (name_wait) {
+		server->flags |= FLAG_NAME_WAIT;
+		resolve_ipaddr(ipaddr, server);
+	}
 
 	++num_servers;
 
@@ -4149,13 +4867,83 @@ add_qserver_byaddr(unsigned int ipaddr, unsigned short port, server_type *type,
 }
 
 
+static server_type *
+master_server_type(struct qserver *server, int *port_adjust)
+{
+	server_type *server_type;
+
+	if (server->query_arg && (server->type->id == GAMESPY_MASTER)) {
+		server_type = find_server_type_string(server->query_arg);
+		if (server_type == NULL) {
+			server_type = find_server_type_id(server->type->master);
+		}
+	} else {
+		server_type = find_server_type_id(server->type->master);
+	}
+
+	*port_adjust = 0;
+	if ((server->type->id == GAMESPY_MASTER) && server_type) {
+		if (server_type->id == UN_SERVER) {
+			*port_adjust = -1;
+		} else if (server_type->id == KINGPIN_SERVER) {
+			*port_adjust = 10;
+		}
+	}
+
+	return (server_type);
+}
+
+
+/*
+ * Add the servers a master has sent since it was last called, so they're
+ * queried while it's still sending the rest. Servers another master, or
+ * an earlier page, has already sent aren't added twice, even once they've
+ * been shown.
+ */
+static void
+add_servers_from_master(struct qserver *server)
+{
+	unsigned int ipaddr;
+	unsigned short port;
+	int new_server, port_adjust;
+	server_type *server_type;
+
+	if ((server->master_pkt == NULL) || server->outfilename) {
+		// written out once the master is done
+		return;
+	}
+	server_type = master_server_type(server, &port_adjust);
+	if (server_type == NULL) {
+		return;
+	}
+
+	if (server->master_pkt_added > server->master_pkt_len) {
+		// the master started over, what it sent before is already added
+		server->master_pkt_added = server->master_pkt_len;
+	}
+	for ( ; server->master_pkt_added + 6 <= server->master_pkt_len; server->master_pkt_added += 6) {
+		memcpy(&ipaddr, &server->master_pkt[server->master_pkt_added], 4);
+		memcpy(&port, &server->master_pkt[server->master_pkt_added + 4], 2);
+		ipaddr = ntohl(ipaddr);
+		port = ntohs(port) + port_adjust;
+		if (!master_seen_add(ipaddr, port)) {
+			// already queried, and maybe shown and freed
+			continue;
+		}
+		new_server = 1;
+		add_qserver_byaddr(ipaddr, port, server_type, &new_server);
+		server->master_n_added += new_server;
+	}
+}
+
+
 void
 add_servers_from_masters()
 {
 	struct qserver *server;
 	unsigned int ipaddr, i;
 	unsigned short port;
-	int n_servers, new_server, port_adjust = 0;
+	int n_servers, port_adjust;
 	char *pkt;
 	server_type *server_type;
 	FILE *outfile;
@@ -4165,23 +4953,7 @@ add_servers_from_masters()
 			continue;
 		}
 		pkt = server->master_pkt;
-
-		if (server->query_arg && (server->type->id == GAMESPY_MASTER)) {
-			server_type = find_server_type_string(server->query_arg);
-			if (server_type == NULL) {
-				server_type = find_server_type_id(server->type->master);
-			}
-		} else {
-			server_type = find_server_type_id(server->type->master);
-		}
-
-		if ((server->type->id == GAMESPY_MASTER) && server_type) {
-			if (server_type->id == UN_SERVER) {
-				port_adjust = -1;
-			} else if (server_type->id == KINGPIN_SERVER) {
-				port_adjust = 10;
-			}
-		}
+		server_type = master_server_type(server, &port_adjust);
 
 		outfile = NULL;
 		if (server->outfilename) {
@@ -4195,36 +4967,42 @@ add_servers_from_masters()
 				continue;
 			}
 		}
-		n_servers = 0;
-		for (i = 0; i < server->master_pkt_len; i += 6) {
-			memcpy(&ipaddr, &pkt[i], 4);
-			memcpy(&port, &pkt[i + 4], 2);
-			ipaddr = ntohl(ipaddr);
-			port = ntohs(port) + port_adjust;
-			new_server = 1;
-			if (outfile) {
-				fprintf(outfile, "%s %d.%d.%d.%d:%hu\n",
-				    server_type ? server_type->type_string : "",
-				    (ipaddr >> 24) & 0xff,
-				    (ipaddr >> 16) & 0xff,
-				    (ipaddr >> 8) & 0xff,
-				    ipaddr & 0xff, port
-				    );
-			} else if (server_type == NULL) {
-				xform_printf(OF, "%d.%d.%d.%d:%hu\n", (ipaddr >> 24) & 0xff, (ipaddr >> 16) & 0xff, (ipaddr >> 8) & 0xff, ipaddr & 0xff, port);
-			} else {
-				add_qserver_byaddr(ipaddr, port, server_type, &new_server);
+
+		if (outfile || (server_type == NULL)) {
+			n_servers = 0;
+			for (i = 0; i < server->master_pkt_len; i += 6) {
+				memcpy(&ipaddr, &pkt[i], 4);
+				memcpy(&port, &pkt[i + 4], 2);
+				ipaddr = ntohl(ipaddr);
+				port = ntohs(port) + port_adjust;
+				if (outfile) {
+					fprintf(outfile, "%s %d.%d.%d.%d:%hu\n",
+					    server_type ? server_type->type_string : "",
+					    (ipaddr >> 24) & 0xff,
+					    (ipaddr >> 16) & 0xff,
+					    (ipaddr >> 8) & 0xff,
+					    ipaddr & 0xff, port
+					    );
+				} else {
+					xform_printf(OF, "%d.%d.%d.%d:%hu\n", (ipaddr >> 24) & 0xff, (ipaddr >> 16) & 0xff, (ipaddr >> 8) & 0xff, ipaddr & 0xff, port);
+				}
+				n_servers++;
 			}
-			n_servers += new_server;
+		} else {
+			// most were added as they arrived
+			add_servers_from_master(server);
+			n_servers = server->master_n_added;
 		}
 		free(server->master_pkt);
 		server->master_pkt = NULL;
 		server->master_pkt_len = 0;
+		server->master_pkt_added = 0;
 		server->n_servers = n_servers;
 		if (outfile) {
 			fclose(outfile);
 		}
 	}
+	mcache_write();
 	if (hostname_lookup) {
 		hcache_update_file();
 	}
@@ -4232,8 +5010,11 @@ add_servers_from_masters()
 }
 
 
-void
-init_qserver(struct qserver *server, server_type *type)
+/*
+ * Everything a query changes, so it can be started afresh
+ */
+static void
+init_query_state(struct qserver *server)
 {
 	server->server_name = NULL;
 	server->map_name = NULL;
@@ -4257,7 +5038,13 @@ init_qserver(struct qserver *server, server_type *type)
 	server->n_servers = 0;
 	server->master_pkt_len = 0;
 	server->master_pkt = NULL;
+	server->master_pkt_added = 0;
+	server->master_n_added = 0;
 	server->error = NULL;
+	server->timer_index = -1;
+	server->worker_index = -1;
+	server->rtt_sends = 0;
+	server->source = NULL;
 
 	server->saved_data.data = NULL;
 	server->saved_data.datalen = 0;
@@ -4265,9 +5052,8 @@ init_qserver(struct qserver *server, server_type *type)
 	server->saved_data.pkt_max = 0;
 	server->saved_data.next = NULL;
 
-	server->type = type;
 	server->next_rule = (get_server_rules) ? "" : NO_SERVER_RULES;
-	server->next_player_info = (get_player_info && type->player_packet) ? 0 : NO_PLAYER_INFO;
+	server->next_player_info = (get_player_info && server->type->player_packet) ? 0 : NO_PLAYER_INFO;
 
 	server->n_player_info = 0;
 	server->players = NULL;
@@ -4275,11 +5061,43 @@ init_qserver(struct qserver *server, server_type *type)
 	server->rules = NULL;
 	server->last_rule = &server->rules;
 	server->missing_rules = 0;
+}
+
+
+void
+init_qserver(struct qserver *server, server_type *type)
+{
+	server->type = type;
+	server->rtt.samples = 0;
+	init_query_state(server);
 
 	num_servers_total++;
 }
 
 
+static unsigned int
+address_hash(unsigned int ipaddr, unsigned short port)
+{
+	unsigned int hash = ipaddr ^ (port * 0x9e3779b1u);
+
+	// murmur3 finaliser, addresses from a master list are far from random
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	hash ^= hash >> 16;
+
+	return (hash);
+}
+
+
+static unsigned int
+server_hash_slot(unsigned int ipaddr, unsigned short port)
+{
+	return (address_hash(ipaddr, port) & (server_hash_size - 1));
+}
+
+
 // ipaddr should be network byte-order
 // port should be host byte-order
 // NOTE: This will return the first matching server, which is not nessacarily correct
@@ -4287,26 +5105,25 @@ init_qserver(struct qserver *server, server_type *type)
 struct qserver *
 find_server_by_address(unsigned int ipaddr, unsigned short port)
 {
-	struct qserver **hashed;
-	unsigned int hash, i;
+	struct qserver *hashed;
+	unsigned int i, mask = server_hash_size - 1;
 
 	if (!noserverdups && show_errors) {
 		fprintf(stderr, "error: find_server_by_address while duplicates are allowed, this is unsafe!");
 	}
 
-	hash = (ipaddr + port) % ADDRESS_HASH_LENGTH;
-
 	if (ipaddr == 0) {
-		for (hash = 0; hash < ADDRESS_HASH_LENGTH; hash++) {
-			printf("%3d %d\n", hash, server_hash_len[hash]);
-		}
+		printf("%u servers in %u slots\n", server_hash_count, server_hash_size);
+		return (NULL);
+	}
+
+	if (server_hash_count == 0) {
 		return (NULL);
 	}
 
-	hashed = server_hash[hash];
-	for (i = server_hash_len[hash]; i; i--, hashed++) {
-		if (*hashed && ((*hashed)->ipaddr == ipaddr) && ((*hashed)->port == port)) {
-			return (*hashed);
+	for (i = server_hash_slot(ipaddr, port); (hashed = server_hash[i]) != NULL; i = (i + 1) & mask) {
+		if ((hashed->ipaddr == ipaddr) && (hashed->port == port)) {
+			return (hashed);
 		}
 	}
 	return (NULL);
@@ -4316,49 +5133,119 @@ find_server_by_address(unsigned int ipaddr, unsigned short port)
 void
 add_server_to_hash(struct qserver *server)
 {
-	unsigned int hash;
+	struct qserver **old_hash = server_hash;
+	unsigned int i, j, old_size = server_hash_size;
 
-	hash = (server->ipaddr + server->port) % ADDRESS_HASH_LENGTH;
+	// kept at most half full so runs stay short
+	if ((server_hash_count + 1) * 2 > server_hash_size) {
+		server_hash_size = server_hash_size ? server_hash_size * 2 : SERVER_HASH_MIN;
+		server_hash = (struct qserver **)calloc(server_hash_size, sizeof(struct qserver *));
+		for (i = 0; i < old_size; i++) {
+			if (old_hash[i] == NULL) {
+				continue;
+			}
+			for (j = server_hash_slot(old_hash[i]->ipaddr, old_hash[i]->orig_port); server_hash[j] != NULL; j = (j + 1) & (server_hash_size - 1)) {
+			}
+			server_hash[j] = old_hash[i];
+		}
+		free(old_hash);
+	}
 
-	if (server_hash_len[hash] % 16 == 0) {
-		server_hash[hash] = (struct qserver **)realloc(server_hash[hash], sizeof(struct qserver **) * (server_hash_len[hash] + 16));
-		memset(&server_hash[hash][server_hash_len[hash]], 0, sizeof(struct qserver **) * 16);
+	for (i = server_hash_slot(server->ipaddr, server->orig_port); server_hash[i] != NULL; i = (i + 1) & (server_hash_size - 1)) {
 	}
-	server_hash[hash][server_hash_len[hash]] = server;
-	server_hash_len[hash]++;
+	server_hash[i] = server;
+	server_hash_count++;
 }
 
 
 void
 remove_server_from_hash(struct qserver *server)
 {
-	struct qserver **hashed;
-	unsigned int hash, i, ipaddr = server->ipaddr;
-	unsigned short port = server->orig_port;
+	unsigned int i, j, home, mask = server_hash_size - 1;
+
+	if (server_hash_count == 0) {
+		return;
+	}
 
-	hash = (ipaddr + port) % ADDRESS_HASH_LENGTH;
+	// NOTE: we use direct pointer checks here to prevent issues with duplicate port servers e.g. teamspeak 2 and 3
+	for (i = server_hash_slot(server->ipaddr, server->orig_port); server_hash[i] != server; i = (i + 1) & mask) {
+		if (server_hash[i] == NULL) {
+			// never hashed, its address wasn't known
+			return;
+		}
+	}
 
-	hashed = server_hash[hash];
-	for (i = server_hash_len[hash]; i; i--, hashed++) {
-		// NOTE: we use direct pointer checks here to prevent issues with duplicate port servers e.g. teamspeak 2 and 3
-		if (*hashed == server) {
-			*hashed = NULL;
-			break;
+	// move back any later server in the run which can take its place,
+	// so runs never have holes and lookups can stop at the first empty
+	for (j = (i + 1) & mask; server_hash[j] != NULL; j = (j + 1) & mask) {
+		home = server_hash_slot(server_hash[j]->ipaddr, server_hash[j]->orig_port);
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			server_hash[i] = server_hash[j];
+			i = j;
 		}
 	}
+	server_hash[i] = NULL;
+	server_hash_count--;
 }
 
 
 void
 free_server_hash()
 {
-	int i;
+	free(server_hash);
+	server_hash = NULL;
+	server_hash_size = server_hash_count = 0;
+}
+
+
+/*
+ * Note a master has sent ipaddr:port, both host byte-order
+ *
+ * \returns 1 if it's new or 0 if a master has sent it before
+ */
+static int
+master_seen_add(unsigned int ipaddr, unsigned short port)
+{
+	unsigned long long *old_seen = master_seen;
+	unsigned long long key = (((unsigned long long)ipaddr << 16) | port) + 1;
+	unsigned int i, j, old_size = master_seen_size, mask;
+
+	// kept at most half full so runs stay short
+	if ((master_seen_count + 1) * 2 > master_seen_size) {
+		master_seen_size = master_seen_size ? master_seen_size * 2 : SERVER_HASH_MIN;
+		master_seen = (unsigned long long *)calloc(master_seen_size, sizeof(unsigned long long));
+		mask = master_seen_size - 1;
+		for (i = 0; i < old_size; i++) {
+			if (old_seen[i] == 0) {
+				continue;
+			}
+			j = address_hash((unsigned int)((old_seen[i] - 1) >> 16), (unsigned short)(old_seen[i] - 1)) & mask;
+			for ( ; master_seen[j] != 0; j = (j + 1) & mask) {
+			}
+			master_seen[j] = old_seen[i];
+		}
+		free(old_seen);
+	}
 
-	for (i = 0; i < ADDRESS_HASH_LENGTH; i++) {
-		if (server_hash[i]) {
-			free(server_hash[i]);
+	mask = master_seen_size - 1;
+	for (i = address_hash(ipaddr, port) & mask; master_seen[i] != 0; i = (i + 1) & mask) {
+		if (master_seen[i] == key) {
+			return (0);
 		}
 	}
+	master_seen[i] = key;
+	master_seen_count++;
+
+	return (1);
+}
+
+
+static void
+free_master_seen()
+{
+	free(master_seen);
+	master_seen = NULL;
+	master_seen_size = master_seen_count = 0;
 }
 
 
@@ -4370,6 +5257,11 @@ bind_qserver_post(struct qserver *server)
 {
 	server->state = STATE_CONNECTED;
 
+	if (!(server->flags & FLAG_SOCKET_POOL)) {
+		// Due straight away so the first pass of send_packets sees it
+		timer_schedule(server, qtime_now());
+	}
+
 	if (server->type->flags & TF_TCP_CONNECT) {
 		int one = 1;
 		if (-1 == setsockopt(server->fd, IPPROTO_TCP, TCP_NODELAY, (char *)&one, sizeof(one))) {
@@ -4377,6 +5269,10 @@ bind_qserver_post(struct qserver *server)
 		}
 	}
 
+	if (!(server->type->flags & TF_TCP_CONNECT)) {
+		timestamp_enable(server->fd);
+	}
+
 	if (server->type->id & MASTER_SERVER) {
 		// Use a large buffer so we dont miss packets
 		int sockbuf = RECV_BUF;
@@ -4385,14 +5281,36 @@ bind_qserver_post(struct qserver *server)
 		}
 	}
 
+	if (server->flags & FLAG_CONNECT_WAIT) {
+		// already registered while its connect was in progress
+		server->flags &= ~FLAG_CONNECT_WAIT;
+		update_file_descriptor(server);
+		return (0);
+	}
+
+	register_qserver(server);
+
+	return (0);
+}
+
+
+/*
+ * Add server to connmap and the descriptors the main loop waits on
+ */
+static void
+register_qserver(struct qserver *server)
+{
 #ifndef _WIN32
 		if (server->fd >= max_connmap) {
 			int old_max = max_connmap;
 			max_connmap = server->fd + 32;
 			connmap = (struct qserver **)realloc(connmap, max_connmap * sizeof(struct qserver *));
 			memset(&connmap[old_max], 0, (max_connmap - old_max) * sizeof(struct qserver *));
+			connmap_generation = (unsigned int *)realloc(connmap_generation, max_connmap * sizeof(unsigned int));
+			memset(&connmap_generation[old_max], 0, (max_connmap - old_max) * sizeof(unsigned int));
 		}
 		connmap[server->fd] = server;
+		connmap_generation[server->fd]++;
 #endif
 #ifdef _WIN32
 		{
@@ -4408,20 +5326,7 @@ bind_qserver_post(struct qserver *server)
 			}
 		}
 #endif
-
-	return (0);
-}
-
-
-void
-add_ms_to_timeval(struct timeval *a, unsigned long interval_ms, struct timeval *result)
-{
-	result->tv_sec = a->tv_sec + (interval_ms / 1000);
-	result->tv_usec = a->tv_usec + ((interval_ms % 1000) * 1000);
-	if (result->tv_usec > 1000000) {
-		result->tv_usec -= 1000000;
-		result->tv_sec++;
-	}
+	add_file_descriptor(server);
 }
 
 
@@ -4437,46 +5342,50 @@ qserver_sockaddr(struct qserver *server, struct sockaddr_in *addr)
 }
 
 
+/*
+ * Block until server's connect finishes or it would time out, for -syncconnect
+ */
 int
-connected_qserver(struct qserver *server, int polling)
+connected_qserver(struct qserver *server)
 {
 	struct sockaddr_in addr;
 	char error[50];
-	int ret;
-	struct timeval tv, now, to;
+	int ret, wait_ms;
+	qtime_t to;
+#ifdef USE_SELECT
+	struct timeval tv;
 	fd_set connect_set;
+#else
+	struct pollfd connect_pollfd;
+#endif
 
 	error[0] = '\0';
-	gettimeofday(&now, NULL);
-	add_ms_to_timeval(&server->packet_time1, retry_interval * server->retry1, &to);
+	to = server->packet_time1 + (qtime_t)retry_interval * server->retry1 * QTIME_MS;
 
-	if (polling) {
-		// No delay
-		tv.tv_sec = 0;
-		tv.tv_usec = 0;
-	} else {
-		// Wait until the server would timeout
-		tv.tv_sec = to.tv_sec;
-		tv.tv_usec = to.tv_usec;
+	// Wait until the server would timeout
+	wait_ms = time_delta(to, qtime_update());
+	if (wait_ms < 0) {
+		wait_ms = 0;
 	}
 
 	while (1) {
+#ifdef USE_SELECT
 		FD_ZERO(&connect_set);
 		FD_SET(server->fd, &connect_set);
+		tv.tv_sec = wait_ms / 1000;
+		tv.tv_usec = (wait_ms % 1000) * 1000;
 
 		// NOTE: We may need to check exceptfds here on windows instead of writefds
 		ret = select(server->fd + 1, NULL, &connect_set, NULL, &tv);
+#else
+		// descriptors aren't limited to FD_SETSIZE so don't use select
+		connect_pollfd.fd = server->fd;
+		connect_pollfd.events = POLLOUT;
+		connect_pollfd.revents = 0;
+		ret = poll(&connect_pollfd, 1, wait_ms);
+#endif
 		if (0 == ret) {
 			// Time limit expired
-			if (polling) {
-				// Check if we have run out of time to connect
-				gettimeofday(&now, NULL);
-				if (0 < time_delta(&to, &now)) {
-					// We still have time to connect
-					return (-2);
-				}
-			}
-
 			qserver_sockaddr(server, &addr);
 			sprintf(error, "connect:%s:%u - timeout", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
 			server->server_name = TIMEOUT;
@@ -4526,115 +5435,330 @@ connect_error:
 	if (show_errors) {
 		perror(error);
 	}
+	// not counted in connected until it's bound
 	close(server->fd);
 	server->fd = -1;
-	connected--;
 
 	return (-1);
 }
 
 
-int
-bind_qserver2(struct qserver *server, int wait)
+/*
+ * Shared UDP sockets
+ *
+ * With -udpsockets UDP servers don't get a socket of their own, instead
+ * each server type gets a small pool of unconnected sockets which all its
+ * servers are queried over. Replies are routed back to the server by
+ * their source address via the server hash.
+ */
+#define SHARED_RECV_BUF    (RECV_BUF * 16)
+
+struct socket_pool {
+	server_type *type;
+	struct qserver **sockets;
+	int next;
+};
+
+static struct socket_pool *socket_pools;
+static int n_socket_pools;
+
+static struct qserver *
+create_pool_socket(server_type *type)
 {
 	struct sockaddr_in addr;
-	static int one = 1;
-
-	debug(1, "start %p @ %d.%d.%d.%d:%hu\n",
-	    server,
-	    server->ipaddr & 0xff,
-	    (server->ipaddr >> 8) & 0xff,
-	    (server->ipaddr >> 16) & 0xff,
-	    (server->ipaddr >> 24) & 0xff,
-	    server->port
-	    );
+	struct qserver *pool_socket;
+	int sockbuf = SHARED_RECV_BUF;
 
-	if (server->type->flags & TF_TCP_CONNECT) {
-		server->fd = socket(AF_INET, SOCK_STREAM, 0);
-	} else {
-		server->fd = socket(AF_INET, SOCK_DGRAM, 0);
+	pool_socket = (struct qserver *)calloc(1, sizeof(struct qserver));
+	if (pool_socket == NULL) {
+		return (NULL);
 	}
+	pool_socket->type = type;
+	pool_socket->flags = FLAG_SOCKET_POOL;
+	pool_socket->timer_index = -1;
 
-	if (server->fd == INVALID_SOCKET) {
-		if (sockerr() == EMFILE) {
-			// Per process descriptor table is full - retry
-			server->fd = -1;
-			return (-2);
-		}
-
+	pool_socket->fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (pool_socket->fd == INVALID_SOCKET) {
 		perror("socket");
-		server->server_name = SYSERROR;
-		server->state = STATE_SYS_ERROR;
-		return (-1);
+		free(pool_socket);
+		return (NULL);
 	}
 
+	// the pool's sockets take turns over the sources, servers sent
+	// through one count against its source
+	pool_socket->source = source_next();
 	addr.sin_family = AF_INET;
-	addr.sin_addr.s_addr = htonl(source_ip);
-	if (server->type->id == Q2_MASTER) {
-		addr.sin_port = htons(26500);
-	} else if (source_port == 0) {
-		addr.sin_port = 0;
-	} else {
-		addr.sin_port = htons(source_port);
-		source_port++;
-		if (source_port > source_port_high) {
-			source_port = source_port_low;
-		}
-	}
+	addr.sin_addr.s_addr = htonl(pool_socket->source->ip);
+	addr.sin_port = htons(source_next_port(pool_socket->source));
 	memset(&(addr.sin_zero), 0, sizeof(addr.sin_zero));
 
-	if (bind(server->fd, (struct sockaddr *)&addr, sizeof(struct sockaddr)) == SOCKET_ERROR) {
+	if (bind(pool_socket->fd, (struct sockaddr *)&addr, sizeof(struct sockaddr)) == SOCKET_ERROR) {
 		perror("bind");
-		server->server_name = SYSERROR;
-		server->state = STATE_SYS_ERROR;
-		close(server->fd);
-		server->fd = -1;
-		return (-1);
+		close(pool_socket->fd);
+		free(pool_socket);
+		return (NULL);
 	}
 
-	if (server->flags & FLAG_BROADCAST) {
-		if (-1 == setsockopt(server->fd, SOL_SOCKET, SO_BROADCAST, (char *)&one, sizeof(one))) {
-			perror("Failed to set broadcast");
-			server->server_name = SYSERROR;
-			server->state = STATE_SYS_ERROR;
-			close(server->fd);
-			server->fd = -1;
-			return (-1);
-		}
+	set_non_blocking(pool_socket->fd);
+
+	// Replies for many servers queue up on each socket
+	if (-1 == setsockopt(pool_socket->fd, SOL_SOCKET, SO_RCVBUF, (void *)&sockbuf, sizeof(sockbuf))) {
+		perror("Failed to set socket buffer");
 	}
 
-	// we need nonblocking always. poll on an udp socket would wake
-	// up and recv blocks if a packet with incorrect checksum is
-	// received
-	set_non_blocking(server->fd);
+	bind_qserver_post(pool_socket);
 
-	if ((server->type->id != Q2_MASTER) && !(server->flags & FLAG_BROADCAST)) {
-		if (server->type->flags & TF_TCP_CONNECT) {
-			// TCP set packet_time1 so it can be used for ping calculations for protocols with an initial response
-			gettimeofday(&server->packet_time1, NULL);
-		}
+	return (pool_socket);
+}
 
-		qserver_sockaddr(server, &addr);
-		server->state = STATE_CONNECTING;
 
-		if (connect(server->fd, (struct sockaddr *)&addr, sizeof(addr)) == SOCKET_ERROR) {
-			if (connection_inprogress()) {
-				int ret;
+static struct qserver *
+get_pool_socket(server_type *type)
+{
+	struct socket_pool *pool;
+	int i, j;
 
-				// Ensure we don't detect the same error twice, specifically on a different server
-				clear_socketerror();
+	for (i = 0; i < n_socket_pools; i++) {
+		if (socket_pools[i].type == type) {
+			break;
+		}
+	}
 
-				if (!wait) {
-					debug(2, "connect:%s:%u - in progress", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
-					return (-3);
+	if (i == n_socket_pools) {
+		socket_pools = (struct socket_pool *)realloc(socket_pools, (n_socket_pools + 1) * sizeof(struct socket_pool));
+		pool = &socket_pools[n_socket_pools];
+		pool->type = type;
+		pool->next = 0;
+		pool->sockets = (struct qserver **)calloc(udp_socket_pool, sizeof(struct qserver *));
+		for (j = 0; j < udp_socket_pool; j++) {
+			pool->sockets[j] = create_pool_socket(type);
+			if (pool->sockets[j] == NULL) {
+				while (j--) {
+					qserver_disconnect(pool->sockets[j]);
+					free(pool->sockets[j]);
 				}
-				ret = connected_qserver(server, 0);
-				if (0 != ret) {
-					return (ret);
-				}
-			} else {
-				if (show_errors) {
-					char error[50];
+				free(pool->sockets);
+				return (NULL);
+			}
+		}
+		n_socket_pools++;
+	}
+
+	pool = &socket_pools[i];
+	pool->next = (pool->next + 1) % udp_socket_pool;
+
+	return (pool->sockets[pool->next]);
+}
+
+
+void
+free_socket_pools()
+{
+	int i, j;
+
+	for (i = 0; i < n_socket_pools; i++) {
+		for (j = 0; j < udp_socket_pool; j++) {
+			qserver_disconnect(socket_pools[i].sockets[j]);
+			free(socket_pools[i].sockets[j]);
+		}
+		free(socket_pools[i].sockets);
+	}
+	free(socket_pools);
+	socket_pools = NULL;
+	n_socket_pools = 0;
+}
+
+
+static int
+use_shared_socket(struct qserver *server)
+{
+	// Broadcasts need their own socket and Q2 masters a fixed port. Replies
+	// are matched on address so duplicate servers can't share either.
+	return (
+		udp_socket_pool &&
+		noserverdups &&
+		!(server->type->flags & TF_TCP_CONNECT) &&
+		!(server->flags & FLAG_BROADCAST) &&
+		(server->type->id != Q2_MASTER)
+		);
+}
+
+
+static int
+bind_shared_socket(struct qserver *server)
+{
+	struct qserver *pool_socket;
+
+	pool_socket = get_pool_socket(server->type);
+	if (pool_socket == NULL) {
+		server->server_name = SYSERROR;
+		server->state = STATE_SYS_ERROR;
+		return (-1);
+	}
+
+	server->fd = pool_socket->fd;
+	server->flags |= FLAG_SHARED_SOCKET;
+	server->state = STATE_CONNECTED;
+	source_acquire(server, pool_socket->source);
+
+	timer_schedule(server, qtime_now());
+
+	return (0);
+}
+
+
+static struct qserver *
+find_shared_server_by_port(struct qserver *pool_socket, unsigned int ipaddr, unsigned short port)
+{
+	struct qserver *hashed;
+	unsigned int i;
+
+	if (server_hash_count == 0) {
+		return (NULL);
+	}
+
+	// servers are hashed on the port they were added with
+	for (i = server_hash_slot(ipaddr, port); (hashed = server_hash[i]) != NULL; i = (i + 1) & (server_hash_size - 1)) {
+		if ((hashed->ipaddr == ipaddr) && (hashed->orig_port == port) &&
+		    (hashed->flags & FLAG_SHARED_SOCKET) && (hashed->fd == pool_socket->fd)) {
+			return (hashed);
+		}
+	}
+	return (NULL);
+}
+
+
+/*
+ * Find the in progress server a reply on a shared socket came from
+ */
+static struct qserver *
+find_shared_server(struct qserver *pool_socket, struct sockaddr_in *addr)
+{
+	struct qserver *server;
+	unsigned short port = ntohs(addr->sin_port);
+
+	if (!no_port_offset) {
+		server = find_shared_server_by_port(pool_socket, addr->sin_addr.s_addr, port - pool_socket->type->port_offset);
+		if (server && !(server->flags & TF_NO_PORT_OFFSET)) {
+			return (server);
+		}
+	}
+
+	server = find_shared_server_by_port(pool_socket, addr->sin_addr.s_addr, port);
+	if (server && (no_port_offset || server->flags & TF_NO_PORT_OFFSET)) {
+		return (server);
+	}
+
+	return (NULL);
+}
+
+
+int
+bind_qserver2(struct qserver *server, int wait)
+{
+	struct sockaddr_in addr;
+	struct source *source;
+	static int one = 1;
+
+	debug(1, "start %p @ %d.%d.%d.%d:%hu\n",
+	    server,
+	    server->ipaddr & 0xff,
+	    (server->ipaddr >> 8) & 0xff,
+	    (server->ipaddr >> 16) & 0xff,
+	    (server->ipaddr >> 24) & 0xff,
+	    server->port
+	    );
+
+	if (use_shared_socket(server)) {
+		return (bind_shared_socket(server));
+	}
+
+	if (server->type->flags & TF_TCP_CONNECT) {
+		server->fd = socket(AF_INET, SOCK_STREAM, 0);
+	} else {
+		server->fd = socket(AF_INET, SOCK_DGRAM, 0);
+	}
+
+	if (server->fd == INVALID_SOCKET) {
+		if (sockerr() == EMFILE) {
+			// Per process descriptor table is full - retry
+			server->fd = -1;
+			return (-2);
+		}
+
+		perror("socket");
+		server->server_name = SYSERROR;
+		server->state = STATE_SYS_ERROR;
+		return (-1);
+	}
+
+	source = source_next();
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(source->ip);
+	if (server->type->id == Q2_MASTER) {
+		addr.sin_port = htons(26500);
+	} else {
+		addr.sin_port = htons(source_next_port(source));
+	}
+	memset(&(addr.sin_zero), 0, sizeof(addr.sin_zero));
+
+	if (bind(server->fd, (struct sockaddr *)&addr, sizeof(struct sockaddr)) == SOCKET_ERROR) {
+		perror("bind");
+		server->server_name = SYSERROR;
+		server->state = STATE_SYS_ERROR;
+		close(server->fd);
+		server->fd = -1;
+		return (-1);
+	}
+
+	// released by qserver_disconnect, including when it's cleaned up
+	// after failing to connect
+	source_acquire(server, source);
+
+	if (server->flags & FLAG_BROADCAST) {
+		if (-1 == setsockopt(server->fd, SOL_SOCKET, SO_BROADCAST, (char *)&one, sizeof(one))) {
+			perror("Failed to set broadcast");
+			server->server_name = SYSERROR;
+			server->state = STATE_SYS_ERROR;
+			close(server->fd);
+			server->fd = -1;
+			return (-1);
+		}
+	}
+
+	// we need nonblocking always. poll on an udp socket would wake
+	// up and recv blocks if a packet with incorrect checksum is
+	// received
+	set_non_blocking(server->fd);
+
+	if ((server->type->id != Q2_MASTER) && !(server->flags & FLAG_BROADCAST)) {
+		if (server->type->flags & TF_TCP_CONNECT) {
+			// TCP set packet_time1 so it can be used for ping calculations for protocols with an initial response
+			server->packet_time1 = qtime_now();
+		}
+
+		qserver_sockaddr(server, &addr);
+		server->state = STATE_CONNECTING;
+
+		if (connect(server->fd, (struct sockaddr *)&addr, sizeof(addr)) == SOCKET_ERROR) {
+			if (connection_inprogress()) {
+				// Ensure we don't detect the same error twice, specifically on a different server
+				clear_socketerror();
+
+				if (!wait) {
+					// the main loop finishes it off once the socket
+					// is writable, or times it out at the deadline
+					debug(2, "connect:%s:%u - in progress", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+					server->flags |= FLAG_CONNECT_WAIT;
+					register_qserver(server);
+					timer_schedule(server, server->packet_time1 + (qtime_t)retry_interval * server->retry1 * QTIME_MS);
+					return (-3);
+				}
+				// finishes the bind itself when it's connected
+				return (connected_qserver(server));
+			} else {
+				if (show_errors) {
+					char error[50];
 					sprintf(error, "connect:%s:%u", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
 					perror(error);
 				}
@@ -4658,19 +5782,25 @@ bind_qserver(struct qserver *server)
 }
 
 
-static struct timeval t_lastsend = { 0, 0 };
+static qtime_t t_lastsend = 0;
 
 int
 bind_sockets()
 {
-	struct qserver *server, *next_server, *first_server, *last_server;
-	struct timeval now;
-	int rc, retry_count = 0, inprogress = 0;
+	struct qserver *server, *next_server, *stalled = NULL;
+	int rc, retry_count = 0;
+
+	// servers from masters are queried as they arrive, except when
+	// they're left for the worker processes and have to be passed over
+	int resume = !waiting_for_masters || !masters_only;
 
-	gettimeofday(&now, NULL);
-	if (connected && sendinterval && (time_delta(&now, &t_lastsend) < sendinterval)) {
+	// hand over finished host name lookups, resolved servers join the
+	// queue wherever they are in the list
+	resolve_poll();
+
+	if (!ratelimit_enabled() && connected && sendinterval && (time_delta(qtime_now(), t_lastsend) < sendinterval)) {
 		server = NULL;
-	} else if (!waiting_for_masters) {
+	} else if (resume) {
 		if (last_server_bind == NULL) {
 			last_server_bind = servers;
 		}
@@ -4679,13 +5809,35 @@ bind_sockets()
 		server = servers;
 	}
 
-	first_server = server;
-
-	for ( ; server != NULL && connected < max_simultaneous; ) {
+	for ( ; server != NULL && connected < congestion_limit(); ) {
 		// note the next server for use as process_func can free the server
 		next_server = server->next;
-		if ((server->server_name == NULL) && (server->fd == -1)) {
-			if (waiting_for_masters && !server->type->master) {
+		if ((server->server_name == NULL) && (server->fd == -1) && !(server->flags & FLAG_RESOLVING)) {
+			if (masters_only && !server->type->master && !(server->flags & FLAG_BROADCAST)) {
+				// left for the worker processes
+				server = next_server;
+				continue;
+			}
+
+			if (server->type->master && mcache_fill(server)) {
+				// its list was fetched recently enough by an earlier run
+				add_servers_from_master(server);
+				cleanup_qserver(server, FORCE);
+				server = next_server;
+				continue;
+			}
+
+			if (!ratelimit_ready(ratelimit_for(server))) {
+				if (ratelimit_next() != 0) {
+					// out of budget, carry on from here once one refills
+					break;
+				}
+
+				// only its own budget is spent, so others can still go
+				// but the next call has to start back here
+				if (stalled == NULL) {
+					stalled = server;
+				}
 				server = next_server;
 				continue;
 			}
@@ -4699,24 +5851,30 @@ bind_sockets()
 				    server->port
 				    );
 
-				gettimeofday(&t_lastsend, NULL);
+				t_lastsend = qtime_now();
 				debug(2, "calling status_query_func for %p - connect", server);
 				process_func_ret(server, server->type->status_query_func(server));
 
 				connected++;
-				if (!waiting_for_masters) {
+				if (resume && (stalled == NULL)) {
 					last_server_bind = server;
 				}
-				break;
+
+				// without a rate limit it's one server per call
+				if (!ratelimit_enabled()) {
+					break;
+				}
 			} else if (rc == -3) {
-				// Connect in progress
+				// Connect in progress, connect_finished sends the query
 
 				// We add to increment connected as we need to know the total
 				// amount of connections in progress not just those that have
 				// successfuly completed their connection otherwise we could
 				// blow FD_SETSIZE
 				connected++;
-				inprogress++;
+				if (resume && (stalled == NULL)) {
+					last_server_bind = server;
+				}
 			} else if ((rc == -2) && (++retry_count > 2)) {
 				return (-2);
 			} else if (-1 == rc) {
@@ -4727,48 +5885,132 @@ bind_sockets()
 		server = next_server;
 	}
 
-	// Wait for all connections to succeed or fail
-	last_server = server;
-	while (inprogress) {
-		inprogress = 0;
-		server = first_server;
-		for ( ; server != last_server; ) {
-			next_server = server->next;
-			if (STATE_CONNECTING == server->state) {
-				rc = connected_qserver(server, 1);
-				switch (rc) {
-				case 0:
-					// Connected
-					gettimeofday(&t_lastsend, NULL);
-					debug(2, "calling status_query_func for %p - in progress", server);
-					process_func_ret(server, server->type->status_query_func(server));
-
-					// NOTE: connected is already incremented
-					if (!waiting_for_masters) {
-						last_server_bind = server;
-					}
-					break;
+	if ((NULL != server) || (NULL != stalled) || (!connected && retry_count) || resolve_pending()) {
+		// Retry later, more to process
+		return (-2);
+	}
 
-				case -2:
-					// In progress
-					inprogress++;
-					break;
+	return (0);
+}
 
-				case -1:
-					cleanup_qserver(server, FORCE);
-					break;
-				}
+
+void
+qserver_resolved(struct qserver **list, int n_servers, const char *hostname, unsigned long ipaddr, int h_err)
+{
+	struct qserver *server;
+	int i;
+
+	if ((ipaddr == 0) && show_errors) {
+		fprintf(stderr, "%s: %s\n", hostname, strherror(h_err));
+	}
+
+	for (i = 0; i < n_servers; i++) {
+		server = list[i];
+		server->flags &= ~FLAG_RESOLVING;
+
+		if (ipaddr == 0) {
+			server->server_name = HOSTNOTFOUND;
+			server->error = strdup(strherror(h_err));
+			num_servers--;
+			continue;
+		}
+
+		if (noserverdups && (find_server_by_address(htonl(ipaddr), server->orig_port) != NULL)) {
+			num_servers--;
+			num_servers_total--;
+			free_server(server);
+			continue;
+		}
+
+		server->ipaddr = htonl(ipaddr);
+		add_server_to_hash(server);
+		if (server->type->master) {
+			waiting_for_masters++;
+		}
+	}
+
+	// bind_sockets may have passed them by already
+	last_server_bind = NULL;
+}
+
+
+void
+qserver_named(struct qserver **list, int n_servers, const char *hostname)
+{
+	struct qserver *server;
+	int i;
+
+	for (i = 0; i < n_servers; i++) {
+		server = list[i];
+		server->flags &= ~FLAG_NAME_WAIT;
+		if (hostname != NULL) {
+			free(server->host_name);
+			if (strchr(server->arg, ':') != NULL) {
+				server->host_name = (char *)malloc(strlen(hostname) + 5 + 2);
+				sprintf(server->host_name, "%s:%hu", hostname, server->orig_port);
+			} else {
+				server->host_name = strdup(hostname);
 			}
-			server = next_server;
+		}
+		if (server->flags & FLAG_DISPLAY_WAIT) {
+			server->flags &= ~FLAG_DISPLAY_WAIT;
+			display_server(server);
 		}
 	}
+}
 
-	if ((NULL != last_server) || (!connected && retry_count)) {
-		// Retry later, more to process
-		return (-2);
+
+/*
+ * A connect bind_sockets left in progress has finished, so send the
+ * first query if it worked.
+ */
+static void
+connect_finished(struct qserver *server)
+{
+	struct sockaddr_in addr;
+	char error[50];
+	int sockerr = 0;
+	unsigned int lon = sizeof(int);
+
+	if ((0 != getsockopt(server->fd, SOL_SOCKET, SO_ERROR, (void *)(&sockerr), &lon)) || sockerr) {
+		if (sockerr) {
+			// set the real error
+			errno = sockerr;
+		}
+		if (show_errors) {
+			qserver_sockaddr(server, &addr);
+			sprintf(error, "connect: %s:%u", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+			perror(error);
+		}
+		server->server_name = SYSERROR;
+		server->state = STATE_SYS_ERROR;
+		cleanup_qserver(server, FORCE);
+		return;
 	}
 
-	return (0);
+	bind_qserver_post(server);
+
+	t_lastsend = qtime_now();
+	debug(2, "calling status_query_func for %p - connected", server);
+	process_func_ret(server, server->type->status_query_func(server));
+}
+
+
+/*
+ * A connect bind_sockets left in progress has run out of time
+ */
+static void
+connect_timeout(struct qserver *server)
+{
+	struct sockaddr_in addr;
+
+	if (show_errors) {
+		qserver_sockaddr(server, &addr);
+		fprintf(stderr, "connect:%s:%u - timeout\n", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+	}
+	server->state = STATE_TIMEOUT;
+	server->flags |= FLAG_CUT_SHORT;
+	cleanup_qserver(server, FORCE);
 }
 
 
@@ -4776,6 +6018,10 @@ int
 process_func_ret(struct qserver *server, int ret)
 {
 	debug(3, "%p, %d", server, ret);
+	if (server->type->master) {
+		// start on the servers it's sent so far
+		add_servers_from_master(server);
+	}
 	switch (ret) {
 	case INPROGRESS:
 		return (ret);
@@ -4784,12 +6030,14 @@ process_func_ret(struct qserver *server, int ret)
 		cleanup_qserver(server, NO_FORCE);
 		return (ret);
 
-	case DONE_FORCE:
 	case SYS_ERROR:
 	case MEM_ERROR:
 	case PKT_ERROR:
 	case ORD_ERROR:
 	case REQ_ERROR:
+		server->flags |= FLAG_CUT_SHORT;
+		// fall through
+	case DONE_FORCE:
 		cleanup_qserver(server, FORCE);
 		return (ret);
 	}
@@ -4801,127 +6049,281 @@ process_func_ret(struct qserver *server, int ret)
 
 
 /*
- * Functions for sending packets
+ * Timer heap
+ *
+ * Connected servers are kept in a binary min-heap on the time they next
+ * need attention from send_packets, so each pass only touches the servers
+ * which are due instead of every connected server.
  */
-// this is so broken, someone please rewrite the timeout handling
-void
-send_packets()
+static struct qserver **timer_heap;
+static int n_timers;
+static int max_timers;
+
+// the server send_packets is working on, cleared if it's disconnected
+static struct qserver *timer_current;
+
+static int
+timer_expired(struct qserver *server, qtime_t now)
 {
-	struct qserver *server;
-	struct timeval now;
-	int interval, n_sent = 0, prev_n_sent;
-	unsigned i;
+	return (server->deadline <= now);
+}
 
-	debug(3, "processing...");
 
-	gettimeofday(&now, NULL);
+static void
+timer_set(int i, struct qserver *server)
+{
+	timer_heap[i] = server;
+	server->timer_index = i;
+}
+
 
-	if (!t_lastsend.tv_sec) {
-		// nothing
-	} else if (connected && sendinterval && (time_delta(&now, &t_lastsend) < sendinterval)) {
+static void
+timer_sift_up(int i)
+{
+	struct qserver *server = timer_heap[i];
+	int parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (timer_expired(timer_heap[parent], server->deadline)) {
+			break;
+		}
+		timer_set(i, timer_heap[parent]);
+		i = parent;
+	}
+	timer_set(i, server);
+}
+
+
+static void
+timer_sift_down(int i)
+{
+	struct qserver *server = timer_heap[i];
+	int child;
+
+	while ((child = 2 * i + 1) < n_timers) {
+		if ((child + 1 < n_timers) && !timer_expired(timer_heap[child], timer_heap[child + 1]->deadline)) {
+			child++;
+		}
+		if (timer_expired(server, timer_heap[child]->deadline)) {
+			break;
+		}
+		timer_set(i, timer_heap[child]);
+		i = child;
+	}
+	timer_set(i, server);
+}
+
+
+/*
+ * Add server to the heap, or move it if it's already there, so it's
+ * handled by the first send_packets after deadline.
+ */
+static void
+timer_schedule(struct qserver *server, qtime_t deadline)
+{
+	int i = server->timer_index;
+
+	server->deadline = deadline;
+
+	if (i == -1) {
+		if (n_timers == max_timers) {
+			max_timers = max_timers ? max_timers * 2 : 256;
+			timer_heap = (struct qserver **)realloc(timer_heap, max_timers * sizeof(struct qserver *));
+		}
+		i = n_timers++;
+		timer_set(i, server);
+	}
+
+	timer_sift_up(i);
+	timer_sift_down(server->timer_index);
+}
+
+
+static void
+timer_remove(struct qserver *server)
+{
+	struct qserver *moved;
+	int i = server->timer_index;
+
+	if (i == -1) {
 		return;
 	}
 
-	for (i = 0; i < max_connmap; ++i) {
-		server = connmap[i];
-		if (!server) {
-			continue;
+	if (server == timer_current) {
+		timer_current = NULL;
+	}
+
+	server->timer_index = -1;
+	if (i != --n_timers) {
+		// fill the hole with the last entry and restore the heap
+		moved = timer_heap[n_timers];
+		timer_set(i, moved);
+		timer_sift_up(i);
+		timer_sift_down(moved->timer_index);
+	}
+}
+
+
+/*
+ * Functions for sending packets
+ */
+
+/*
+ * Send any retries or follow up queries due for server.
+ * Returns the number of queries sent.
+ */
+static int
+send_server_packets(struct qserver *server, qtime_t now)
+{
+	int interval, n_sent = 0;
+
+	if (server->type->id & MASTER_SERVER) {
+		interval = master_retry_interval;
+	} else {
+		interval = retry_interval;
+	}
+	interval = rtt_timeout(server, interval);
+
+	debug(2, "server %p, name %s, retry1 %d, next_rule %p, next_player_info %d, num_players %d, n_retries %d",
+	    server,
+	    server->server_name,
+	    server->retry1,
+	    server->next_rule,
+	    server->next_player_info,
+	    server->num_players,
+	    n_retries
+	    );
+	if (server->server_name == NULL) {
+		// We havent seen the server yet?
+		if ((server->retry1 != n_retries) && (time_delta(now, server->packet_time1) < (interval * (n_retries - server->retry1 + 1)))) {
+			return (n_sent);
 		}
 
-		if (server->fd == -1) {
-			debug(0, "invalid entry in connmap\n");
+		if (server->retry1 < 1) {
+			// No more retries
+			server->flags |= FLAG_CUT_SHORT;
+			cleanup_qserver(server, FORCE);
+			return (n_sent);
 		}
 
-		if (server->type->id & MASTER_SERVER) {
-			interval = master_retry_interval;
-		} else {
-			interval = retry_interval;
+		if ((qserver_get_timeout(server, now) <= 0) && !(server->type->flags & TF_TCP_CONNECT)) {
+			// Query status
+			debug(2, "calling status_query_func for %p", server);
+			process_func_ret(server, server->type->status_query_func(server));
+			t_lastsend = qtime_now();
+			n_sent++;
+			return (n_sent);
 		}
+	}
 
-		debug(2, "server %p, name %s, retry1 %d, next_rule %p, next_player_info %d, num_players %d, n_retries %d",
-		    server,
-		    server->server_name,
-		    server->retry1,
-		    server->next_rule,
-		    server->next_player_info,
-		    server->num_players,
-		    n_retries
-		    );
-		prev_n_sent = n_sent;
-		if (server->server_name == NULL) {
-			// We havent seen the server yet?
-			if ((server->retry1 != n_retries) && (time_delta(&now, &server->packet_time1) < (interval * (n_retries - server->retry1 + 1)))) {
-				continue;
-			}
+	if (server->next_rule != NO_SERVER_RULES) {
+		// We want server rules
+		if ((server->retry1 != n_retries) && (time_delta(now, server->packet_time1) < (interval * (n_retries - server->retry1 + 1)))) {
+			return (n_sent);
+		}
+
+		if (server->retry1 < 1) {
+			// no more retries
+			server->next_rule = NULL;
+			server->missing_rules = 1;
+			cleanup_qserver(server, NO_FORCE);
+			return (n_sent);
+		}
+		debug(3, "send_rule_request_packet1");
+		send_rule_request_packet(server);
+		t_lastsend = qtime_now();
+		n_sent++;
+	}
 
-			if (server->retry1 < 1) {
-				// No more retries
+	if (server->next_player_info < server->num_players) {
+		// Expecting player details
+		if ((server->retry2 != n_retries) && (time_delta(now, server->packet_time2) < (interval * (n_retries - server->retry2 + 1)))) {
+			return (n_sent);
+		}
+		if (!server->retry2) {
+			server->next_player_info++;
+			if (server->next_player_info >= server->num_players) {
+				// no more retries
 				cleanup_qserver(server, FORCE);
-				continue;
+				return (n_sent);
 			}
+			server->retry2 = n_retries;
+		}
+		send_player_request_packet(server);
+		t_lastsend = qtime_now();
+		n_sent++;
+	}
 
-			if ((qserver_get_timeout(server, &now) <= 0) && !(server->type->flags & TF_TCP_CONNECT)) {
-				// Query status
-				debug(2, "calling status_query_func for %p", server);
-				process_func_ret(server, server->type->status_query_func(server));
-				gettimeofday(&t_lastsend, NULL);
-				n_sent++;
-				continue;
+	if (n_sent == 0) {
+		// we didnt send any additional queries
+		debug(2, "no queries sent: %d %d", time_delta(now, server->packet_time1), (interval * (n_retries + 1)));
+		if (server->retry1 < 1) {
+			// no retries left
+			if (time_delta(now, server->packet_time1) > (interval * (n_retries + 1))) {
+				server->flags |= FLAG_CUT_SHORT;
+				cleanup_qserver(server, FORCE);
 			}
+		} else {
+			// decrement as we didnt send any packets
+			server->retry1--;
 		}
+	}
 
-		if (server->next_rule != NO_SERVER_RULES) {
-			// We want server rules
-			if ((server->retry1 != n_retries) && (time_delta(&now, &server->packet_time1) < (interval * (n_retries - server->retry1 + 1)))) {
-				continue;
-			}
+	return (n_sent);
+}
 
-			if (server->retry1 < 1) {
-				// no more retries
-				server->next_rule = NULL;
-				server->missing_rules = 1;
-				cleanup_qserver(server, NO_FORCE);
-				continue;
-			}
-			debug(3, "send_rule_request_packet1");
-			send_rule_request_packet(server);
-			gettimeofday(&t_lastsend, NULL);
-			n_sent++;
+
+/*
+ * Send retries and follow up queries for the servers whose deadline has
+ * passed, servers which are still in progress afterwards are scheduled
+ * again for when they next need timeout handling.
+ */
+void
+send_packets()
+{
+	struct qserver *server;
+	qtime_t now;
+	int diff;
+
+	debug(3, "processing...");
+
+	now = qtime_now();
+
+	if (!t_lastsend || ratelimit_enabled()) {
+		// nothing
+	} else if (connected && sendinterval && (time_delta(now, t_lastsend) < sendinterval)) {
+		return;
+	}
+
+	while (n_timers && timer_expired(timer_heap[0], now)) {
+		server = timer_heap[0];
+		if (server->flags & FLAG_CONNECT_WAIT) {
+			// disconnects it, which takes it off the heap
+			connect_timeout(server);
+			continue;
 		}
 
-		if (server->next_player_info < server->num_players) {
-			// Expecting player details
-			if ((server->retry2 != n_retries) && (time_delta(&now, &server->packet_time2) < (interval * (n_retries - server->retry2 + 1)))) {
-				continue;
-			}
-			if (!server->retry2) {
-				server->next_player_info++;
-				if (server->next_player_info >= server->num_players) {
-					// no more retries
-					cleanup_qserver(server, FORCE);
-					continue;
-				}
-				server->retry2 = n_retries;
-			}
-			send_player_request_packet(server);
-			gettimeofday(&t_lastsend, NULL);
-			n_sent++;
+		if (!ratelimit_ready(ratelimit_for(server))) {
+			// leave it due, get_next_timeout waits for the refill
+			break;
 		}
 
-		if (prev_n_sent == n_sent) {
-			// we didnt send any additional queries
-			debug(2, "no queries sent: %d %d", time_delta(&now, &server->packet_time1), (interval * (n_retries + 1)));
-			if (server->retry1 < 1) {
-				// no retries left
-				if (time_delta(&now, &server->packet_time1) > (interval * (n_retries + 1))) {
-					cleanup_qserver(server, FORCE);
-				}
-			} else {
-				// decrement as we didnt send any packets
-				server->retry1--;
-			}
+		timer_current = server;
+		send_server_packets(server, now);
+		if (timer_current != server) {
+			// disconnected, server may have been freed
+			continue;
 		}
+
+		// always move forward so we can't spin on a server
+		diff = qserver_get_timeout(server, now);
+		if (diff < 1) {
+			diff = 1;
+		}
+		timer_schedule(server, now + diff * QTIME_MS);
 	}
+	timer_current = NULL;
 
 	debug(3, "done");
 }
@@ -4954,9 +6356,9 @@ send_qwserver_request_packet(struct qserver *server)
 	if (server->flags & FLAG_BROADCAST) {
 		rc = send_broadcast(server, server->type->status_packet, server->type->status_len);
 	} else if (server->server_name == NULL) {
-		rc = send(server->fd, server->type->status_packet, server->type->status_len, 0);
+		rc = qserver_send_raw(server, server->type->status_packet, server->type->status_len);
 	} else if ((server->server_name != NULL) && server->type->rule_packet) {
-		rc = send(server->fd, server->type->rule_packet, server->type->rule_len, 0);
+		rc = qserver_send_raw(server, server->type->rule_packet, server->type->rule_len);
 	} else {
 		rc = SOCKET_ERROR;
 	}
@@ -4966,7 +6368,7 @@ send_qwserver_request_packet(struct qserver *server)
 	}
 
 	if ((server->retry1 == n_retries) || server->flags & FLAG_BROADCAST) {
-		gettimeofday(&server->packet_time1, NULL);
+		server->packet_time1 = qtime_now();
 		server->n_requests++;
 	} else if (server->server_name == NULL) {
 		server->n_retries++;
@@ -5119,16 +6521,7 @@ send_qwmaster_request_packet(struct qserver *server)
 	server->next_player_info = NO_PLAYER_INFO;
 
 	if (server->type->id == Q2_MASTER) {
-		struct sockaddr_in addr;
-		addr.sin_family = AF_INET;
-		if (no_port_offset || server->flags & TF_NO_PORT_OFFSET) {
-			addr.sin_port = htons(server->port);
-		} else {
-			addr.sin_port = htons((unsigned short)(server->port + server->type->port_offset));
-		}
-		addr.sin_addr.s_addr = server->ipaddr;
-		memset(&(addr.sin_zero), 0, sizeof(addr.sin_zero));
-		rc = sendto(server->fd, server->type->master_packet, server->type->master_len, 0, (struct sockaddr *)&addr, sizeof(addr));
+		rc = send_broadcast(server, server->type->master_packet, server->type->master_len);
 	} else {
 		char *packet;
 		int packet_len;
@@ -5185,7 +6578,7 @@ send_qwmaster_request_packet(struct qserver *server)
 			packet = query_buf;
 		}
 
-		rc = send(server->fd, packet, packet_len, 0);
+		rc = qserver_send_raw(server, packet, packet_len);
 	}
 
 	if (rc == SOCKET_ERROR) {
@@ -5193,7 +6586,7 @@ send_qwmaster_request_packet(struct qserver *server)
 	}
 
 	if (server->retry1 == n_retries) {
-		gettimeofday(&server->packet_time1, NULL);
+		server->packet_time1 = qtime_now();
 		server->n_requests++;
 	} else {
 		server->n_retries++;
@@ -5220,9 +6613,9 @@ send_tribes2_request_packet(struct qserver *server)
 	if (server->flags & FLAG_BROADCAST && (server->server_name == NULL)) {
 		rc = send_broadcast(server, server->type->status_packet, server->type->status_len);
 	} else if (server->server_name == NULL) {
-		rc = send(server->fd, server->type->status_packet, server->type->status_len, 0);
+		rc = qserver_send_raw(server, server->type->status_packet, server->type->status_len);
 	} else {
-		rc = send(server->fd, server->type->player_packet, server->type->player_len, 0);
+		rc = qserver_send_raw(server, server->type->player_packet, server->type->player_len);
 	}
 
 	if (rc == SOCKET_ERROR) {
@@ -5289,7 +6682,7 @@ send_tribes2master_request_packet(struct qserver *server)
 	};
 
 	if (strcmp(get_param_value(server, "query", ""), "types") == 0) {
-		rc = send(server->fd, tribes2_game_types_request, sizeof(tribes2_game_types_request), 0);
+		rc = qserver_send_raw(server, tribes2_game_types_request, sizeof(tribes2_game_types_request));
 		goto send_done;
 	}
 
@@ -5436,7 +6829,7 @@ send_tribes2master_request_packet(struct qserver *server)
 		*pkt++ = 0;
 	}
 
-	rc = send(server->fd, (char *)packet, pkt - packet, 0);
+	rc = qserver_send_raw(server, (char *)packet, pkt - packet);
 
 send_done:
 	if (rc == SOCKET_ERROR) {
@@ -5444,7 +6837,7 @@ send_done:
 	}
 
 	if (server->retry1 == n_retries) {
-		gettimeofday(&server->packet_time1, NULL);
+		server->packet_time1 = qtime_now();
 		server->n_requests++;
 	} else {
 		server->n_retries++;
@@ -5494,7 +6887,7 @@ send_gamespy_master_request(struct qserver *server)
 	//
 	// The details of this can be seen in gslist:
 	// http://aluigi.altervista.org/papers.htm#gslist
-	rc = send(server->fd, server->type->master_packet, server->type->master_len, 0);
+	rc = qserver_send_raw(server, server->type->master_packet, server->type->master_len);
 	if (rc != server->type->master_len) {
 		return (send_error(server, rc));
 	}
@@ -5515,13 +6908,13 @@ send_gamespy_master_request(struct qserver *server)
 	strcat(request, "\\final\\");
 	assert(strlen(request) < sizeof(request));
 
-	rc = send(server->fd, request, strlen(request), 0);
+	rc = qserver_send_raw(server, request, strlen(request));
 	if (rc != strlen(request)) {
 		return (send_error(server, rc));
 	}
 
 	if (server->retry1 == n_retries) {
-		gettimeofday(&server->packet_time1, NULL);
+		server->packet_time1 = qtime_now();
 		server->n_requests++;
 	}
 
@@ -5557,14 +6950,14 @@ send_rule_request_packet(struct qserver *server)
 		len = server->type->rule_len;
 	}
 
-	rc = send(server->fd, (const char *)server->type->rule_packet, len, 0);
+	rc = qserver_send_raw(server, (const char *)server->type->rule_packet, len);
 	if (rc == SOCKET_ERROR) {
 		return (send_error(server, rc));
 	}
 
 setup_retry:
 	if (server->retry1 == n_retries) {
-		gettimeofday(&server->packet_time1, NULL);
+		server->packet_time1 = qtime_now();
 		server->n_requests++;
 	} else if (server->server_name == NULL) {
 		server->n_retries++;
@@ -5618,7 +7011,7 @@ send_player_request_packet(struct qserver *server)
 
 setup_retry:
 	if (server->retry2 == n_retries) {
-		gettimeofday(&server->packet_time2, NULL);
+		server->packet_time2 = qtime_now();
 		server->n_requests++;
 	} else {
 		server->n_retries++;
@@ -5636,7 +7029,18 @@ qserver_disconnect(struct qserver *server)
 #ifdef _WIN32
 		int i;
 #endif
-	if (server->fd != -1) {
+	source_release(server);
+
+	if (server->fd == -1) {
+		return;
+	}
+
+	timer_remove(server);
+	qserver_forget_sends(server);
+
+	// a shared socket belongs to the pool so is left open
+	if (!(server->flags & FLAG_SHARED_SOCKET)) {
+		remove_file_descriptor(server);
 		close(server->fd);
 #ifndef _WIN32
 			connmap[server->fd] = NULL;
@@ -5648,12 +7052,37 @@ qserver_disconnect(struct qserver *server)
 				}
 			}
 #endif
-		server->fd = -1;
+	}
+	server->fd = -1;
+	server->flags &= ~FLAG_CONNECT_WAIT;
+
+	if (!(server->flags & FLAG_SOCKET_POOL)) {
 		connected--;
 	}
 }
 
 
+/*
+ * Swap a finished server's map and game for shared copies, most servers
+ * being on one of a few of each
+ */
+static void
+intern_map_and_game(struct qserver *server)
+{
+	char *copy;
+
+	if ((server->map_name != NULL) && !interned(server->map_name) && ((copy = intern(server->map_name)) != NULL)) {
+		free(server->map_name);
+		server->map_name = copy;
+	}
+	if ((server->game != NULL) && !(server->flags & FLAG_DO_NOT_FREE_GAME) && ((copy = intern(server->game)) != NULL)) {
+		free(server->game);
+		server->game = copy;
+		server->flags |= FLAG_DO_NOT_FREE_GAME;
+	}
+}
+
+
 /* Functions for figuring timeouts and when to give up
  * Returns 1 if the query is done (server may be freed) and 0 if not.
  */
@@ -5697,7 +7126,11 @@ cleanup_qserver(struct qserver *server, int force)
 		}
 
 		qserver_disconnect(server);
+		intern_map_and_game(server);
 
+		if (!server->type->master && (server->server_name != TIMEOUT) && (server->server_name != DOWN)) {
+			congestion_result(server->n_retries > 0, connected);
+		}
 		if (server->server_name != TIMEOUT) {
 			num_servers_returned++;
 			if (server->server_name != DOWN) {
@@ -5709,13 +7142,23 @@ cleanup_qserver(struct qserver *server, int force)
 			server->ping_total = 999999;
 		}
 		if (server->type->master) {
+			// a list is only worth reusing if the master got to its
+			// last page; multi response masters never say when that is
+			if ((server->server_name == MASTER) && (!(server->flags & FLAG_CUT_SHORT) || (server->type->flags & TF_MASTER_MULTI_RESPONSE))) {
+				mcache_store(server);
+			}
 			waiting_for_masters--;
 			if (waiting_for_masters == 0) {
 				add_servers_from_masters();
 			}
 		}
 		if (!server_sort) {
-			display_server(server);
+			if (server->flags & FLAG_NAME_WAIT) {
+				// shown once its name has been looked up
+				server->flags |= FLAG_DISPLAY_WAIT;
+			} else {
+				display_server(server);
+			}
 		}
 		return (1);
 	}
@@ -5727,7 +7170,7 @@ cleanup_qserver(struct qserver *server, int force)
  * @returns time in ms until server needs timeout handling. timeout handling is needed if <= zero
  */
 static int
-qserver_get_timeout(struct qserver *server, struct timeval *now)
+qserver_get_timeout(struct qserver *server, qtime_t now)
 {
 	int diff, diff1, diff2, interval;
 
@@ -5736,13 +7179,14 @@ qserver_get_timeout(struct qserver *server, struct timeval *now)
 	} else {
 		interval = retry_interval;
 	}
+	interval = rtt_timeout(server, interval);
 
 	diff2 = 0xffff;
 
-	diff1 = interval * (n_retries - server->retry1 + 1) - time_delta(now, &server->packet_time1);
+	diff1 = interval * (n_retries - server->retry1 + 1) - time_delta(now, server->packet_time1);
 
 	if (server->next_player_info < server->num_players) {
-		diff2 = interval * (n_retries - server->retry2 + 1) - time_delta(now, &server->packet_time2);
+		diff2 = interval * (n_retries - server->retry2 + 1) - time_delta(now, server->packet_time2);
 	}
 
 	debug(2, "timeout for %p is diff1 %d diff2 %d", server, diff1, diff2);
@@ -5753,182 +7197,600 @@ qserver_get_timeout(struct qserver *server, struct timeval *now)
 }
 
 
-void
-get_next_timeout(struct timeval *timeout)
-{
-	struct qserver *server = servers;
-	struct timeval now;
-	int diff, smallest = retry_interval + master_retry_interval;
-	int bind_count = 0;
+/*
+ * Returns how long in ms the main loop can wait before there's more to do
+ */
+int
+get_next_timeout()
+{
+	int diff, smallest = retry_interval + master_retry_interval;
+	int min_wait = ratelimit_enabled() ? 1 : 10;
+
+	/* if there are unconnected servers and slots left, or host names
+	 * being looked up, we retry in 10ms, or sooner if that's when the
+	 * send rate limit allows the next bind */
+	if ((n_timers == 0) || resolve_pending() || ((num_servers > connected) && (connected < congestion_limit()))) {
+		diff = ratelimit_enabled() ? ratelimit_next() : 0;
+		if ((diff <= 0) || (diff > 10)) {
+			diff = 10;
+		}
+		return (diff);
+	}
+
+	// The earliest deadline is always at the top of the heap, and the
+	// clock is read afresh as processing replies may have taken a while
+	diff = time_delta(timer_heap[0]->deadline, qtime_update());
+	if (diff <= 0) {
+		diff = ratelimit_wait(ratelimit_for(timer_heap[0]));
+	}
+	if (diff < smallest) {
+		smallest = diff;
+	}
+
+	diff = requery_wait();
+	if ((diff != -1) && (diff < smallest)) {
+		smallest = diff;
+	}
+
+	if (smallest < min_wait) {
+		smallest = min_wait;
+	}
+
+	return (smallest);
+}
+
+
+#ifdef USE_SELECT
+	static fd_set select_read_fds;
+	static fd_set select_write_fds;
+	static int select_maxfd;
+	static int select_cursor;
+
+	/*
+	 * Servers are selected for reading, apart from those still connecting
+	 * which are selected for writing
+	 */
+	int
+	set_fds(fd_set *read_fds, fd_set *write_fds)
+	{
+		int maxfd = -1, i;
+
+		for (i = 0; i < max_connmap; i++) {
+			if (connmap[i] != NULL) {
+				if (connmap[i]->flags & FLAG_CONNECT_WAIT) {
+					FD_SET(connmap[i]->fd, write_fds);
+				} else {
+					FD_SET(connmap[i]->fd, read_fds);
+				}
+				if (connmap[i]->fd > maxfd) {
+					maxfd = connmap[i]->fd;
+				}
+			}
+		}
+
+		return (maxfd);
+	}
+
+
+	void
+	set_file_descriptors()
+	{
+		FD_ZERO(&select_read_fds);
+		FD_ZERO(&select_write_fds);
+		select_maxfd = set_fds(&select_read_fds, &select_write_fds);
+	}
+
+
+	int
+	wait_for_file_descriptors(int ms)
+	{
+		struct timeval timeout;
+
+		timeout.tv_sec = ms / 1000;
+		timeout.tv_usec = (ms % 1000) * 1000;
+		select_cursor = 0;
+		// NOTE: We may need to check exceptfds here on windows for failed connects
+		return (select(select_maxfd + 1, &select_read_fds, &select_write_fds, NULL, &timeout));
+	}
+
+
+	struct qserver *
+	get_next_ready_server()
+	{
+		while (select_cursor < max_connmap && (connmap[select_cursor] == NULL ||
+		    (!FD_ISSET(connmap[select_cursor]->fd, &select_read_fds) && !FD_ISSET(connmap[select_cursor]->fd, &select_write_fds)))) {
+			select_cursor++;
+		}
+
+		if (select_cursor >= max_connmap) {
+			return (NULL);
+		}
+		return (connmap[select_cursor++]);
+	}
+
+
+	int
+	wait_for_timeout(unsigned int ms)
+	{
+		struct timeval timeout;
+
+		timeout.tv_sec = ms / 1000;
+		timeout.tv_usec = (ms % 1000) * 1000;
+		return (select(0, 0, NULL, NULL, &timeout));
+	}
+
+
+	void
+	add_file_descriptor(struct qserver *server)
+	{
+		// select set is rebuilt from connmap in set_file_descriptors
+	}
+
+
+	void
+	update_file_descriptor(struct qserver *server)
+	{
+	}
+
+
+	void
+	remove_file_descriptor(struct qserver *server)
+	{
+	}
+
+
+	void
+	reset_file_descriptors()
+	{
+	}
+
+
+#endif  /* USE_SELECT */
+
+#ifdef USE_POLL
+	static struct pollfd *pollfds;
+	static int n_pollfds;
+	static int max_pollfds = 0;
+	static int poll_cursor;
+
+	void
+	set_file_descriptors()
+	{
+		struct pollfd *p;
+		int i;
+
+		if (max_connmap > max_pollfds) {
+			max_pollfds = max_connmap;
+			pollfds = (struct pollfd *)realloc(pollfds, max_pollfds * sizeof(struct pollfd));
+		}
+
+		p = pollfds;
+		for (i = 0; i < max_connmap; i++) {
+			if (connmap[i] != NULL) {
+				p->fd = connmap[i]->fd;
+				p->events = (connmap[i]->flags & FLAG_CONNECT_WAIT) ? POLLOUT : POLLIN;
+				p->revents = 0;
+				p++;
+			}
+		}
+		n_pollfds = p - pollfds;
+	}
+
+
+	int
+	wait_for_file_descriptors(int ms)
+	{
+		poll_cursor = 0;
+		return (poll(pollfds, n_pollfds, ms));
+	}
+
+
+	struct qserver *
+	get_next_ready_server()
+	{
+		for ( ; poll_cursor < n_pollfds; poll_cursor++) {
+			if (pollfds[poll_cursor].revents) {
+				break;
+			}
+		}
+
+		if (poll_cursor >= n_pollfds) {
+			return (NULL);
+		}
+		return (connmap[pollfds[poll_cursor++].fd]);
+	}
+
+
+	int
+	wait_for_timeout(unsigned int ms)
+	{
+		return (poll(0, 0, ms));
+	}
+
+
+	void
+	add_file_descriptor(struct qserver *server)
+	{
+		// pollfds are rebuilt from connmap in set_file_descriptors
+	}
+
+
+	void
+	update_file_descriptor(struct qserver *server)
+	{
+	}
+
+
+	void
+	remove_file_descriptor(struct qserver *server)
+	{
+	}
+
+
+	void
+	reset_file_descriptors()
+	{
+	}
+
+
+#endif  /* USE_POLL */
+
+#ifdef USE_EPOLL
+	/*
+	 * Descriptors are registered once when the server is bound and removed
+	 * when it's disconnected, so a wakeup only costs the number of ready
+	 * servers instead of a walk over the whole of connmap.
+	 */
+	static int epoll_fd = -1;
+	static struct epoll_event *epoll_events;
+	static int n_epoll_events;
+	static int max_epoll_events = 0;
+	static int epoll_cursor;
+
+	static int
+	epoll_init()
+	{
+		if (epoll_fd != -1) {
+			return (0);
+		}
+
+		epoll_fd = epoll_create(max_connmap);
+		if (epoll_fd == -1) {
+			perror("epoll_create");
+			return (-1);
+		}
+
+		return (0);
+	}
+
+
+	void
+	set_file_descriptors()
+	{
+		epoll_init();
+
+		if (max_connmap > max_epoll_events) {
+			max_epoll_events = max_connmap;
+			epoll_events = (struct epoll_event *)realloc(epoll_events, max_epoll_events * sizeof(struct epoll_event));
+		}
+	}
+
+
+	int
+	wait_for_file_descriptors(int ms)
+	{
+		epoll_cursor = 0;
+		n_epoll_events = epoll_wait(epoll_fd, epoll_events, max_epoll_events, ms);
+
+		return (n_epoll_events);
+	}
+
+
+	struct qserver *
+	get_next_ready_server()
+	{
+		struct qserver *server;
+
+		while (epoll_cursor < n_epoll_events) {
+			// servers can be cleaned up while we work through the list
+			// so always go via connmap rather than caching the pointer
+			server = connmap[epoll_events[epoll_cursor++].data.fd];
+			if (server != NULL) {
+				return (server);
+			}
+		}
+
+		return (NULL);
+	}
+
+
+	int
+	wait_for_timeout(unsigned int ms)
+	{
+		// not epoll_wait, an unread datagram on any registered fd
+		// would end every wait at once
+		return (poll(0, 0, ms));
+	}
+
+
+	void
+	add_file_descriptor(struct qserver *server)
+	{
+		struct epoll_event event;
+
+		if (epoll_init() == -1) {
+			return;
+		}
 
-	if (first_server_bind == NULL) {
-		first_server_bind = servers;
+		memset(&event, 0, sizeof(event));
+		event.events = (server->flags & FLAG_CONNECT_WAIT) ? EPOLLOUT : EPOLLIN;
+		event.data.fd = server->fd;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server->fd, &event) == -1) {
+			perror("epoll_ctl");
+		}
 	}
 
-	server = first_server_bind;
 
-	for ( ; server != NULL && server->fd == -1; server = server->next) {
-	}
+	/*
+	 * Switch server to reading now its connect has finished
+	 */
+	void
+	update_file_descriptor(struct qserver *server)
+	{
+		struct epoll_event event;
 
-	/* if there are unconnected servers and slots left we retry in 10ms */
-	if ((server == NULL) || ((num_servers > connected) && (connected < max_simultaneous))) {
-		timeout->tv_sec = 0;
-		timeout->tv_usec = 10 * 1000;
-		return;
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.fd = server->fd;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, server->fd, &event) == -1) {
+			perror("epoll_ctl");
+		}
 	}
 
-	first_server_bind = server;
 
-	gettimeofday(&now, NULL);
-	for ( ; server != NULL && bind_count < connected; server = server->next) {
-		if (server->fd == -1) {
-			continue;
-		}
+	void
+	remove_file_descriptor(struct qserver *server)
+	{
+		struct epoll_event event;
 
-		diff = qserver_get_timeout(server, &now);
-		if (diff < smallest) {
-			smallest = diff;
+		// event is ignored but must be non-NULL on pre 2.6.9 kernels
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, server->fd, &event) == -1) {
+			perror("epoll_ctl");
 		}
-		bind_count++;
 	}
 
-	if (smallest < 10) {
-		smallest = 10;
+
+	/*
+	 * Drop the epoll instance so a forked process doesn't share it,
+	 * the next set_file_descriptors creates a new one.
+	 */
+	void
+	reset_file_descriptors()
+	{
+		if (epoll_fd != -1) {
+			close(epoll_fd);
+			epoll_fd = -1;
+		}
 	}
 
-	timeout->tv_sec = smallest / 1000;
-	timeout->tv_usec = (smallest % 1000) * 1000;
-}
 
+#endif  /* USE_EPOLL */
 
-#ifdef USE_SELECT
-	static fd_set select_read_fds;
-	static int select_maxfd;
-	static int select_cursor;
+#ifdef USE_IO_URING
+	/*
+	 * Sockets keep a receive posted on the ring and sends are queued on
+	 * it, so wait_for_file_descriptors both submits the queued requests
+	 * and collects the replies in one io_uring_enter. Each ready server
+	 * is handed out with the packet it received, see uring.c.
+	 */
+	static struct uring_event uring_event;
+	static int uring_event_pending;
 
-	int
-	set_fds(fd_set *fds)
+	static void
+	uring_backend_init()
 	{
-		int maxfd = -1, i;
+		if (uring_init() == -1) {
+			fprintf(stderr, "io_uring is unavailable, qstat needs building without --enable-io-uring\n");
+			exit(1);
+		}
+	}
 
-		for (i = 0; i < max_connmap; i++) {
-			if (connmap[i] != NULL) {
-				FD_SET(connmap[i]->fd, fds);
-				if (connmap[i]->fd > maxfd) {
-					maxfd = connmap[i]->fd;
-				}
+
+	static void
+	release_ready_event()
+	{
+		if (uring_event_pending) {
+			if (uring_event.bid != -1) {
+				uring_release_buffer(uring_event.bid);
 			}
+			uring_event_pending = 0;
 		}
-
-		return (maxfd);
 	}
 
 
 	void
 	set_file_descriptors()
 	{
-		FD_ZERO(&select_read_fds);
-		select_maxfd = set_fds(&select_read_fds);
+		uring_backend_init();
 	}
 
 
 	int
-	wait_for_file_descriptors(struct timeval *timeout)
+	wait_for_file_descriptors(int ms)
 	{
-		select_cursor = 0;
-		return (select(select_maxfd + 1, &select_read_fds, NULL, NULL, timeout));
+		release_ready_event();
+		return (uring_wait(ms));
 	}
 
 
 	struct qserver *
 	get_next_ready_server()
 	{
-		while (select_cursor < max_connmap && (connmap[select_cursor] == NULL || !FD_ISSET(connmap[select_cursor]->fd, &select_read_fds))) {
-			select_cursor++;
-		}
+		struct qserver *server;
 
-		if (select_cursor >= max_connmap) {
-			return (NULL);
+		release_ready_event();
+		while (uring_next_event(&uring_event)) {
+			// servers can be cleaned up while we work through the
+			// completions so always go via connmap
+			server = (uring_event.fd < max_connmap) ? connmap[uring_event.fd] : NULL;
+			if (server != NULL) {
+				uring_event_pending = 1;
+				return (server);
+			}
+			if (uring_event.bid != -1) {
+				uring_release_buffer(uring_event.bid);
+			}
 		}
-		return (connmap[select_cursor++]);
+
+		return (NULL);
 	}
 
 
-	int
-	wait_for_timeout(unsigned int ms)
+	/*
+	 * Hand pkt the ring buffer holding the packet which made server
+	 * ready, release_packet returns it to the kernel. Later calls fail
+	 * with EAGAIN until the next server is taken.
+	 */
+	static int
+	recv_packet(struct qserver *server, struct rcv_pkt *pkt)
 	{
-		struct timeval timeout;
+		int len;
+
+		pkt->recv_time = qtime_now();
+		if (!uring_event_pending) {
+			errno = EAGAIN;
+			return (SOCKET_ERROR);
+		}
+
+		len = uring_event.res;
+		if (uring_event.readable) {
+			// too big for the ring's buffers, so read it here
+			struct msghdr msg;
+			struct iovec iov;
+			union {
+				struct cmsghdr align;
+				char buf[TIMESTAMP_CONTROL_LEN];
+			} control;
+			char *large = (char *)malloc(PACKET_LEN + 1);
+
+			release_ready_event();
+			if (large == NULL) {
+				errno = ENOMEM;
+				return (SOCKET_ERROR);
+			}
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_name = &pkt->addr;
+			msg.msg_namelen = sizeof(pkt->addr);
+			msg.msg_iov = &iov;
+			msg.msg_iovlen = 1;
+			iov.iov_base = large;
+			iov.iov_len = PACKET_LEN;
+			if (kernel_timestamps) {
+				msg.msg_control = control.buf;
+				msg.msg_controllen = sizeof(control.buf);
+			}
+			len = recvmsg(server->fd, &msg, MSG_DONTWAIT);
+			if (len > 0) {
+				pkt->data = large;
+				timestamp_get(&msg, &pkt->recv_time);
+			} else {
+				free(large);
+			}
+			return (len);
+		} else if (len < 0) {
+			errno = -len;
+			len = SOCKET_ERROR;
+		} else if (uring_event.bid != -1) {
+			pkt->data = uring_event.data;
+			pkt->bid = uring_event.bid;
+			pkt->addr = uring_event.addr;
+			if (uring_event.stamped) {
+				pkt->recv_time = uring_event.stamp;
+			}
+			uring_event.bid = -1;
+		}
+		release_ready_event();
 
-		timeout.tv_sec = ms / 1000;
-		timeout.tv_usec = (ms % 1000) * 1000;
-		return (select(0, 0, NULL, NULL, &timeout));
+		return (len);
 	}
 
 
-#endif  /* USE_SELECT */
+	int
+	wait_for_timeout(unsigned int ms)
+	{
+		uring_backend_init();
+		uring_submit();
+		return (poll(0, 0, ms));
+	}
 
-#ifdef USE_POLL
-	static struct pollfd *pollfds;
-	static int n_pollfds;
-	static int max_pollfds = 0;
-	static int poll_cursor;
 
 	void
-	set_file_descriptors()
+	add_file_descriptor(struct qserver *server)
 	{
-		struct pollfd *p;
-		int i;
-
-		if (max_connmap > max_pollfds) {
-			max_pollfds = max_connmap;
-			pollfds = (struct pollfd *)realloc(pollfds, max_pollfds * sizeof(struct pollfd));
-		}
-
-		p = pollfds;
-		for (i = 0; i < max_connmap; i++) {
-			if (connmap[i] != NULL) {
-				p->fd = connmap[i]->fd;
-				p->events = POLLIN;
-				p->revents = 0;
-				p++;
-			}
+		uring_backend_init();
+		if (server->flags & FLAG_CONNECT_WAIT) {
+			uring_add_connect(server->fd);
+		} else {
+			uring_add(server->fd);
 		}
-		n_pollfds = p - pollfds;
 	}
 
 
-	int
-	wait_for_file_descriptors(struct timeval *timeout)
+	/*
+	 * Start receiving now server's connect has finished
+	 */
+	void
+	update_file_descriptor(struct qserver *server)
 	{
-		poll_cursor = 0;
-		return (poll(pollfds, n_pollfds, timeout->tv_sec * 1000 + timeout->tv_usec / 1000));
+		uring_add(server->fd);
 	}
 
 
-	struct qserver *
-	get_next_ready_server()
+	void
+	remove_file_descriptor(struct qserver *server)
 	{
-		for ( ; poll_cursor < n_pollfds; poll_cursor++) {
-			if (pollfds[poll_cursor].revents) {
-				break;
-			}
-		}
+		uring_remove(server->fd);
 
-		if (poll_cursor >= n_pollfds) {
-			return (NULL);
+		// The ring holds the socket open until its receive is cancelled,
+		// so get that to the kernel now if the port may be bound again
+		if (source_fixed_ports()) {
+			uring_submit();
 		}
-		return (connmap[pollfds[poll_cursor++].fd]);
 	}
 
 
-	int
-	wait_for_timeout(unsigned int ms)
+	/*
+	 * Drop the ring so a forked process doesn't share it, the next
+	 * registration creates a new one.
+	 */
+	void
+	reset_file_descriptors()
 	{
-		return (poll(0, 0, ms));
+		release_ready_event();
+		uring_close();
 	}
 
 
-#endif  /* USE_POLL */
+#endif  /* USE_IO_URING */
+
+static void
+free_server_name(struct qserver *server)
+{
+	if (
+		(server->server_name != NULL) &&
+		(server->server_name != DOWN) &&
+		(server->server_name != HOSTNOTFOUND) &&
+		(server->server_name != SYSERROR) &&
+		(server->server_name != MASTER) &&
+		(server->server_name != SERVERERROR) &&
+		(server->server_name != TIMEOUT) &&
+		(server->server_name != GAMESPY_MASTER_NAME) &&
+		(server->server_name != BFRIS_SERVER_NAME)
+		) {
+		free(server->server_name);
+	}
+}
+
 
 void
 free_server(struct qserver *server)
@@ -5951,9 +7813,6 @@ free_server(struct qserver *server)
 			last_server = &servers;
 		}
 	}
-	if (server == first_server_bind) {
-		first_server_bind = server->next;
-	}
 	if (server == last_server_bind) {
 		last_server_bind = server->next;
 	}
@@ -5971,12 +7830,12 @@ free_server(struct qserver *server)
 	/* free all the data */
 	for (player = server->players; player; player = next_player) {
 		next_player = player->next;
-		free_player(player);
+		free_player(player, &server->arena);
 	}
 
 	for (rule = server->rules; rule; rule = next_rule) {
 		next_rule = rule->next;
-		free_rule(rule);
+		free_rule(rule, &server->arena);
 	}
 
 	if (server->arg) {
@@ -5991,7 +7850,7 @@ free_server(struct qserver *server)
 	if (server->address) {
 		free(server->address);
 	}
-	if (server->map_name) {
+	if (server->map_name && !interned(server->map_name)) {
 		free(server->map_name);
 	}
 	if (!(server->flags & FLAG_DO_NOT_FREE_GAME) && server->game) {
@@ -6000,6 +7859,9 @@ free_server(struct qserver *server)
 	if (server->master_pkt) {
 		free(server->master_pkt);
 	}
+	if (server->worker_output) {
+		free(server->worker_output);
+	}
 	if (server->query_arg) {
 		free(server->query_arg);
 	}
@@ -6010,19 +7872,10 @@ free_server(struct qserver *server)
 	/* These fields are never malloc'd: outfilename
 	 */
 
-	if (
-		(server->server_name != NULL) &&
-		(server->server_name != DOWN) &&
-		(server->server_name != HOSTNOTFOUND) &&
-		(server->server_name != SYSERROR) &&
-		(server->server_name != MASTER) &&
-		(server->server_name != SERVERERROR) &&
-		(server->server_name != TIMEOUT) &&
-		(server->server_name != GAMESPY_MASTER_NAME) &&
-		(server->server_name != BFRIS_SERVER_NAME)
-		) {
-		free(server->server_name);
-	}
+	free_server_name(server);
+
+	// after the lists, which are mostly in it
+	arena_clear(&server->arena);
 
 	/*
 	 * params ...
@@ -6034,45 +7887,175 @@ free_server(struct qserver *server)
 }
 
 
+/*
+ * Show a server from the previous -delta run which wasn't queried in
+ * this one
+ */
 void
-free_player(struct player *player)
+qserver_gone(server_type *type, const char *arg)
+{
+	struct qserver *server;
+
+	server = (struct qserver *)calloc(1, sizeof(struct qserver));
+	server->arg = strdup(arg);
+	server->host_name = strdup(arg);
+	init_qserver(server, type);
+	num_servers_total--;
+	num_servers++;
+
+	server->server_name = SERVERERROR;
+	server->error = strdup("no longer listed");
+	output_server(server);
+	free_server(server);
+}
+
+
+/*
+ * Ready a server which has been shown for another query, keeping what
+ * came from its argument and its round trip estimate
+ */
+static void
+reset_qserver(struct qserver *server)
 {
-	if (player->name) {
-		free(player->name);
+	struct player *player, *next_player;
+	struct rule *rule, *next_rule;
+
+	for (player = server->players; player; player = next_player) {
+		next_player = player->next;
+		free_player(player, &server->arena);
+	}
+
+	for (rule = server->rules; rule; rule = next_rule) {
+		next_rule = rule->next;
+		free_rule(rule, &server->arena);
+	}
+
+	if (server->error) {
+		free(server->error);
+	}
+	if (server->address) {
+		free(server->address);
+		server->address = NULL;
+	}
+	if (server->map_name && !interned(server->map_name)) {
+		free(server->map_name);
+	}
+	if (!(server->flags & FLAG_DO_NOT_FREE_GAME) && server->game) {
+		free(server->game);
+	}
+	if (server->master_pkt) {
+		free(server->master_pkt);
 	}
-	if (!(player->flags & PLAYER_FLAG_DO_NOT_FREE_TEAM) && player->team_name) {
-		free(player->team_name);
+	if (server->challenge_string) {
+		free(server->challenge_string);
+		server->challenge_string = NULL;
 	}
-	if (player->address) {
-		free(player->address);
+	free_server_name(server);
+	arena_reset(&server->arena);
+
+	server->flags &= ~(FLAG_DO_NOT_FREE_GAME | FLAG_PLAYER_TEAMS | FLAG_SHARED_SOCKET | FLAG_MASTER_CACHED | FLAG_CHECK_DUPLICATE_RULES | FLAG_CUT_SHORT | TF_STATUS_QUERY | TF_PLAYER_QUERY | TF_RULES_QUERY);
+	server->port = server->orig_port;
+	server->challenge = 0;
+	server->combined = 0;
+	server->max_players = 0;
+	server->max_spectators = 0;
+	server->protocol_version = 0;
+	memset(server->master_query_tag, 0, sizeof(server->master_query_tag));
+
+	init_query_state(server);
+}
+
+
+void
+requeue_qserver(struct qserver *server)
+{
+	reset_qserver(server);
+	num_servers++;
+
+	if ((void *)&server->next == (void *)last_server) {
+		// already where bind_sockets will come to it
+		return;
 	}
-	if (player->tribe_tag) {
-		free(player->tribe_tag);
+
+	// moved to the end of the list, past the last server bound
+	if (server == last_server_bind) {
+		last_server_bind = server->next;
 	}
-	if (player->skin) {
-		free(player->skin);
+	if (server == servers) {
+		servers = server->next;
+	} else {
+		server->prev->next = server->next;
 	}
-	if (player->mesh) {
-		free(player->mesh);
+	server->next->prev = server->prev;
+
+	server->prev = (struct qserver *)((char *)last_server - ((char *)&server->next - (char *)server));
+	server->next = NULL;
+	*last_server = server;
+	last_server = &server->next;
+}
+
+
+/*
+ * Free string unless it's shared or from arena
+ */
+static void
+free_string(struct arena *arena, char *string)
+{
+	if ((string != NULL) && !interned(string)) {
+		arena_free(arena, string);
 	}
-	if (player->face) {
-		free(player->face);
+}
+
+
+/*
+ * Copy a rule or info value, sharing it if it's short enough to be one
+ * of a few common ones
+ */
+static char *
+value_strdup(struct arena *arena, const char *value)
+{
+	if (strlen(value) <= INTERN_VALUE_MAX) {
+		return (intern_strdup(arena, value));
 	}
-	free(player);
+
+	return (arena_strdup(arena, value));
 }
 
 
+/*
+ * Free what of player didn't come from its server's arena
+ */
 void
-free_rule(struct rule *rule)
+free_player(struct player *player, struct arena *arena)
 {
-	if (rule->name) {
-		free(rule->name);
+	struct info *info, *next_info;
+
+	for (info = player->info; info; info = next_info) {
+		next_info = info->next;
+		free_string(arena, info->name);
+		free_string(arena, info->value);
+		arena_free(arena, info);
 	}
 
-	if (rule->value) {
-		free(rule->value);
+	arena_free(arena, player->name);
+	if (!(player->flags & PLAYER_FLAG_DO_NOT_FREE_TEAM)) {
+		free_string(arena, player->team_name);
 	}
-	free(rule);
+	arena_free(arena, player->address);
+	arena_free(arena, player->tribe_tag);
+	arena_free(arena, player->skin);
+	arena_free(arena, player->mesh);
+	arena_free(arena, player->face);
+	arena_free(arena, player);
+}
+
+
+void
+free_rule(struct rule *rule, struct arena *arena)
+{
+	free_string(arena, rule->name);
+	free_string(arena, rule->value);
+	arena_free(arena, rule);
 }
 
 
@@ -6102,17 +8085,17 @@ deal_with_q_packet(struct qserver *server, char *rawpkt, int pktlen)
 		return (0);
 
 	case Q_CCREP_SERVER_INFO:
-		server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+		server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 		rc = server_info_packet(server, pkt, pktlen - Q_HEADER_LEN);
 		break;
 
 	case Q_CCREP_PLAYER_INFO:
-		server->ping_total += time_delta(&packet_recv_time, &server->packet_time2);
+		server->ping_total += time_delta(packet_recv_time, server->packet_time2);
 		rc = player_info_packet(server, pkt, pktlen - Q_HEADER_LEN);
 		break;
 
 	case Q_CCREP_RULE_INFO:
-		server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+		server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 		rc = rule_info_packet(server, pkt, pktlen - Q_HEADER_LEN);
 		break;
 
@@ -6139,7 +8122,7 @@ deal_with_qw_packet(struct qserver *server, char *rawpkt, int pktlen)
 {
 	debug(2, "deal_with_qw_packet %p, %d", server, pktlen);
 	if (server->server_name == NULL) {
-		server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+		server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 	}
 
 	if ((((rawpkt[0] != '\377') && (rawpkt[0] != '\376')) || (rawpkt[1] != '\377') || (rawpkt[2] != '\377') || (rawpkt[3] != '\377')) && show_errors) {
@@ -6218,7 +8201,7 @@ deal_with_qw_packet(struct qserver *server, char *rawpkt, int pktlen)
 			rawpkt++;
 			pktlen--;
 		}
-		server->flags |= CHECK_DUPLICATE_RULES;
+		server->flags |= FLAG_CHECK_DUPLICATE_RULES;
 		return (deal_with_q2_packet(server, rawpkt + 19, pktlen - 19));
 	} else if (strncmp(&rawpkt[4], "infostringresponse", 19) == 0) {
 		return (deal_with_q2_packet(server, rawpkt + 23, pktlen - 23));
@@ -6320,7 +8303,7 @@ deal_with_q1qw_packet(struct qserver *server, char *rawpkt, int pktlen)
 				break;
 			}
 			if (get_player_info) {
-				player = (struct player *)calloc(1, sizeof(struct player));
+				player = (struct player *)arena_calloc(&server->arena, sizeof(struct player));
 				player->number = number;
 				player->frags = frags;
 				player->connect_time = connect_time * 60;
@@ -6491,7 +8474,7 @@ deal_with_q2_packet(struct qserver *server, char *rawpkt, int pktlen)
 				add_rule(server, key, value, NO_VALUE_COPY);
 			} else if (get_server_rules || (strncmp(key, "game", 4) == 0)) {
 				int dofree = 0;
-				int flags = (server->flags & CHECK_DUPLICATE_RULES) ? CHECK_DUPLICATE_RULES | NO_VALUE_COPY : NO_VALUE_COPY;
+				int flags = (server->flags & FLAG_CHECK_DUPLICATE_RULES) ? CHECK_DUPLICATE_RULES | NO_VALUE_COPY : NO_VALUE_COPY;
 				if (add_rule(server, key, value, flags) == NULL) {
 					// duplicate, so free value
 					dofree = 1;
@@ -6564,7 +8547,7 @@ player_info:            debug(3, "player info");
 			}
 
 			if (get_player_info) {
-				player = (struct player *)calloc(1, sizeof(struct player));
+				player = (struct player *)arena_calloc(&server->arena, sizeof(struct player));
 				player->number = 0;
 				player->connect_time = -1;
 				player->frags = frags;
@@ -6655,7 +8638,7 @@ ack_descent3master_packet(struct qserver *server, char *curtok)
 	packet[1] = 0x1d;
 	packet[0x16] = 1;
 	memcpy(packet + 0x1a, curtok, 4);
-	rc = send(server->fd, packet, sizeof(packet), 0);
+	rc = qserver_send_raw(server, packet, sizeof(packet));
 	if (rc == SOCKET_ERROR) {
 		return (send_error(server, rc));
 	}
@@ -6717,7 +8700,7 @@ deal_with_qwmaster_packet(struct qserver *server, char *rawpkt, int pktlen)
 
 	debug(2, "deal_with_qwmaster_packet %p, %d", server, pktlen);
 
-	server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+	server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 
 	if (rawpkt[0] == QW_NACK) {
 		server->error = strdup(&rawpkt[2]);
@@ -7210,10 +9193,10 @@ player_info_packet(struct qserver *server, struct q_packet *pkt, int datalen)
 		return (0);
 	}
 
-	player = (struct player *)calloc(1, sizeof(struct player));
+	player = (struct player *)arena_calloc(&server->arena, sizeof(struct player));
 	player->number = player_number;
-	player->name = strdup(name);
-	player->address = strdup(address);
+	player->name = arena_strdup(&server->arena, name);
+	player->address = arena_strdup(&server->arena, address);
 	player->connect_time = connect_time;
 	player->frags = frags;
 	player->shirt_color = colors >> 4;
@@ -7276,9 +9259,9 @@ rule_info_packet(struct qserver *server, struct q_packet *pkt, int datalen)
 		return (0);
 	}
 
-	rule = (struct rule *)malloc(sizeof(struct rule));
-	rule->name = strdup(name);
-	rule->value = strdup(value);
+	rule = (struct rule *)arena_alloc(&server->arena, sizeof(struct rule));
+	rule->name = intern_strdup(&server->arena, name);
+	rule->value = value_strdup(&server->arena, value);
 	rule->next = NULL;
 
 	if (last == NULL) {
@@ -7297,6 +9280,24 @@ rule_info_packet(struct qserver *server, struct q_packet *pkt, int datalen)
 }
 
 
+static char *
+player_strdup(struct player *player, const char *string)
+{
+	return (player->arena ? arena_strdup(player->arena, string) : strdup(string));
+}
+
+
+static void
+player_free(struct player *player, void *ptr)
+{
+	if (player->arena) {
+		free_string(player->arena, (char *)ptr);
+	} else {
+		free(ptr);
+	}
+}
+
+
 struct info *
 player_add_info(struct player *player, char *key, char *value, int flags)
 {
@@ -7306,11 +9307,11 @@ player_add_info(struct player *player, char *key, char *value, int flags)
 		for (info = player->info; info; info = info->next) {
 			if (0 == strcmp(info->name, key)) {
 				// We should be able to free this
-				free(info->value);
+				player_free(player, info->value);
 				if (flags & NO_VALUE_COPY) {
 					info->value = value;
 				} else {
-					info->value = strdup(value);
+					info->value = player_strdup(player, value);
 				}
 
 				return (info);
@@ -7329,7 +9330,8 @@ player_add_info(struct player *player, char *key, char *value, int flags)
 	if (flags & COMBINE_VALUES) {
 		for (info = player->info; info; info = info->next) {
 			if (0 == strcmp(info->name, key)) {
-				char *full_value = (char *)calloc(sizeof(char), strlen(info->value) + strlen(value) + 2);
+				size_t len = strlen(info->value) + strlen(value) + strlen(multi_delimiter) + 1;
+				char *full_value = player->arena ? (char *)arena_alloc(player->arena, len) : (char *)malloc(len);
 				if (NULL == full_value) {
 					fprintf(stderr, "Failed to malloc combined value\n");
 					exit(1);
@@ -7337,7 +9339,7 @@ player_add_info(struct player *player, char *key, char *value, int flags)
 				sprintf(full_value, "%s%s%s", info->value, multi_delimiter, value);
 
 				// We should be able to free this
-				free(info->value);
+				player_free(player, info->value);
 				info->value = full_value;
 
 				return (info);
@@ -7345,16 +9347,22 @@ player_add_info(struct player *player, char *key, char *value, int flags)
 		}
 	}
 
-	info = (struct info *)malloc(sizeof(struct info));
+	if (player->arena) {
+		info = (struct info *)arena_alloc(player->arena, sizeof(struct info));
+	} else {
+		info = (struct info *)malloc(sizeof(struct info));
+	}
 	if (flags & NO_KEY_COPY) {
 		info->name = key;
+	} else if (player->arena) {
+		info->name = intern_strdup(player->arena, key);
 	} else {
 		info->name = strdup(key);
 	}
 	if (flags & NO_VALUE_COPY) {
 		info->value = value;
 	} else {
-		info->value = strdup(value);
+		info->value = player_strdup(player, value);
 	}
 	info->next = NULL;
 
@@ -7380,11 +9388,11 @@ add_rule(struct qserver *server, char *key, char *value, int flags)
 		for (rule = server->rules; rule; rule = rule->next) {
 			if (0 == strcmp(rule->name, key)) {
 				// We should be able to free this
-				free(rule->value);
+				free_string(&server->arena, rule->value);
 				if (flags & NO_VALUE_COPY) {
 					rule->value = value;
 				} else {
-					rule->value = strdup(value);
+					rule->value = value_strdup(&server->arena, value);
 				}
 
 				return (rule);
@@ -7403,15 +9411,11 @@ add_rule(struct qserver *server, char *key, char *value, int flags)
 	if (flags & COMBINE_VALUES) {
 		for (rule = server->rules; rule; rule = rule->next) {
 			if (0 == strcmp(rule->name, key)) {
-				char *full_value = (char *)calloc(sizeof(char), strlen(rule->value) + strlen(value) + strlen(multi_delimiter) + 1);
-				if (NULL == full_value) {
-					fprintf(stderr, "Failed to malloc combined value\n");
-					exit(1);
-				}
+				char *full_value = (char *)arena_alloc(&server->arena, strlen(rule->value) + strlen(value) + strlen(multi_delimiter) + 1);
 				sprintf(full_value, "%s%s%s", rule->value, multi_delimiter, value);
 
 				// We should be able to free this
-				free(rule->value);
+				free_string(&server->arena, rule->value);
 				rule->value = full_value;
 
 				return (rule);
@@ -7419,17 +9423,17 @@ add_rule(struct qserver *server, char *key, char *value, int flags)
 		}
 	}
 
-	rule = (struct rule *)malloc(sizeof(struct rule));
+	rule = (struct rule *)arena_alloc(&server->arena, sizeof(struct rule));
 	if (flags & NO_KEY_COPY) {
 		rule->name = key;
 	} else {
-		rule->name = strdup(key);
+		rule->name = intern_strdup(&server->arena, key);
 	}
 
 	if (flags & NO_VALUE_COPY) {
 		rule->value = value;
 	} else {
-		rule->value = strdup(value);
+		rule->value = value_strdup(&server->arena, value);
 	}
 	rule->next = NULL;
 	*server->last_rule = rule;
@@ -7451,9 +9455,9 @@ add_nrule(struct qserver *server, char *key, char *value, int len)
 		}
 	}
 
-	rule = (struct rule *)malloc(sizeof(struct rule));
-	rule->name = strdup(key);
-	rule->value = strndup(value, len);
+	rule = (struct rule *)arena_alloc(&server->arena, sizeof(struct rule));
+	rule->name = intern_strdup(&server->arena, key);
+	rule->value = (len <= INTERN_VALUE_MAX) ? intern_strndup(&server->arena, value, len) : arena_strndup(&server->arena, value, len);
 	rule->next = NULL;
 	*server->last_rule = rule;
 	server->last_rule = &rule->next;
@@ -7472,7 +9476,8 @@ add_player(struct qserver *server, int player_number)
 		}
 	}
 
-	player = (struct player *)calloc(1, sizeof(struct player));
+	player = (struct player *)arena_calloc(&server->arena, sizeof(struct player));
+	player->arena = &server->arena;
 	player->number = player_number;
 	player->next = server->players;
 	player->n_info = 0;
@@ -7561,7 +9566,7 @@ players_set_teamname(struct qserver *server, int teamid, char *teamname)
 
 	for (player = server->players; player; player = player->next) {
 		if (player->team == teamid) {
-			player->team_name = strdup(teamname);
+			player->team_name = intern_strdup(&server->arena, teamname);
 		}
 	}
 }
@@ -8009,9 +10014,10 @@ get_rule(struct qserver *server, char *name)
 {
 	struct rule *rule;
 
+	// most names are shared, so the same pointer, but not all
 	rule = server->rules;
 	for ( ; rule != NULL; rule = rule->next) {
-		if (strcmp(name, rule->name) == 0) {
+		if ((name == rule->name) || (strcmp(name, rule->name) == 0)) {
 			return (rule->value);
 		}
 	}
@@ -8054,7 +10060,7 @@ deal_with_ut2003_packet(struct qserver *server, char *rawpkt, int pktlen)
 	case 0x00:
 		// Server info
 		if (server->server_name == NULL) {
-			server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+			server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 		}
 
 		error = ut2003_basic_packet(server, rawpkt, end);
@@ -8092,7 +10098,7 @@ deal_with_ut2003_packet(struct qserver *server, char *rawpkt, int pktlen)
 	case 0x10:
 		// Pariah Server info
 		if (server->server_name == NULL) {
-			server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+			server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 		}
 
 		error = pariah_basic_packet(server, rawpkt, end);
@@ -8174,7 +10180,7 @@ deal_with_halflife_packet(struct qserver *server, char *rawpkt, int pktlen)
 	debug(2, "deal_with_halflife_packet %p, %d", server, pktlen);
 
 	if (server->server_name == NULL) {
-		server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+		server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 	}
 
 	if (pktlen < 5) {
@@ -8345,8 +10351,8 @@ deal_with_halflife_packet(struct qserver *server, char *rawpkt, int pktlen)
 			}
 			n++;
 			pkt++;
-			player = (struct player *)calloc(1, sizeof(struct player));
-			player->name = strdup(pkt);
+			player = (struct player *)arena_calloc(&server->arena, sizeof(struct player));
+			player->name = arena_strdup(&server->arena, pkt);
 			pkt += strlen(pkt) + 1;
 			memcpy(&player->frags, pkt, 4);
 			pkt += 4;
@@ -8412,9 +10418,9 @@ deal_with_tribes_packet(struct qserver *server, char *rawpkt, int pktlen)
 	debug(2, "deal_with_tribes_packet %p, %d", server, pktlen);
 
 	if (server->server_name == NULL) {
-		server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+		server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 	} else {
-		gettimeofday(&server->packet_time1, NULL);
+		server->packet_time1 = qtime_now();
 	}
 
 	if (pktlen < sizeof(tribes_info_reponse)) {
@@ -8482,11 +10488,11 @@ deal_with_tribes_packet(struct qserver *server, char *rawpkt, int pktlen)
 	if (n_teams > 1) {
 		teams = (struct player **)calloc(1, sizeof(struct player *) * n_teams);
 		for (t = 0; t < n_teams; t++) {
-			teams[t] = (struct player *)calloc(1, sizeof(struct player));
+			teams[t] = (struct player *)arena_calloc(&server->arena, sizeof(struct player));
 			teams[t]->number = TRIBES_TEAM;
 			teams[t]->team = t;
 			len = *pkt;     /* team name */
-			teams[t]->name = strndup((char *)pkt + 1, len);
+			teams[t]->name = arena_strndup(&server->arena, (char *)pkt + 1, len);
 			debug(2, "team#0 <%.*s>\n", len, pkt + 1);
 			pkt += len + 1;
 
@@ -8522,7 +10528,7 @@ deal_with_tribes_packet(struct qserver *server, char *rawpkt, int pktlen)
 		if ((char *)pkt + len > (rawpkt + pktlen)) {
 			break;
 		}
-		player = (struct player *)calloc(1, sizeof(struct player));
+		player = (struct player *)arena_calloc(&server->arena, sizeof(struct player));
 		player->team = pkt[-1];
 		if (n_teams && (player->team < n_teams)) {
 			player->team_name = teams[player->team]->name;
@@ -8532,7 +10538,7 @@ deal_with_tribes_packet(struct qserver *server, char *rawpkt, int pktlen)
 		player->flags |= PLAYER_FLAG_DO_NOT_FREE_TEAM;
 		player->ping = ping;
 		player->packet_loss = packet_loss;
-		player->name = strndup((char *)pkt + 1, len);
+		player->name = arena_strndup(&server->arena, (char *)pkt + 1, len);
 		debug(2, "player#%d, name %.*s\n", pnum, len, pkt + 1);
 		pkt += len + 1;
 		len = *pkt;
@@ -8620,12 +10626,12 @@ deal_with_tribes2_packet(struct qserver *server, char *pkt, int pktlen)
 	pkt[pktlen] = '\0';
 
 	if (server->server_name == NULL) {
-		server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+		server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 	}
 
 	/*
 	 * else
-	 * gettimeofday( &server->packet_time1, NULL);
+	 * server->packet_time1 = qtime_now();
 	 */
 
 	if (pkt[0] == TRIBES2_RESPONSE_PING) {
@@ -8762,7 +10768,7 @@ deal_with_tribes2_packet(struct qserver *server, char *pkt, int pktlen)
 
 	teams = (struct player **)calloc(1, sizeof(struct player *) * n_teams);
 	for (t = 0; t < n_teams; t++) {
-		teams[t] = (struct player *)calloc(1, sizeof(struct player));
+		teams[t] = (struct player *)arena_calloc(&server->arena, sizeof(struct player));
 		teams[t]->number = TRIBES_TEAM;
 		teams[t]->team = t;
 		/* team name */
@@ -8771,7 +10777,7 @@ deal_with_tribes2_packet(struct qserver *server, char *pkt, int pktlen)
 			n_teams = t;
 			goto info_done;
 		}
-		teams[t]->name = strndup(pkt, term - pkt);
+		teams[t]->name = arena_strndup(&server->arena, pkt, term - pkt);
 		pkt = term + 1;
 		term = strchr(pkt, 0xa);
 		if (!term) {
@@ -8799,13 +10805,13 @@ deal_with_tribes2_packet(struct qserver *server, char *pkt, int pktlen)
 		if (pkt - start >= len) {
 			break;
 		}
-		player = (struct player *)calloc(1, sizeof(struct player));
+		player = (struct player *)arena_calloc(&server->arena, sizeof(struct player));
 		term = strchr(pkt, 0x11);
 		if (!term || (term - start >= len)) {
-			free(player);
+			// left to be freed with the arena
 			break;
 		}
-		player->name = strndup(pkt, term - pkt);
+		player->name = arena_strndup(&server->arena, pkt, term - pkt);
 		get_tribes2_player_type(player);
 		pkt = term + 1;
 		pkt++;  /* skip 0x9 */
@@ -8814,8 +10820,6 @@ deal_with_tribes2_packet(struct qserver *server, char *pkt, int pktlen)
 		}
 		term = strchr(pkt, 0x9);
 		if (!term || (term - start >= len)) {
-			free(player->name);
-			free(player);
 			break;
 		}
 		for (t = 0; t < n_teams; t++) {
@@ -8913,7 +10917,7 @@ deal_with_ghostrecon_packet(struct qserver *server, char *pkt, int pktlen)
 	 */
 
 	if (server->server_name == NULL) {
-		server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+		server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 	}
 
 	/* sanity check against packet */
@@ -9072,13 +11076,13 @@ deal_with_ghostrecon_packet(struct qserver *server, char *pkt, int pktlen)
 		iLen = swap_long_from_little(pkt);
 		pkt += 4;
 
-		player = (struct player *)calloc(1, sizeof(struct player));
+		player = (struct player *)arena_calloc(&server->arena, sizeof(struct player));
 
 		if ((iLen < 1) || (iLen > SHORT_GR_LEN)) {
 			add_rule(server, "error", "Player Name too Long", NO_FLAGS);
 			return (PKT_ERROR);
 		}
-		player->name = strndup(pkt, iLen);
+		player->name = arena_strndup(&server->arena, pkt, iLen);
 		pkt += iLen;            /* player name */
 		player->team = i;       // tag so we can find this record when we have player dat.
 		player->team_name = "Unassigned";
@@ -9485,9 +11489,9 @@ deal_with_ravenshield_packet(struct qserver *server, char *rawpkt, int pktlen)
 
 	server->n_servers++;
 	if (NULL == server->server_name) {
-		server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+		server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 	} else {
-		gettimeofday(&server->packet_time1, NULL);
+		server->packet_time1 = qtime_now();
 	}
 
 	rawpkt[pktlen] = '\0';
@@ -9605,7 +11609,7 @@ deal_with_ravenshield_packet(struct qserver *server, char *rawpkt, int pktlen)
 					if (0 != strlen(player_name)) {
 						struct player *player = add_player(server, player_number);
 						if (NULL != player) {
-							player->name = strdup(player_name);
+							player->name = arena_strdup(&server->arena, player_name);
 						}
 						player_number++;
 					}
@@ -9748,9 +11752,9 @@ deal_with_savage_packet(struct qserver *server, char *rawpkt, int pktlen)
 
 	server->n_servers++;
 	if (NULL == server->server_name) {
-		server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+		server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 	} else {
-		gettimeofday(&server->packet_time1, NULL);
+		server->packet_time1 = qtime_now();
 	}
 
 	rawpkt[pktlen] = '\0';
@@ -9865,9 +11869,9 @@ deal_with_savage_packet(struct qserver *server, char *rawpkt, int pktlen)
 					if (0 != strlen(player_name)) {
 						struct player *player = add_player(server, player_number);
 						if (NULL != player) {
-							player->name = strdup(player_name);
+							player->name = arena_strdup(&server->arena, player_name);
 							player->team = team_number;
-							player->team_name = strdup(team_name);
+							player->team_name = intern_strdup(&server->arena, team_name);
 						}
 						player_number++;
 					}
@@ -9892,9 +11896,9 @@ deal_with_farcry_packet(struct qserver *server, char *rawpkt, int pktlen)
 
 	server->n_servers++;
 	if (NULL == server->server_name) {
-		server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+		server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 	} else {
-		gettimeofday(&server->packet_time1, NULL);
+		server->packet_time1 = qtime_now();
 	}
 
 	rawpkt[pktlen] = '\0';
@@ -10009,9 +12013,9 @@ deal_with_farcry_packet(struct qserver *server, char *rawpkt, int pktlen)
 					if (0 != strlen(player_name)) {
 						struct player *player = add_player(server, player_number);
 						if (NULL != player) {
-							player->name = strdup(player_name);
+							player->name = arena_strdup(&server->arena, player_name);
 							player->team = team_number;
-							player->team_name = strdup(team_name);
+							player->team_name = intern_strdup(&server->arena, team_name);
 						}
 						player_number++;
 					}
@@ -10040,7 +12044,7 @@ deal_with_bfris_packet(struct qserver *server, char *rawpkt, int pktlen)
 
 	debug(2, "deal_with_bfris_packet %p, %d", server, pktlen);
 
-	server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+	server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 
 	/* add to the data previously saved */
 	sdata = &server->saved_data;
@@ -10225,7 +12229,7 @@ deal_with_bfris_packet(struct qserver *server, char *rawpkt, int pktlen)
 			}
 
 			player_data_pos += BFRIS_PNAME_POS;
-			player->name = strdup((char *)saved_data + player_data_pos);
+			player->name = arena_strdup(&server->arena, (char *)saved_data + player_data_pos);
 
 			player_data_pos += strlen(player->name) + 1;
 		}
@@ -10256,7 +12260,7 @@ deal_with_descent3_packet(struct qserver *server, char *rawpkt, int pktlen)
 	debug(2, "deal_with_descent3_packet %p, %d", server, pktlen);
 
 	if (server->server_name == NULL) {
-		server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+		server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 	}
 
 	if (pktlen < 4) {
@@ -10336,8 +12340,8 @@ deal_with_descent3_packet(struct qserver *server, char *rawpkt, int pktlen)
 
 		pkt = &rawpkt[0x4];
 		while (*pkt) {
-			player = (struct player *)calloc(1, sizeof(struct player));
-			player->name = strdup(pkt);
+			player = (struct player *)arena_calloc(&server->arena, sizeof(struct player));
+			player->name = arena_strdup(&server->arena, pkt);
 			pkt += strlen(pkt) + 1;
 			*last_player = player;
 			last_player = &player->next;
@@ -10377,7 +12381,7 @@ deal_with_eye_packet(struct qserver *server, char *rawpkt, int pktlen)
 		return (PKT_ERROR);
 	}
 
-	server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+	server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 
 	end = rawpkt + pktlen;
 	pkt_index = rawpkt[3] - '0';
@@ -10515,7 +12519,7 @@ deal_with_eye_packet(struct qserver *server, char *rawpkt, int pktlen)
 		if (mask == 0) {
 			break;
 		}
-		player = (struct player *)calloc(1, sizeof(struct player));
+		player = (struct player *)arena_calloc(&server->arena, sizeof(struct player));
 		if (player == NULL) {
 			break;
 		}
@@ -10599,9 +12603,9 @@ deal_with_hl2_packet(struct qserver *server, char *rawpkt, int pktlen)
 
 	server->n_servers++;
 	if (server->server_name == NULL) {
-		server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+		server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 	} else {
-		gettimeofday(&server->packet_time1, NULL);
+		server->packet_time1 = qtime_now();
 	}
 
 	// Check if correct reply
@@ -10772,7 +12776,7 @@ deal_with_hl2_packet(struct qserver *server, char *rawpkt, int pktlen)
 			ptr++;
 
 			// name
-			player->name = strdup(ptr);
+			player->name = arena_strdup(&server->arena, ptr);
 			ptr += strlen(ptr) + 1;
 
 			// frags
@@ -11243,13 +13247,9 @@ strherror(int h_err)
 
 
 int
-time_delta(struct timeval *later, struct timeval *past)
+time_delta(qtime_t later, qtime_t past)
 {
-	if (later->tv_usec < past->tv_usec) {
-		later->tv_sec--;
-		later->tv_usec += 1000000;
-	}
-	return ((later->tv_sec - past->tv_sec) * 1000 + (later->tv_usec - past->tv_usec) / 1000);
+	return ((int)((later - past) / QTIME_MS));
 }
 
 
@@ -11472,6 +13472,9 @@ strcmp_withnull(char *one, char *two)
 	if (one == NULL) {
 		return (1);
 	}
+	if (one == two) {
+		return (0);
+	}
 	return (strcasecmp(one, two));
 }
 
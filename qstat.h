@@ -88,6 +88,7 @@ typedef enum {
 	REQ_ERROR = -5
 } query_status_t;
 
+#include "qtime.h"
 #include "qserver.h"
 
 typedef void (*DisplayFunc)(struct qserver *);
@@ -309,6 +310,7 @@ struct q_packet;
  */
 
 void display_server(struct qserver *server);
+void output_server(struct qserver *server);
 void display_qwmaster(struct qserver *server);
 void display_server_rules(struct qserver *server);
 void display_player_info(struct qserver *server);
@@ -3796,6 +3798,15 @@ struct player;
 #define FLAG_BROADCAST			(1 << 1)
 #define FLAG_PLAYER_TEAMS		(1 << 2)
 #define FLAG_DO_NOT_FREE_GAME		(1 << 3)
+#define FLAG_SHARED_SOCKET		(1 << 4)        /* queried over a shared socket pool */
+#define FLAG_SOCKET_POOL		(1 << 5)        /* shared socket, not a real server */
+#define FLAG_CONNECT_WAIT		(1 << 6)        /* registered while its TCP connect completes */
+#define FLAG_RESOLVING			(1 << 7)        /* waiting on its address */
+#define FLAG_NAME_WAIT			(1 << 8)        /* waiting on its host name for -H */
+#define FLAG_DISPLAY_WAIT		(1 << 9)        /* finished, shown once its name is known */
+#define FLAG_MASTER_CACHED		(1 << 10)       /* master list read from -mcache */
+#define FLAG_CHECK_DUPLICATE_RULES	(1 << 11)       /* rules may repeat, add_rule must check */
+#define FLAG_CUT_SHORT			(1 << 12)       /* gave up on it before its reply was complete */
 
 #define PLAYER_TYPE_NORMAL		1
 #define PLAYER_TYPE_BOT			2
@@ -3832,6 +3843,8 @@ struct player {
 	struct info **last_info;
 	int missing_rules;
 
+	struct arena *arena;            /* where player_add_info allocates, NULL to malloc */
+
 	struct player *next;
 };
 
@@ -3857,7 +3870,7 @@ extern char *HOSTNOTFOUND;
 
 extern int n_retries;
 
-extern struct timeval packet_recv_time;
+extern qtime_t packet_recv_time;
 
 #define DEFAULT_RETRIES			3
 #define DEFAULT_RETRY_INTERVAL		500 /* milli-seconds */
@@ -3962,7 +3975,7 @@ int server_info_packet(struct qserver *server, struct q_packet *pkt, int datalen
 int player_info_packet(struct qserver *server, struct q_packet *pkt, int datalen);
 int rule_info_packet(struct qserver *server, struct q_packet *pkt, int datalen);
 
-int time_delta(struct timeval *later, struct timeval *past);
+int time_delta(qtime_t later, qtime_t past);
 char *strherror(int h_err);
 int connection_refused();
 int connection_would_block();
@@ -4028,6 +4041,25 @@ char *hcache_lookup_ipaddr(unsigned long ipaddr);
 void hcache_write_file(char *filename);
 void hcache_update_file();
 
+#define HCACHE_TTL_DEFAULT             86400
+#define HCACHE_NEGATIVE_TTL_DEFAULT    3600
+
+/** \brief seconds a lookup stays in the host cache, set by -Httl */
+extern int hcache_ttl;
+
+/** \brief seconds a failed lookup stays in the host cache, set by -Hnegttl */
+extern int hcache_negative_ttl;
+
+/*
+ * Cache only lookups, the add functions record the results of lookups
+ * done elsewhere. A failed lookup is recorded with an address of 0 or a
+ * NULL name. Expired entries aren't found.
+ */
+int hcache_find_hostname(char *hostname, unsigned long *ipaddr);
+void hcache_add_hostname(char *hostname, unsigned long ipaddr, char *canonical);
+int hcache_find_ipaddr(unsigned long ipaddr, char **hostname);
+void hcache_add_ipaddr(unsigned long ipaddr, char *hostname);
+
 unsigned int swap_long_from_little(void *l);
 unsigned short swap_short_from_little(void *l);
 float swap_float_from_little(void *f);
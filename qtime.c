@@ -0,0 +1,93 @@
+/*
+ * qstat
+ * by Steve Jankowski
+ *
+ * Monotonic clock for query timing
+ *
+ * Licensed under the Artistic License, see LICENSE.txt for license terms
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "qstat.h"
+#include "qtime.h"
+
+#ifdef _WIN32
+ #include <windows.h>
+#endif
+
+static qtime_t now;
+
+// wall clock minus monotonic clock, worked out once per update if needed
+static qtime_t wall_offset;
+static int wall_offset_valid = 0;
+
+
+static qtime_t
+qtime_read(void)
+{
+#if defined(_WIN32)
+		static LARGE_INTEGER freq;
+		LARGE_INTEGER count;
+
+		if (freq.QuadPart == 0) {
+			QueryPerformanceFrequency(&freq);
+		}
+		QueryPerformanceCounter(&count);
+
+		return ((qtime_t)(count.QuadPart / freq.QuadPart) * QTIME_SEC + (qtime_t)(count.QuadPart % freq.QuadPart) * QTIME_SEC / freq.QuadPart);
+#elif defined(CLOCK_MONOTONIC)
+		struct timespec ts;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+
+		return ((qtime_t)ts.tv_sec * QTIME_SEC + ts.tv_nsec);
+#else
+		struct timeval tv;
+
+		// no monotonic clock, the best that can be done
+		gettimeofday(&tv, NULL);
+
+		return ((qtime_t)tv.tv_sec * QTIME_SEC + (qtime_t)tv.tv_usec * QTIME_US);
+#endif
+}
+
+
+qtime_t
+qtime_update(void)
+{
+	now = qtime_read();
+	wall_offset_valid = 0;
+
+	return (now);
+}
+
+
+qtime_t
+qtime_now(void)
+{
+	if (now == 0) {
+		return (qtime_update());
+	}
+
+	return (now);
+}
+
+
+qtime_t
+qtime_from_wall(long long sec, long nsec)
+{
+	struct timeval wall;
+	qtime_t mono;
+
+	if (!wall_offset_valid) {
+		gettimeofday(&wall, NULL);
+		mono = qtime_read();
+		wall_offset = ((qtime_t)wall.tv_sec * QTIME_SEC + (qtime_t)wall.tv_usec * QTIME_US) - mono;
+		wall_offset_valid = 1;
+	}
+
+	return ((qtime_t)sec * QTIME_SEC + nsec - wall_offset);
+}
@@ -0,0 +1,42 @@
+/*
+ * qstat
+ * by Steve Jankowski
+ *
+ * Monotonic clock for query timing
+ *
+ * Licensed under the Artistic License, see LICENSE.txt for license terms
+ */
+#ifndef QSTAT_QTIME_H
+#define QSTAT_QTIME_H
+
+/**
+ * Nanoseconds on a clock which only moves forward, unaffected by the
+ * wall clock being stepped. Only differences between times mean anything.
+ */
+typedef long long qtime_t;
+
+#define QTIME_US      1000LL
+#define QTIME_MS      1000000LL
+#define QTIME_SEC     1000000000LL
+
+/**
+ * Read the clock
+ *
+ * The time read is also kept for qtime_now.
+ */
+qtime_t qtime_update(void);
+
+/**
+ * \returns the time from the last qtime_update
+ *
+ * The main loop updates the time each time it wakes up, so this is
+ * enough for timeouts and deadlines without reading the clock again.
+ */
+qtime_t qtime_now(void);
+
+/**
+ * Convert a wall clock time, as kernel receive timestamps are, to a qtime_t
+ */
+qtime_t qtime_from_wall(long long sec, long nsec);
+
+#endif
@@ -0,0 +1,198 @@
+/*
+ * qstat
+ * by Steve Jankowski
+ *
+ * Send rate limiting
+ *
+ * Licensed under the Artistic License, see LICENSE.txt for license terms
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "qstat.h"
+#include "ratelimit.h"
+#include "debug.h"
+
+struct ratelimit send_limit;
+struct ratelimit master_send_limit;
+
+
+int
+ratelimit_parse(const char *arg, double *rate, double *burst)
+{
+	char *end;
+
+	*rate = strtod(arg, &end);
+	if ((end == arg) || (*rate <= 0)) {
+		return (-1);
+	}
+
+	if (*end == ':') {
+		arg = end + 1;
+		*burst = strtod(arg, &end);
+		if ((end == arg) || (*burst < 1)) {
+			return (-1);
+		}
+	} else {
+		*burst = *rate / 10;
+		if (*burst < 1) {
+			*burst = 1;
+		}
+	}
+
+	if (*end != '\0') {
+		return (-1);
+	}
+
+	return (0);
+}
+
+
+static int
+ratelimit_active(struct ratelimit *limit)
+{
+	return (limit->packet_rate > 0 || limit->byte_rate > 0);
+}
+
+
+int
+ratelimit_enabled()
+{
+	return (ratelimit_active(&send_limit) || ratelimit_active(&master_send_limit));
+}
+
+
+struct ratelimit *
+ratelimit_for(struct qserver *server)
+{
+	if ((server->type->id & MASTER_SERVER) && ratelimit_active(&master_send_limit)) {
+		return (&master_send_limit);
+	}
+
+	return (&send_limit);
+}
+
+
+static void
+ratelimit_refill(struct ratelimit *limit)
+{
+	qtime_t now = qtime_now();
+	double elapsed;
+
+	elapsed = (double)(now - limit->last) / QTIME_SEC;
+	if (elapsed <= 0) {
+		return;
+	}
+	limit->last = now;
+
+	limit->packets += limit->packet_rate * elapsed;
+	if (limit->packets > limit->packet_burst) {
+		limit->packets = limit->packet_burst;
+	}
+
+	limit->bytes += limit->byte_rate * elapsed;
+	if (limit->bytes > limit->byte_burst) {
+		limit->bytes = limit->byte_burst;
+	}
+}
+
+
+int
+ratelimit_ready(struct ratelimit *limit)
+{
+	if (!ratelimit_active(limit)) {
+		return (1);
+	}
+
+	ratelimit_refill(limit);
+
+	return (
+		(limit->packet_rate <= 0 || limit->packets >= 1) &&
+		(limit->byte_rate <= 0 || limit->bytes >= 0)
+		);
+}
+
+
+int
+ratelimit_wait(struct ratelimit *limit)
+{
+	double wait = 0, bytes_wait;
+
+	if (ratelimit_ready(limit)) {
+		return (0);
+	}
+
+	if ((limit->packet_rate > 0) && (limit->packets < 1)) {
+		wait = (1 - limit->packets) / limit->packet_rate;
+	}
+
+	if ((limit->byte_rate > 0) && (limit->bytes < 0)) {
+		bytes_wait = -limit->bytes / limit->byte_rate;
+		if (bytes_wait > wait) {
+			wait = bytes_wait;
+		}
+	}
+
+	// round up so we don't wake before there's a whole token
+	return ((int)(wait * 1000) + 1);
+}
+
+
+int
+ratelimit_next()
+{
+	int wait, master_wait;
+
+	wait = ratelimit_wait(&send_limit);
+	if (ratelimit_active(&master_send_limit)) {
+		master_wait = ratelimit_wait(&master_send_limit);
+		if (master_wait < wait) {
+			wait = master_wait;
+		}
+	}
+
+	return (wait);
+}
+
+
+static void
+ratelimit_share_limit(struct ratelimit *limit, int n)
+{
+	limit->packet_rate /= n;
+	limit->packet_burst /= n;
+	if (limit->packet_burst < 1) {
+		limit->packet_burst = 1;
+	}
+
+	limit->byte_rate /= n;
+	limit->byte_burst /= n;
+	if (limit->byte_burst < 1) {
+		limit->byte_burst = 1;
+	}
+}
+
+
+void
+ratelimit_share(int n)
+{
+	ratelimit_share_limit(&send_limit, n);
+	ratelimit_share_limit(&master_send_limit, n);
+}
+
+
+void
+ratelimit_charge(struct ratelimit *limit, size_t len)
+{
+	if (!ratelimit_active(limit)) {
+		return;
+	}
+
+	ratelimit_refill(limit);
+
+	limit->packets--;
+	limit->bytes -= len;
+
+	debug(4, "packets %.1f bytes %.0f", limit->packets, limit->bytes);
+}
@@ -0,0 +1,84 @@
+/*
+ * qstat
+ * by Steve Jankowski
+ *
+ * Send rate limiting
+ *
+ * Licensed under the Artistic License, see LICENSE.txt for license terms
+ */
+#ifndef QSTAT_RATELIMIT_H
+#define QSTAT_RATELIMIT_H
+
+#include "qstat.h"
+
+/**
+ * Token buckets limiting the packets and bytes sent per second.
+ *
+ * A send is allowed while there's at least one packet token and the byte
+ * bucket isn't in debt, its actual size is then charged which may take the
+ * byte bucket below zero. A rate of 0 means that bucket is unlimited.
+ * Buckets start out empty but are filled to their burst on first use.
+ */
+struct ratelimit {
+	double packet_rate;
+	double packet_burst;
+	double packets;
+
+	double byte_rate;
+	double byte_burst;
+	double bytes;
+
+	qtime_t last;
+};
+
+/** \brief limit for all servers, or just game servers with -msendrate / -msendbytes */
+extern struct ratelimit send_limit;
+
+/** \brief separate limit for master servers */
+extern struct ratelimit master_send_limit;
+
+/**
+ * Parse a "<rate>[:<burst>]" option argument
+ *
+ * The burst defaults to a tenth of a second's worth of the rate.
+ *
+ * \returns 0 on success or -1 if the argument is invalid
+ */
+int ratelimit_parse(const char *arg, double *rate, double *burst);
+
+/**
+ * \returns non zero if any send rate limit has been set
+ */
+int ratelimit_enabled();
+
+/**
+ * \returns the limit which applies to sends to server
+ */
+struct ratelimit *ratelimit_for(struct qserver *server);
+
+/**
+ * \returns non zero if limit allows a packet to be sent now
+ */
+int ratelimit_ready(struct ratelimit *limit);
+
+/**
+ * \returns time in ms until limit allows a packet to be sent, 0 if it does now
+ */
+int ratelimit_wait(struct ratelimit *limit);
+
+/**
+ * \returns time in ms until any limit allows a packet to be sent, 0 if one does now
+ */
+int ratelimit_next();
+
+/**
+ * Divide the limits between n processes sending in parallel
+ */
+void ratelimit_share(int n);
+
+/**
+ * Take a sent packet of len bytes from limit's buckets
+ */
+void ratelimit_charge(struct ratelimit *limit, size_t len);
+
+#endif
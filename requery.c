@@ -0,0 +1,119 @@
+/*
+ * qstat
+ * by Steve Jankowski
+ *
+ * Daemon mode, querying servers again and again
+ *
+ * Finished servers wait in a min-heap on the time they're next due. Once
+ * due they're reset and moved to the end of the server list, where
+ * bind_sockets picks them up like any other server yet to be queried, so
+ * the server table is built once and stays put.
+ *
+ * Licensed under the Artistic License, see LICENSE.txt for license terms
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#include "qstat.h"
+#include "requery.h"
+#include "debug.h"
+
+struct requery {
+	qtime_t due;
+	struct qserver *server;
+};
+
+int requery_interval = 0;
+
+static struct requery *heap = NULL;
+static int n_heap = 0;
+static int max_heap = 0;
+
+
+static void
+swap(int a, int b)
+{
+	struct requery tmp = heap[a];
+
+	heap[a] = heap[b];
+	heap[b] = tmp;
+}
+
+
+int
+requery_schedule(struct qserver *server)
+{
+	qtime_t interval = (qtime_t)requery_interval * QTIME_SEC;
+	int i;
+
+	if (!requery_interval || server->type->master || (server->flags & FLAG_BROADCAST) || (server->server_name == HOSTNOTFOUND)) {
+		// masters and broadcasts find their servers once, and it's
+		// those servers which are queried again
+		return (0);
+	}
+
+	if (n_heap == max_heap) {
+		max_heap = max_heap ? max_heap * 2 : 64;
+		heap = (struct requery *)realloc(heap, max_heap * sizeof(struct requery));
+	}
+
+	// anywhere from 0.9 to 1.1 intervals from now
+	i = n_heap++;
+	heap[i].due = qtime_now() + interval - interval / 10 + (qtime_t)((double)rand() / RAND_MAX * (interval / 5));
+	heap[i].server = server;
+	for ( ; i > 0 && heap[i].due < heap[(i - 1) / 2].due; i = (i - 1) / 2) {
+		swap(i, (i - 1) / 2);
+	}
+
+	return (1);
+}
+
+
+void
+requery_due()
+{
+	struct qserver *server;
+	qtime_t now = qtime_now();
+	int i, child;
+
+	while (n_heap && (heap[0].due <= now)) {
+		server = heap[0].server;
+		heap[0] = heap[--n_heap];
+		for (i = 0; (child = 2 * i + 1) < n_heap; i = child) {
+			if ((child + 1 < n_heap) && (heap[child + 1].due < heap[child].due)) {
+				child++;
+			}
+			if (heap[i].due <= heap[child].due) {
+				break;
+			}
+			swap(i, child);
+		}
+
+		debug(2, "requerying %s", server->arg);
+		requeue_qserver(server);
+	}
+}
+
+
+int
+requery_wait()
+{
+	qtime_t wait;
+
+	if (n_heap == 0) {
+		return (-1);
+	}
+
+	wait = heap[0].due - qtime_now();
+	if (wait <= 0) {
+		return (0);
+	}
+
+	// rounded up so the wait doesn't end just short of it, and kept in
+	// range of an int for very long -daemon intervals
+	wait = (wait + QTIME_MS - 1) / QTIME_MS;
+
+	return ((wait > INT_MAX) ? INT_MAX : (int)wait);
+}
@@ -0,0 +1,46 @@
+/*
+ * qstat
+ * by Steve Jankowski
+ *
+ * Daemon mode, querying servers again and again
+ *
+ * Licensed under the Artistic License, see LICENSE.txt for license terms
+ */
+#ifndef QSTAT_REQUERY_H
+#define QSTAT_REQUERY_H
+
+#include "qstat.h"
+
+/** \brief seconds between queries of each server, 0 to query once, set by -daemon */
+extern int requery_interval;
+
+/**
+ * Start the clock for the next query of server, whose result has just
+ * been shown
+ *
+ * Each server is queried again after requery_interval give or take a
+ * tenth, so servers which were queried together drift apart and the
+ * sends are spread out.
+ *
+ * \returns 1 if server is kept for it, 0 if it's done with and can be freed
+ */
+int requery_schedule(struct qserver *server);
+
+/**
+ * Put the servers which are due back in the queue
+ */
+void requery_due();
+
+/**
+ * \returns the milliseconds until the next server is due, -1 if none are
+ * waiting
+ */
+int requery_wait();
+
+/**
+ * Called by requery_due for each server which is due, to reset it and
+ * queue it to be queried again
+ */
+void requeue_qserver(struct qserver *server);
+
+#endif
@@ -0,0 +1,391 @@
+/*
+ * qstat
+ * by Steve Jankowski
+ *
+ * Background host name lookups
+ *
+ * Long server lists name many hosts and a slow name server would hold up
+ * the whole run while each is looked up in turn, so lookups are handed to
+ * a pool of threads and their servers join the queries as they finish.
+ * Results are only handed over from resolve_poll, so the host cache and
+ * server list are never touched off the main thread.
+ *
+ * Without threads the lookups are done as they're asked for.
+ *
+ * Licensed under the Artistic License, see LICENSE.txt for license terms
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "qstat.h"
+#include "resolve.h"
+#include "debug.h"
+
+#ifndef _WIN32
+ #include <sys/types.h>
+ #include <sys/socket.h>
+ #include <netinet/in.h>
+ #include <arpa/inet.h>
+ #include <netdb.h>
+#endif
+
+#ifdef HAVE_PTHREAD_H
+ #include <pthread.h>
+#endif
+
+#define RESOLVE_HASH_SIZE    1024
+
+struct resolve_request {
+	int reverse;
+	char *hostname;         /* forward: looked up, reverse: result */
+	unsigned long ipaddr;   /* forward: result, reverse: looked up */
+	char *canonical;
+	int h_err;
+
+	struct qserver **servers;
+	int n_servers;
+	int max_servers;
+
+	struct resolve_request *next;
+	struct resolve_request *hash_next;
+};
+
+int max_resolvers = RESOLVERS_DEFAULT;
+
+// lookups not yet through resolve_poll, so servers can join them
+static struct resolve_request *pending[RESOLVE_HASH_SIZE];
+static int n_pending = 0;
+
+static struct resolve_request *done_head = NULL;
+static struct resolve_request **done_tail = &done_head;
+
+#ifdef HAVE_PTHREAD_H
+	static pthread_mutex_t resolve_lock = PTHREAD_MUTEX_INITIALIZER;
+	static pthread_cond_t resolve_wake = PTHREAD_COND_INITIALIZER;
+	static struct resolve_request *todo_head = NULL;
+	static struct resolve_request **todo_tail = &todo_head;
+	static int n_threads = 0;
+	static int n_idle = 0;
+#endif
+
+
+static unsigned int
+hostname_hash(const char *hostname)
+{
+	unsigned int hash = 5381;
+
+	while (*hostname) {
+		hash = hash * 33 + (unsigned char)*hostname++;
+	}
+
+	return (hash % RESOLVE_HASH_SIZE);
+}
+
+
+static unsigned int
+request_hash(struct resolve_request *request)
+{
+	if (request->reverse) {
+		return ((unsigned int)(request->ipaddr * 2654435761u) % RESOLVE_HASH_SIZE);
+	}
+
+	return (hostname_hash(request->hostname));
+}
+
+
+#ifdef HAVE_PTHREAD_H
+	static int
+	gai_h_errno(int rc)
+	{
+		switch (rc) {
+		case EAI_AGAIN:
+			return (TRY_AGAIN);
+
+		case EAI_FAIL:
+			return (NO_RECOVERY);
+
+ #ifdef EAI_NODATA
+		case EAI_NODATA:
+			return (NO_ADDRESS);
+ #endif
+
+		default:
+			return (HOST_NOT_FOUND);
+		}
+	}
+
+
+	static void
+	lookup(struct resolve_request *request)
+	{
+		struct addrinfo hints, *res;
+		struct sockaddr_in addr;
+		char host[NI_MAXHOST];
+		int rc;
+
+		if (request->reverse) {
+			memset(&addr, 0, sizeof(addr));
+			addr.sin_family = AF_INET;
+			addr.sin_addr.s_addr = htonl(request->ipaddr);
+			rc = getnameinfo((struct sockaddr *)&addr, sizeof(addr), host, sizeof(host), NULL, 0, NI_NAMEREQD);
+			if (rc == 0) {
+				request->hostname = strdup(host);
+			} else {
+				request->h_err = gai_h_errno(rc);
+			}
+			return;
+		}
+
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_DGRAM;
+		hints.ai_flags = AI_CANONNAME;
+		rc = getaddrinfo(request->hostname, NULL, &hints, &res);
+		if (rc != 0) {
+			request->h_err = gai_h_errno(rc);
+			return;
+		}
+
+		request->ipaddr = ntohl(((struct sockaddr_in *)res->ai_addr)->sin_addr.s_addr);
+		if (res->ai_canonname != NULL) {
+			request->canonical = strdup(res->ai_canonname);
+		}
+		freeaddrinfo(res);
+	}
+
+
+	static void *
+	resolver_main(void *arg)
+	{
+		struct resolve_request *request;
+
+		pthread_mutex_lock(&resolve_lock);
+		for ( ; ; ) {
+			while (todo_head == NULL) {
+				n_idle++;
+				pthread_cond_wait(&resolve_wake, &resolve_lock);
+				n_idle--;
+			}
+			request = todo_head;
+			todo_head = request->next;
+			if (todo_head == NULL) {
+				todo_tail = &todo_head;
+			}
+			pthread_mutex_unlock(&resolve_lock);
+
+			lookup(request);
+
+			pthread_mutex_lock(&resolve_lock);
+			request->next = NULL;
+			*done_tail = request;
+			done_tail = &request->next;
+		}
+
+		return (NULL);
+	}
+
+
+	static void
+	start_lookup(struct resolve_request *request)
+	{
+		pthread_t thread;
+
+		pthread_mutex_lock(&resolve_lock);
+		*todo_tail = request;
+		todo_tail = &request->next;
+		if ((n_idle == 0) && (n_threads < max_resolvers)) {
+			if (pthread_create(&thread, NULL, resolver_main, NULL) == 0) {
+				pthread_detach(thread);
+				n_threads++;
+				debug(2, "started resolver %d", n_threads);
+			} else if (n_threads == 0) {
+				// no thread will ever pick it up, so do it here
+				todo_head = NULL;
+				todo_tail = &todo_head;
+				pthread_mutex_unlock(&resolve_lock);
+				lookup(request);
+				pthread_mutex_lock(&resolve_lock);
+				*done_tail = request;
+				done_tail = &request->next;
+			}
+		}
+		pthread_cond_signal(&resolve_wake);
+		pthread_mutex_unlock(&resolve_lock);
+	}
+
+
+#else /* HAVE_PTHREAD_H */
+	static void
+	lookup(struct resolve_request *request)
+	{
+		struct hostent *ent;
+		struct in_addr addr;
+
+		if (request->reverse) {
+			addr.s_addr = htonl(request->ipaddr);
+			ent = gethostbyaddr((char *)&addr, sizeof(addr), AF_INET);
+			if ((ent != NULL) && (ent->h_name != NULL)) {
+				request->hostname = strdup(ent->h_name);
+			} else {
+				request->h_err = h_errno;
+			}
+			return;
+		}
+
+		ent = gethostbyname(request->hostname);
+		if (ent == NULL) {
+			request->h_err = h_errno;
+			return;
+		}
+		memcpy(&addr, ent->h_addr_list[0], sizeof(addr));
+		request->ipaddr = ntohl(addr.s_addr);
+		if (ent->h_name != NULL) {
+			request->canonical = strdup(ent->h_name);
+		}
+	}
+
+
+	static void
+	start_lookup(struct resolve_request *request)
+	{
+		lookup(request);
+		*done_tail = request;
+		done_tail = &request->next;
+	}
+
+
+#endif /* HAVE_PTHREAD_H */
+
+static void
+add_waiting(struct resolve_request *request, struct qserver *server)
+{
+	if (request->n_servers == request->max_servers) {
+		request->max_servers = request->max_servers ? request->max_servers * 2 : 4;
+		request->servers = (struct qserver **)realloc(request->servers, request->max_servers * sizeof(struct qserver *));
+	}
+	request->servers[request->n_servers++] = server;
+}
+
+
+static void
+submit(struct resolve_request *request, struct qserver *server)
+{
+	unsigned int hash = request_hash(request);
+
+	add_waiting(request, server);
+	request->hash_next = pending[hash];
+	pending[hash] = request;
+	n_pending++;
+
+	if (request->reverse) {
+		debug(2, "resolving %lx", request->ipaddr);
+	} else {
+		debug(2, "resolving %s", request->hostname);
+	}
+	start_lookup(request);
+}
+
+
+void
+resolve_hostname(const char *hostname, struct qserver *server)
+{
+	struct resolve_request *request;
+
+	for (request = pending[hostname_hash(hostname)]; request != NULL; request = request->hash_next) {
+		if (!request->reverse && (strcmp(request->hostname, hostname) == 0)) {
+			add_waiting(request, server);
+			return;
+		}
+	}
+
+	request = (struct resolve_request *)calloc(1, sizeof(struct resolve_request));
+	request->hostname = strdup(hostname);
+	submit(request, server);
+}
+
+
+void
+resolve_ipaddr(unsigned long ipaddr, struct qserver *server)
+{
+	struct resolve_request *request, key;
+
+	key.reverse = 1;
+	key.ipaddr = ipaddr;
+	for (request = pending[request_hash(&key)]; request != NULL; request = request->hash_next) {
+		if (request->reverse && (request->ipaddr == ipaddr)) {
+			add_waiting(request, server);
+			return;
+		}
+	}
+
+	request = (struct resolve_request *)calloc(1, sizeof(struct resolve_request));
+	request->reverse = 1;
+	request->ipaddr = ipaddr;
+	submit(request, server);
+}
+
+
+static void
+forget(struct resolve_request *request)
+{
+	struct resolve_request **prev = &pending[request_hash(request)];
+
+	while (*prev != request) {
+		prev = &(*prev)->hash_next;
+	}
+	*prev = request->hash_next;
+	n_pending--;
+}
+
+
+void
+resolve_poll()
+{
+	struct resolve_request *request, *next;
+
+	if (n_pending == 0) {
+		return;
+	}
+
+#ifdef HAVE_PTHREAD_H
+		pthread_mutex_lock(&resolve_lock);
+#endif
+	request = done_head;
+	done_head = NULL;
+	done_tail = &done_head;
+#ifdef HAVE_PTHREAD_H
+		pthread_mutex_unlock(&resolve_lock);
+#endif
+
+	for ( ; request != NULL; request = next) {
+		next = request->next;
+		forget(request);
+
+		if (request->reverse) {
+			debug(2, "%lx is %s", request->ipaddr, request->hostname ? request->hostname : "unnamed");
+			hcache_add_ipaddr(request->ipaddr, request->hostname);
+			qserver_named(request->servers, request->n_servers, request->hostname);
+		} else {
+			debug(2, "%s is %lx", request->hostname, request->ipaddr);
+			hcache_add_hostname(request->hostname, request->ipaddr, request->canonical);
+			qserver_resolved(request->servers, request->n_servers, request->hostname, request->ipaddr, request->h_err);
+		}
+
+		free(request->hostname);
+		free(request->canonical);
+		free(request->servers);
+		free(request);
+	}
+
+	// appends just the new lookups, so they're kept if the run dies
+	hcache_update_file();
+}
+
+
+int
+resolve_pending()
+{
+	return (n_pending);
+}
@@ -0,0 +1,57 @@
+/*
+ * qstat
+ * by Steve Jankowski
+ *
+ * Background host name lookups
+ *
+ * Licensed under the Artistic License, see LICENSE.txt for license terms
+ */
+#ifndef QSTAT_RESOLVE_H
+#define QSTAT_RESOLVE_H
+
+#include "qstat.h"
+
+#define RESOLVERS_DEFAULT    16
+
+/** \brief lookups run at once, set by -resolvers */
+extern int max_resolvers;
+
+/**
+ * Look up the address of hostname for server
+ *
+ * Servers waiting on the same name share one lookup. The result is passed
+ * to qserver_resolved by a later resolve_poll.
+ */
+void resolve_hostname(const char *hostname, struct qserver *server);
+
+/**
+ * Look up the name of ipaddr, in host byte order, for server
+ *
+ * The result is passed to qserver_named by a later resolve_poll.
+ */
+void resolve_ipaddr(unsigned long ipaddr, struct qserver *server);
+
+/**
+ * Record the lookups which have finished and hand them to their servers
+ */
+void resolve_poll();
+
+/**
+ * \returns the number of lookups which haven't been through resolve_poll yet
+ */
+int resolve_pending();
+
+/**
+ * Called by resolve_poll with the address of the servers waiting on
+ * hostname, in host byte order, or 0 and the h_errno style error if it
+ * wasn't found
+ */
+void qserver_resolved(struct qserver **servers, int n_servers, const char *hostname, unsigned long ipaddr, int h_err);
+
+/**
+ * Called by resolve_poll with the name of the servers waiting on a
+ * reverse lookup, NULL if it has none
+ */
+void qserver_named(struct qserver **servers, int n_servers, const char *hostname);
+
+#endif
@@ -0,0 +1,136 @@
+/*
+ * qstat
+ * by Steve Jankowski
+ *
+ * Round trip time estimation
+ *
+ * Licensed under the Artistic License, see LICENSE.txt for license terms
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "qstat.h"
+#include "rtt.h"
+#include "debug.h"
+
+// a type's estimate is only trusted for unseen servers after this many
+#define RTT_TYPE_SAMPLES    16
+
+// clock granularity in the retransmit timeout, RFC 6298's G
+#define RTT_GRANULARITY     1000
+
+extern server_type *types;
+extern int n_server_types;
+
+static struct rtt_estimate *type_rtt;
+
+
+static struct rtt_estimate *
+rtt_for_type(server_type *type)
+{
+	int index = type - types;
+
+	if ((index < 0) || (index >= n_server_types)) {
+		return (NULL);
+	}
+
+	if (type_rtt == NULL) {
+		type_rtt = (struct rtt_estimate *)calloc(n_server_types, sizeof(struct rtt_estimate));
+	}
+
+	return ((type_rtt != NULL) ? &type_rtt[index] : NULL);
+}
+
+
+/*
+ * Fold a sample of rtt microseconds into est as RFC 6298 does
+ */
+static void
+rtt_update(struct rtt_estimate *est, int rtt)
+{
+	int delta;
+
+	if (est->samples++ == 0) {
+		est->srtt = rtt;
+		est->rttvar = rtt / 2;
+		return;
+	}
+
+	delta = est->srtt - rtt;
+	if (delta < 0) {
+		delta = -delta;
+	}
+	est->rttvar += (delta - est->rttvar) / 4;
+	est->srtt += (rtt - est->srtt) / 8;
+}
+
+
+void
+rtt_sent(struct qserver *server)
+{
+	if (server->rtt_sends++ == 0) {
+		server->rtt_sent = qtime_now();
+	}
+}
+
+
+void
+rtt_received(struct qserver *server, qtime_t recv_time)
+{
+	struct rtt_estimate *type_est;
+	int rtt;
+
+	if (server->rtt_sends == 1) {
+		rtt = (int)((recv_time - server->rtt_sent) / QTIME_US);
+		if (rtt >= 0) {
+			rtt_update(&server->rtt, rtt);
+			type_est = rtt_for_type(server->type);
+			if (type_est != NULL) {
+				rtt_update(type_est, rtt);
+			}
+			debug(3, "rtt %d srtt %d rttvar %d", rtt, server->rtt.srtt, server->rtt.rttvar);
+		}
+	}
+
+	// the rest of a multi packet reply isn't a round trip
+	server->rtt_sends = 0;
+}
+
+
+int
+rtt_timeout(struct qserver *server, int interval)
+{
+	struct rtt_estimate *est = &server->rtt, seeded;
+	int timeout, var;
+
+	if (est->samples == 0) {
+		if ((server->n_requests > 0) && (server->ping_total > 0)) {
+			// replies to several queries at once can't be sampled
+			// but the protocol code still tracks the average ping
+			seeded.srtt = server->ping_total / server->n_requests * 1000;
+			seeded.rttvar = seeded.srtt / 2;
+			est = &seeded;
+		} else {
+			est = rtt_for_type(server->type);
+			if ((est == NULL) || (est->samples < RTT_TYPE_SAMPLES)) {
+				return (interval);
+			}
+		}
+	}
+
+	var = 4 * est->rttvar;
+	if (var < RTT_GRANULARITY) {
+		var = RTT_GRANULARITY;
+	}
+	timeout = (est->srtt + var + 999) / 1000;
+
+	if (timeout < interval / 5) {
+		timeout = interval / 5;
+	} else if (timeout > interval * 4) {
+		timeout = interval * 4;
+	}
+
+	return (timeout);
+}
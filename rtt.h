@@ -0,0 +1,39 @@
+/*
+ * qstat
+ * by Steve Jankowski
+ *
+ * Round trip time estimation
+ *
+ * Licensed under the Artistic License, see LICENSE.txt for license terms
+ */
+#ifndef QSTAT_RTT_H
+#define QSTAT_RTT_H
+
+#include "qstat.h"
+
+/**
+ * Record that a packet is being sent to server
+ */
+void rtt_sent(struct qserver *server);
+
+/**
+ * Take a round trip sample from a reply received from server at recv_time
+ *
+ * Following Karn's algorithm only a reply to a single outstanding packet
+ * is sampled, as a reply after a retry can't be matched to its request.
+ * Samples update both the server's estimate and that of its type.
+ */
+void rtt_received(struct qserver *server, qtime_t recv_time);
+
+/**
+ * Time in ms to wait for a reply from server before retrying
+ *
+ * This is the TCP style retransmit timeout of smoothed round trip time
+ * plus four times its variance, from the server's own estimate or one
+ * seeded from its average ping, else from its type's estimate once that
+ * has enough samples. Without an estimate it's interval, which also
+ * bounds the result to between a fifth and four times itself.
+ */
+int rtt_timeout(struct qserver *server, int interval);
+
+#endif
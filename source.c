@@ -0,0 +1,165 @@
+/*
+ * qstat
+ * by Steve Jankowski
+ *
+ * Local addresses queries are sent from
+ *
+ * Some servers and masters limit how fast each address may query them,
+ * so with several local addresses the queries are spread across all of
+ * them, and across each one's ports.
+ *
+ * Licensed under the Artistic License, see LICENSE.txt for license terms
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "qstat.h"
+#include "source.h"
+#include "debug.h"
+
+#ifndef _WIN32
+ #include <netinet/in.h>
+#endif
+
+static struct source *sources;
+static int n_sources = 0;
+static int max_sources = 0;
+
+// the last source handed out, ties go to the ones after it
+static int last_source = -1;
+
+
+void
+source_add(unsigned int ip, unsigned short port_low, unsigned short port_high)
+{
+	struct source *source;
+
+	if (n_sources == max_sources) {
+		max_sources = max_sources ? max_sources * 2 : 4;
+		sources = (struct source *)realloc(sources, max_sources * sizeof(struct source));
+	}
+
+	source = &sources[n_sources++];
+	memset(source, 0, sizeof(struct source));
+	source->ip = ip;
+	source->port_low = port_low;
+	source->port_high = port_high;
+	source->next_port = port_low;
+}
+
+
+void
+source_init(unsigned short port_low, unsigned short port_high)
+{
+	int i;
+
+	if (n_sources == 0) {
+		source_add(INADDR_ANY, 0, 0);
+	}
+
+	for (i = 0; i < n_sources; i++) {
+		if (sources[i].port_low == 0) {
+			sources[i].port_low = port_low;
+			sources[i].port_high = port_high;
+			sources[i].next_port = port_low;
+		}
+	}
+}
+
+
+struct source *
+source_next()
+{
+	int i, n, best = -1;
+
+	if (n_sources == 0) {
+		source_init(0, 0);
+	}
+
+	for (n = 1; n <= n_sources; n++) {
+		i = (last_source + n) % n_sources;
+		if ((best == -1) || (sources[i].in_flight < sources[best].in_flight)) {
+			best = i;
+		}
+	}
+	last_source = best;
+
+	return (&sources[best]);
+}
+
+
+unsigned short
+source_next_port(struct source *source)
+{
+	unsigned short port = source->next_port;
+
+	if (port != 0) {
+		if (source->next_port >= source->port_high) {
+			source->next_port = source->port_low;
+		} else {
+			source->next_port++;
+		}
+	}
+
+	return (port);
+}
+
+
+void
+source_acquire(struct qserver *server, struct source *source)
+{
+	server->source = source;
+	source->in_flight++;
+}
+
+
+void
+source_release(struct qserver *server)
+{
+	if (server->source != NULL) {
+		server->source->in_flight--;
+		server->source = NULL;
+	}
+}
+
+
+int
+source_fixed_ports()
+{
+	int i;
+
+	for (i = 0; i < n_sources; i++) {
+		if (sources[i].port_low != 0) {
+			return (1);
+		}
+	}
+
+	return (0);
+}
+
+
+void
+source_share(int n_workers, int id)
+{
+	struct source *source;
+	unsigned int range, share;
+	int i;
+
+	for (i = 0; i < n_sources; i++) {
+		source = &sources[i];
+		if (source->port_low == 0) {
+			continue;
+		}
+
+		range = source->port_high - source->port_low + 1;
+		if (range >= (unsigned)n_workers) {
+			share = range / n_workers;
+			source->port_low += id * share;
+			source->port_high = source->port_low + share - 1;
+			source->next_port = source->port_low;
+		}
+		debug(2, "worker %d source %d ports %hu-%hu", id, i, source->port_low, source->port_high);
+	}
+}
@@ -0,0 +1,74 @@
+/*
+ * qstat
+ * by Steve Jankowski
+ *
+ * Local addresses queries are sent from
+ *
+ * Licensed under the Artistic License, see LICENSE.txt for license terms
+ */
+#ifndef QSTAT_SOURCE_H
+#define QSTAT_SOURCE_H
+
+#include "qstat.h"
+
+/**
+ * A local IP address and the ports on it sockets are bound to. A port
+ * range of 0 lets the system pick.
+ */
+struct source {
+	unsigned int ip;        /* host byte order */
+	unsigned short port_low;
+	unsigned short port_high;
+	unsigned short next_port;
+
+	/** \brief servers queried from this address right now */
+	int in_flight;
+};
+
+/**
+ * Add an address given with -srcip, ports of 0 take the -srcport range
+ */
+void source_add(unsigned int ip, unsigned short port_low, unsigned short port_high);
+
+/**
+ * Finish setting up the sources once the options are parsed
+ *
+ * Adds the any address if -srcip wasn't given and gives the -srcport
+ * range to sources without a range of their own.
+ */
+void source_init(unsigned short port_low, unsigned short port_high);
+
+/**
+ * \returns the source the next socket should be bound to, the one with
+ * the fewest servers in flight taking turns when there's a tie
+ */
+struct source *source_next();
+
+/**
+ * \returns the next port to bind to on source, or 0 for any
+ */
+unsigned short source_next_port(struct source *source);
+
+/**
+ * Count server as in flight from source until source_release
+ */
+void source_acquire(struct qserver *server, struct source *source);
+
+/**
+ * Stop counting server against its source
+ */
+void source_release(struct qserver *server);
+
+/**
+ * \returns non zero if sockets are bound to fixed ports, so a port may be
+ * bound again as soon as its last user is closed
+ */
+int source_fixed_ports();
+
+/**
+ * Keep just worker id's share of each source's port range, so workers
+ * never bind the same ports
+ */
+void source_share(int n_workers, int id);
+
+#endif
@@ -245,7 +245,7 @@ deal_with_starmade_packet(struct qserver *server, char *rawpkt, int pktlen)
 		return (ret);
 	}
 
-	gettimeofday(&server->packet_time1, NULL);
+	server->packet_time1 = qtime_now();
 
 	server->map_name = strdup("default");
 
@@ -16,6 +16,7 @@
 
 #include "debug.h"
 #include "qstat.h"
+#include "arena.h"
 #include "packet_manip.h"
 
 /* See "scripts/tw_api.py" from Teeworlds project */
@@ -126,7 +127,7 @@ deal_with_teeserver_packet(struct qserver *server, char *rawpkt, int rawpktlen)
 
 	debug(2, "deal_with_teeserver_packet %p, %d", server, rawpktlen);
 
-	server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+	server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 
 	if (rawpktlen < len_teeserver_info_headerprefix) {
 		malformed_packet(server, "packet too short");
@@ -213,7 +214,7 @@ deal_with_teeserver_packet(struct qserver *server, char *rawpkt, int rawpktlen)
 	/* players */
 	for (i = 0; i < server->num_players; i++) {
 		player = add_player(server, i);
-		player->name = strdup(current);
+		player->name = arena_strdup(&server->arena, current);
 		current += strnlen(current, end - current) + 1;
 
 		player->score = atoi(current);
@@ -372,7 +373,7 @@ deal_with_teemaster_packet(struct qserver *server, char *rawpkt, int rawpktlen)
 
 	debug(2, "deal_with_teemaster_packet %p, %d", server, rawpktlen);
 
-	server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+	server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 
 	if (rawpktlen < len_teemaster_list_headerprefix) {
 		malformed_packet(server, "packet too short");
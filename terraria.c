@@ -25,6 +25,7 @@
 
 #include "debug.h"
 #include "qstat.h"
+#include "arena.h"
 #include "packet_manip.h"
 
 query_status_t
@@ -61,7 +62,7 @@ deal_with_terraria_packet(struct qserver *server, char *rawpkt, int pktlen)
 			int pkt_max;
 			server->retry1 = n_retries;
 			if (0 == server->n_requests) {
-				server->ping_total = time_delta(&packet_recv_time, &server->packet_time1);
+				server->ping_total = time_delta(packet_recv_time, server->packet_time1);
 				server->n_requests++;
 			}
 
@@ -147,7 +148,7 @@ deal_with_terraria_packet(struct qserver *server, char *rawpkt, int pktlen)
 					if (' ' == player_name[0]) {
 						player_name++;
 					}
-					player->name = strdup(player_name);
+					player->name = arena_strdup(&server->arena, player_name);
 					debug(4, "Player: %s\n", player->name);
 				}
 				player_name = strtok_ret(NULL, ",", &playersp);
@@ -164,7 +165,7 @@ deal_with_terraria_packet(struct qserver *server, char *rawpkt, int pktlen)
 		s = strtok_ret(NULL, "\x0d\x0a", &linep);
 	}
 
-	gettimeofday(&server->packet_time1, NULL);
+	server->packet_time1 = qtime_now();
 
 	return (DONE_FORCE);
 }
@@ -201,7 +201,7 @@ deal_with_tf_packet(struct qserver *server, char *rawpkt, int pktlen)
 	pkt = rawpkt;
 
 	if (server->server_name == NULL) {
-		server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+		server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 		server->n_requests++;
 	}
 
@@ -0,0 +1,88 @@
+/*
+ * qstat
+ * by Steve Jankowski
+ *
+ * Kernel receive timestamps
+ *
+ * Licensed under the Artistic License, see LICENSE.txt for license terms
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "qstat.h"
+#include "timestamp.h"
+#include "debug.h"
+
+int kernel_timestamps = 0;
+
+
+void
+timestamp_enable(int fd)
+{
+#if defined(SO_TIMESTAMPNS) || defined(SO_TIMESTAMP)
+		int one = 1;
+
+		if (!kernel_timestamps) {
+			return;
+		}
+
+ #ifdef SO_TIMESTAMPNS
+			if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, (void *)&one, sizeof(one)) == 0) {
+				return;
+			}
+ #endif
+ #ifdef SO_TIMESTAMP
+			if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMP, (void *)&one, sizeof(one)) == 0) {
+				return;
+			}
+ #endif
+
+		// packets are still timed when they're read
+		if (show_errors) {
+			perror("Failed to enable receive timestamps");
+		}
+#endif
+}
+
+#ifndef _WIN32
+
+int
+timestamp_get(struct msghdr *msg, qtime_t *t)
+{
+	struct cmsghdr *cmsg;
+
+	if (!kernel_timestamps || (msg->msg_controllen == 0)) {
+		return (0);
+	}
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET) {
+			continue;
+		}
+ #ifdef SCM_TIMESTAMPNS
+			if ((cmsg->cmsg_type == SCM_TIMESTAMPNS) && (cmsg->cmsg_len >= CMSG_LEN(sizeof(struct timespec)))) {
+				struct timespec ts;
+
+				memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+				*t = qtime_from_wall(ts.tv_sec, ts.tv_nsec);
+				return (1);
+			}
+ #endif
+ #ifdef SCM_TIMESTAMP
+			if ((cmsg->cmsg_type == SCM_TIMESTAMP) && (cmsg->cmsg_len >= CMSG_LEN(sizeof(struct timeval)))) {
+				struct timeval tv;
+
+				memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+				*t = qtime_from_wall(tv.tv_sec, tv.tv_usec * 1000);
+				return (1);
+			}
+ #endif
+	}
+
+	return (0);
+}
+
+#endif
@@ -0,0 +1,42 @@
+/*
+ * qstat
+ * by Steve Jankowski
+ *
+ * Kernel receive timestamps
+ *
+ * Licensed under the Artistic License, see LICENSE.txt for license terms
+ */
+#ifndef QSTAT_TIMESTAMP_H
+#define QSTAT_TIMESTAMP_H
+
+#include "qstat.h"
+
+#ifndef _WIN32
+ #include <sys/socket.h>
+#endif
+
+/** \brief set by -kernelts */
+extern int kernel_timestamps;
+
+/**
+ * Room needed in a message's control data for its timestamp
+ */
+#define TIMESTAMP_CONTROL_LEN    64
+
+/**
+ * Ask the kernel to timestamp the packets fd receives, if -kernelts is set
+ */
+void timestamp_enable(int fd);
+
+#ifndef _WIN32
+
+/**
+ * Take the time msg arrived from its control data
+ *
+ * \returns 1 if t was set or 0 if msg carries no timestamp
+ */
+int timestamp_get(struct msghdr *msg, qtime_t *t);
+
+#endif
+
+#endif
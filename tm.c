@@ -20,6 +20,7 @@
 
 #include "debug.h"
 #include "qstat.h"
+#include "arena.h"
 #include "packet_manip.h"
 
 #define TM_XML_PREFIX		"<?xml version=\"1.0\"?>\n<methodCall>\n<methodName>system.multicall</methodName>\n<params><param><value><array><data>\n"
@@ -159,9 +160,9 @@ deal_with_tm_packet(struct qserver *server, char *rawpkt, int pktlen)
 
 	server->n_servers++;
 	if (server->server_name == NULL) {
-		server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+		server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 	} else {
-		gettimeofday(&server->packet_time1, NULL);
+		server->packet_time1 = qtime_now();
 	}
 
 	// Terminate the packet data
@@ -252,7 +253,7 @@ deal_with_tm_packet(struct qserver *server, char *rawpkt, int pktlen)
 					server->num_players++;
 				} else if (NULL != player) {
 					if (0 == strcmp("NickName", key)) {
-						player->name = strdup(value);
+						player->name = arena_strdup(&server->arena, value);
 					} else if (0 == strcmp("PlayerId", key)) {
 						//player->number = atoi( value );
 					} else if (0 == strcmp("TeamId", key)) {
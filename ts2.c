@@ -19,6 +19,7 @@
 
 #include "debug.h"
 #include "qstat.h"
+#include "arena.h"
 #include "packet_manip.h"
 
 query_status_t
@@ -55,7 +56,7 @@ deal_with_ts2_packet(struct qserver *server, char *rawpkt, int pktlen)
 
 	server->n_servers++;
 	server->n_requests++;
-	server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+	server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 
 	if (0 == pktlen) {
 		// Invalid password
@@ -105,7 +106,7 @@ deal_with_ts2_packet(struct qserver *server, char *rawpkt, int pktlen)
 				// Player info
 				struct player *player = add_player(server, server->n_player_info);
 				if (NULL != player) {
-					player->name = strdup(name);
+					player->name = arena_strdup(&server->arena, name);
 					player->ping = ping;
 					player->connect_time = connect_time;
 				}
@@ -124,7 +125,7 @@ deal_with_ts2_packet(struct qserver *server, char *rawpkt, int pktlen)
 		s = strtok(NULL, "\015\012");
 	}
 
-	gettimeofday(&server->packet_time1, NULL);
+	server->packet_time1 = qtime_now();
 
 	if (0 == server->saved_data.pkt_index) {
 		server->map_name = strdup("N/A");
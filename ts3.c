@@ -23,6 +23,7 @@
 
 #include "debug.h"
 #include "qstat.h"
+#include "arena.h"
 #include "utils.h"
 #include "packet_manip.h"
 
@@ -224,7 +225,7 @@ deal_with_ts3_packet(struct qserver *server, char *rawpkt, int pktlen)
 	if (!server->combined) {
 		server->retry1 = n_retries;
 		if (0 == server->n_requests) {
-			server->ping_total = time_delta(&packet_recv_time, &server->packet_time1);
+			server->ping_total = time_delta(packet_recv_time, server->packet_time1);
 			server->n_requests++;
 		}
 
@@ -383,7 +384,7 @@ deal_with_ts3_packet(struct qserver *server, char *rawpkt, int pktlen)
 					} else if ((0 == strcmp("client_type", key)) && (0 == strcmp("0", value))) {
 						struct player *player = add_player(server, server->n_player_info);
 						if (NULL != player) {
-							player->name = strdup(decode_ts3_val(player_name));
+							player->name = arena_strdup(&server->arena, decode_ts3_val(player_name));
 						}
 					} else if ((0 == strcmp("id", key)) || (0 == strcmp("msg", key))) {
 						// Ignore details from the response code
@@ -395,7 +396,7 @@ deal_with_ts3_packet(struct qserver *server, char *rawpkt, int pktlen)
 		s = strtok(NULL, "\012\015 |");
 	}
 
-	gettimeofday(&server->packet_time1, NULL);
+	server->packet_time1 = qtime_now();
 
 	server->map_name = strdup("N/A");
 	return (DONE_FORCE);
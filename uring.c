@@ -0,0 +1,864 @@
+/*
+ * qstat
+ * by Steve Jankowski
+ *
+ * io_uring network backend
+ *
+ * Every registered socket keeps a multishot recvmsg posted which takes its
+ * buffers from a ring shared by all sockets, and outgoing packets are
+ * queued as sendmsg submissions. Both are handed to the kernel by the
+ * io_uring_enter which waits for completions, so a busy loop iteration
+ * costs a single syscall however many servers are in flight.
+ *
+ * A socket still connecting gets a one shot poll for writability instead,
+ * and its receive is posted once the connect has finished.
+ *
+ * The ring's buffers are only big enough for an MTU sized datagram. A
+ * socket which gets one too big to fit, which is then lost, and a TCP
+ * stream are polled for readability instead and read by the caller into
+ * a buffer large enough for anything.
+ *
+ * Completions carry the fd and a per-fd generation so anything arriving
+ * for a socket after it's been removed, or for a new socket which reused
+ * its fd, is recognised and dropped.
+ *
+ * This talks to the kernel directly rather than through liburing and needs
+ * Linux 6.0 or later for multishot recvmsg and ring provided buffers.
+ *
+ * Licensed under the Artistic License, see LICENSE.txt for license terms
+ */
+
+#ifdef USE_IO_URING
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "qstat.h"
+#include "uring.h"
+#include "timestamp.h"
+#include "debug.h"
+
+#define URING_ENTRIES       1024
+#define URING_CQ_ENTRIES    (URING_ENTRIES * 4)
+#define URING_BUFFERS       2048        /* must be a power of 2 */
+#define URING_BUFFER_LEN    2048        /* headers and an MTU sized datagram */
+#define URING_BGID          0
+#define URING_SEND_SLOTS    1024
+
+/*
+ * user_data holds what a completion is for in the top three bits, then the
+ * fd's generation and either the fd or a send slot in the low 32 bits.
+ */
+#define UD_RECV                     1ULL
+#define UD_SEND                     2ULL
+#define UD_CANCEL                   3ULL
+#define UD_POLL                     4ULL
+#define UD_MAKE(kind, gen, index)    (((kind) << 61) | ((unsigned long long)((gen) & 0x1fffffff) << 32) | (unsigned)(index))
+#define UD_KIND(ud)                  ((ud) >> 61)
+#define UD_GEN(ud)                   ((unsigned)((ud) >> 32) & 0x1fffffff)
+#define UD_INDEX(ud)                 ((unsigned)(ud))
+
+struct uring_fd {
+	unsigned gen;
+	unsigned batch;         /* submit batch of its last queued submission */
+	char registered;
+	char armed;
+	char connecting;        /* polled for writability rather than read */
+	char large;             /* polled for reading, its packets don't fit */
+};
+
+struct send_slot {
+	int fd;
+	unsigned gen;
+	struct msghdr msg;
+	struct iovec iov;
+	struct sockaddr_in addr;
+	char *data;
+	size_t size;
+	int next_free;
+};
+
+static int ring_fd = -1;
+static void *sq_ring;
+static size_t sq_ring_size;
+static void *cq_ring;
+static size_t cq_ring_size;
+static struct io_uring_sqe *sqes;
+static size_t sqes_size;
+static unsigned sq_entries;
+static unsigned *sq_head;
+static unsigned *sq_tail;
+static unsigned *sq_mask;
+static unsigned *sq_array;
+static unsigned sq_local_tail;
+static unsigned *cq_head;
+static unsigned *cq_tail;
+static unsigned *cq_mask;
+static struct io_uring_cqe *cqes;
+
+static struct io_uring_buf_ring *buf_ring;
+static size_t buf_ring_size;
+static char *buf_data;
+static size_t buf_len;
+static unsigned short buf_tail;
+
+static struct uring_fd *fds;
+static int max_fds;
+static unsigned batch = 1;
+
+static int *rearm;
+static int n_rearm;
+static int max_rearm;
+
+static struct send_slot *slots;
+static int free_slot = -1;
+
+// only the name and timestamp are kept, the kernel copies this when each
+// receive is posted
+static struct msghdr recv_msg;
+
+
+static int
+ring_enter(unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz)
+{
+	return (syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, arg, argsz));
+}
+
+
+/*
+ * Pass everything queued to the kernel, waiting for min_complete
+ * completions or ms to pass if min_complete is non zero.
+ */
+static int
+ring_submit(unsigned min_complete, int ms)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned to_submit, flags = 0;
+
+	__atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+	to_submit = sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+	if (!to_submit && !min_complete) {
+		return (0);
+	}
+
+	// anything queued for a socket from now on is in the next batch
+	batch++;
+
+	if (to_submit) {
+		// sends queued since the last submit go out now
+		qserver_stamp_sends();
+	}
+
+	if (!min_complete) {
+		return (ring_enter(to_submit, 0, 0, NULL, 0));
+	}
+
+	memset(&arg, 0, sizeof(arg));
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000;
+	arg.ts = (unsigned long)&ts;
+	flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+
+	return (ring_enter(to_submit, min_complete, flags, &arg, sizeof(arg)));
+}
+
+
+static struct io_uring_sqe *
+get_sqe()
+{
+	struct io_uring_sqe *sqe;
+	unsigned index;
+
+	if (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) {
+		ring_submit(0, 0);
+		if (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) {
+			return (NULL);
+		}
+	}
+
+	index = sq_local_tail & *sq_mask;
+	sq_array[index] = index;
+	sq_local_tail++;
+
+	sqe = &sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+
+	return (sqe);
+}
+
+
+static void
+buf_add(int bid)
+{
+	struct io_uring_buf *buf = &buf_ring->bufs[buf_tail & (URING_BUFFERS - 1)];
+
+	// bufs[0] overlaps the ring's tail so only its own fields are set,
+	// a byte is held back so packets can be terminated in place
+	buf->addr = (unsigned long)(buf_data + bid * buf_len);
+	buf->len = buf_len - 1;
+	buf->bid = bid;
+	buf_tail++;
+	__atomic_store_n(&buf_ring->tail, buf_tail, __ATOMIC_RELEASE);
+}
+
+
+static int
+ensure_fd(int fd)
+{
+	struct uring_fd *new_fds;
+	int new_max;
+
+	if (fd < max_fds) {
+		return (0);
+	}
+
+	new_max = fd + 32;
+	new_fds = (struct uring_fd *)realloc(fds, new_max * sizeof(struct uring_fd));
+	if (new_fds == NULL) {
+		return (-1);
+	}
+	memset(&new_fds[max_fds], 0, (new_max - max_fds) * sizeof(struct uring_fd));
+	fds = new_fds;
+	max_fds = new_max;
+
+	return (0);
+}
+
+
+static void
+add_rearm(int fd)
+{
+	if (n_rearm == max_rearm) {
+		int *new_rearm;
+		max_rearm = max_rearm ? max_rearm * 2 : 64;
+		new_rearm = (int *)realloc(rearm, max_rearm * sizeof(int));
+		if (new_rearm == NULL) {
+			max_rearm = n_rearm;
+			return;
+		}
+		rearm = new_rearm;
+	}
+	rearm[n_rearm++] = fd;
+}
+
+
+static void
+arm_recv(int fd)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = get_sqe();
+	if (sqe == NULL) {
+		// try again when there's room
+		add_rearm(fd);
+		return;
+	}
+
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long)&recv_msg;
+	sqe->len = 1;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BGID;
+	sqe->user_data = UD_MAKE(UD_RECV, fds[fd].gen, fd);
+
+	fds[fd].armed = 1;
+	fds[fd].batch = batch;
+}
+
+
+static void
+arm_poll(int fd)
+{
+	struct io_uring_sqe *sqe;
+	unsigned events = fds[fd].connecting ? POLLOUT : POLLIN;
+
+	sqe = get_sqe();
+	if (sqe == NULL) {
+		// try again when there's room
+		add_rearm(fd);
+		return;
+	}
+
+#if __BYTE_ORDER == __BIG_ENDIAN
+		// the kernel swaps the halves back
+		events = (events << 16) | (events >> 16);
+#endif
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = events;
+	sqe->user_data = UD_MAKE(UD_POLL, fds[fd].gen, fd);
+
+	fds[fd].armed = 1;
+	fds[fd].batch = batch;
+}
+
+
+/*
+ * Repost the receives which finished while their socket was still
+ * registered, which happens on errors or when the buffers ran out, and
+ * any polls there wasn't room for.
+ */
+static void
+rearm_fds()
+{
+	int i, n = n_rearm;
+
+	n_rearm = 0;
+	for (i = 0; i < n; i++) {
+		int fd = rearm[i];
+		if (fds[fd].registered && !fds[fd].armed) {
+			if (fds[fd].connecting || fds[fd].large) {
+				arm_poll(fd);
+			} else {
+				arm_recv(fd);
+			}
+		}
+	}
+}
+
+
+/*
+ * Stop fd's multishot receive, the last completion for it rearms fd
+ *
+ * \returns 0 on success or -1 if there's no room to queue the cancel
+ */
+static int
+cancel_recv(int fd)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = get_sqe();
+	if (sqe == NULL) {
+		return (-1);
+	}
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->addr = UD_MAKE(UD_RECV, fds[fd].gen, fd);
+	sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+	sqe->user_data = UD_MAKE(UD_CANCEL, 0, 0);
+
+	return (0);
+}
+
+
+static int
+setup_ring()
+{
+	struct io_uring_params params;
+	int single_mmap;
+
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+	params.cq_entries = URING_CQ_ENTRIES;
+	ring_fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+	if ((ring_fd == -1) && (errno == EINVAL)) {
+		// the optional flags are newer than the rest of what's needed
+		memset(&params, 0, sizeof(params));
+		params.flags = IORING_SETUP_CQSIZE;
+		params.cq_entries = URING_CQ_ENTRIES;
+		ring_fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+	}
+	if (ring_fd == -1) {
+		perror("io_uring_setup");
+		return (-1);
+	}
+
+	sq_entries = params.sq_entries;
+	sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+	if (single_mmap) {
+		if (cq_ring_size > sq_ring_size) {
+			sq_ring_size = cq_ring_size;
+		}
+		cq_ring_size = sq_ring_size;
+	}
+
+	sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+	if (sq_ring == MAP_FAILED) {
+		sq_ring = NULL;
+		perror("io_uring mmap");
+		return (-1);
+	}
+
+	if (single_mmap) {
+		cq_ring = sq_ring;
+	} else {
+		cq_ring = mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+		if (cq_ring == MAP_FAILED) {
+			cq_ring = NULL;
+			perror("io_uring mmap");
+			return (-1);
+		}
+	}
+
+	sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	sqes = (struct io_uring_sqe *)mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED) {
+		sqes = NULL;
+		perror("io_uring mmap");
+		return (-1);
+	}
+
+	sq_head = (unsigned *)((char *)sq_ring + params.sq_off.head);
+	sq_tail = (unsigned *)((char *)sq_ring + params.sq_off.tail);
+	sq_mask = (unsigned *)((char *)sq_ring + params.sq_off.ring_mask);
+	sq_array = (unsigned *)((char *)sq_ring + params.sq_off.array);
+	sq_local_tail = *sq_tail;
+	cq_head = (unsigned *)((char *)cq_ring + params.cq_off.head);
+	cq_tail = (unsigned *)((char *)cq_ring + params.cq_off.tail);
+	cq_mask = (unsigned *)((char *)cq_ring + params.cq_off.ring_mask);
+	cqes = (struct io_uring_cqe *)((char *)cq_ring + params.cq_off.cqes);
+
+	return (0);
+}
+
+
+static int
+setup_buffers()
+{
+	struct io_uring_buf_reg reg;
+	int i;
+
+	// the recvmsg header, address and timestamp come ahead of the packet
+	buf_len = URING_BUFFER_LEN;
+	buf_data = (char *)malloc(URING_BUFFERS * buf_len);
+	if (buf_data == NULL) {
+		perror("malloc");
+		return (-1);
+	}
+
+	buf_ring_size = URING_BUFFERS * sizeof(struct io_uring_buf);
+	buf_ring = (struct io_uring_buf_ring *)mmap(NULL, buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buf_ring == MAP_FAILED) {
+		buf_ring = NULL;
+		perror("mmap");
+		return (-1);
+	}
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (unsigned long)buf_ring;
+	reg.ring_entries = URING_BUFFERS;
+	reg.bgid = URING_BGID;
+	if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+		perror("io_uring_register");
+		return (-1);
+	}
+
+	buf_tail = 0;
+	for (i = 0; i < URING_BUFFERS; i++) {
+		buf_add(i);
+	}
+
+	return (0);
+}
+
+
+int
+uring_init(void)
+{
+	int i;
+
+	if (ring_fd != -1) {
+		return (0);
+	}
+
+	if ((setup_ring() == -1) || (setup_buffers() == -1)) {
+		uring_close();
+		return (-1);
+	}
+
+	slots = (struct send_slot *)calloc(URING_SEND_SLOTS, sizeof(struct send_slot));
+	if (slots == NULL) {
+		perror("calloc");
+		uring_close();
+		return (-1);
+	}
+	for (i = 0; i < URING_SEND_SLOTS; i++) {
+		slots[i].next_free = i + 1;
+	}
+	slots[URING_SEND_SLOTS - 1].next_free = -1;
+	free_slot = 0;
+
+	memset(&recv_msg, 0, sizeof(recv_msg));
+	recv_msg.msg_namelen = sizeof(struct sockaddr_in);
+	if (kernel_timestamps) {
+		recv_msg.msg_controllen = TIMESTAMP_CONTROL_LEN;
+	}
+
+	return (0);
+}
+
+
+void
+uring_close(void)
+{
+	int i;
+
+	if (ring_fd != -1) {
+		close(ring_fd);
+		ring_fd = -1;
+	}
+	if (sqes != NULL) {
+		munmap(sqes, sqes_size);
+		sqes = NULL;
+	}
+	if ((cq_ring != NULL) && (cq_ring != sq_ring)) {
+		munmap(cq_ring, cq_ring_size);
+	}
+	cq_ring = NULL;
+	if (sq_ring != NULL) {
+		munmap(sq_ring, sq_ring_size);
+		sq_ring = NULL;
+	}
+	if (buf_ring != NULL) {
+		munmap(buf_ring, buf_ring_size);
+		buf_ring = NULL;
+	}
+	free(buf_data);
+	buf_data = NULL;
+
+	if (slots != NULL) {
+		for (i = 0; i < URING_SEND_SLOTS; i++) {
+			free(slots[i].data);
+		}
+		free(slots);
+		slots = NULL;
+	}
+	free_slot = -1;
+
+	free(fds);
+	fds = NULL;
+	max_fds = 0;
+	free(rearm);
+	rearm = NULL;
+	n_rearm = max_rearm = 0;
+}
+
+
+void
+uring_add(int fd)
+{
+	int type = SOCK_DGRAM;
+	socklen_t len = sizeof(type);
+
+	if ((ring_fd == -1) || (ensure_fd(fd) == -1)) {
+		return;
+	}
+
+	fds[fd].gen++;
+	fds[fd].registered = 1;
+	fds[fd].armed = 0;
+	fds[fd].connecting = 0;
+
+	// a stream would be split up into buffer sized pieces
+	getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len);
+	fds[fd].large = (type == SOCK_STREAM);
+	if (fds[fd].large) {
+		arm_poll(fd);
+	} else {
+		arm_recv(fd);
+	}
+}
+
+
+void
+uring_add_connect(int fd)
+{
+	if ((ring_fd == -1) || (ensure_fd(fd) == -1)) {
+		return;
+	}
+
+	fds[fd].gen++;
+	fds[fd].registered = 1;
+	fds[fd].armed = 0;
+	fds[fd].connecting = 1;
+	fds[fd].large = 0;
+	arm_poll(fd);
+}
+
+
+void
+uring_remove(int fd)
+{
+	struct io_uring_sqe *sqe;
+
+	if ((ring_fd == -1) || (fd >= max_fds) || !fds[fd].registered) {
+		return;
+	}
+
+	if (fds[fd].armed) {
+		sqe = get_sqe();
+		if (sqe != NULL) {
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->addr = UD_MAKE((fds[fd].connecting || fds[fd].large) ? UD_POLL : UD_RECV, fds[fd].gen, fd);
+			sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+			sqe->user_data = UD_MAKE(UD_CANCEL, 0, 0);
+		}
+	}
+
+	// the generation moves on so whatever is still to come is dropped
+	fds[fd].registered = 0;
+	fds[fd].armed = 0;
+	fds[fd].connecting = 0;
+	fds[fd].large = 0;
+	fds[fd].gen++;
+
+	// Queued submissions name the fd not the socket so they must reach
+	// the kernel before it's closed and the number reused
+	if (fds[fd].batch == batch) {
+		ring_submit(0, 0);
+	}
+}
+
+
+int
+uring_send(int fd, const char *data, size_t len, const struct sockaddr_in *addr)
+{
+	struct io_uring_sqe *sqe;
+	struct send_slot *slot;
+	int index;
+
+	if ((ring_fd == -1) || (free_slot == -1) || (ensure_fd(fd) == -1)) {
+		goto send_now;
+	}
+
+	index = free_slot;
+	slot = &slots[index];
+	if (slot->size < len) {
+		char *new_data = (char *)realloc(slot->data, len);
+		if (new_data == NULL) {
+			goto send_now;
+		}
+		slot->data = new_data;
+		slot->size = len;
+	}
+
+	sqe = get_sqe();
+	if (sqe == NULL) {
+		goto send_now;
+	}
+	free_slot = slot->next_free;
+
+	memcpy(slot->data, data, len);
+	slot->iov.iov_base = slot->data;
+	slot->iov.iov_len = len;
+	memset(&slot->msg, 0, sizeof(slot->msg));
+	if (addr != NULL) {
+		slot->addr = *addr;
+		slot->msg.msg_name = &slot->addr;
+		slot->msg.msg_namelen = sizeof(slot->addr);
+	}
+	slot->msg.msg_iov = &slot->iov;
+	slot->msg.msg_iovlen = 1;
+	slot->fd = fd;
+	slot->gen = fds[fd].gen;
+
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long)&slot->msg;
+	sqe->len = 1;
+	sqe->user_data = UD_MAKE(UD_SEND, 0, index);
+	fds[fd].batch = batch;
+
+	return ((int)len);
+
+send_now:
+	if (addr != NULL) {
+		return (sendto(fd, data, len, 0, (struct sockaddr *)addr, sizeof(*addr)));
+	}
+
+	return (send(fd, data, len, 0));
+}
+
+
+int
+uring_submit(void)
+{
+	if (ring_fd == -1) {
+		return (0);
+	}
+
+	rearm_fds();
+
+	return (ring_submit(0, 0));
+}
+
+
+int
+uring_wait(int ms)
+{
+	int rc;
+
+	if (ring_fd == -1) {
+		errno = EBADF;
+		return (SOCKET_ERROR);
+	}
+
+	rearm_fds();
+
+	rc = ring_submit(1, ms);
+	if ((rc == -1) && (errno != ETIME) && (errno != EBUSY)) {
+		// EBUSY means completions are backed up, which reaping fixes
+		return (SOCKET_ERROR);
+	}
+
+	return (__atomic_load_n(cq_tail, __ATOMIC_ACQUIRE) - *cq_head);
+}
+
+
+int
+uring_next_event(struct uring_event *event)
+{
+	struct io_uring_cqe *cqe;
+	struct io_uring_recvmsg_out *out;
+	struct send_slot *slot;
+	struct msghdr control;
+	unsigned long long ud;
+	unsigned head, gen, cflags;
+	int res, fd, bid, current;
+	char *buf;
+
+	if (ring_fd == -1) {
+		return (0);
+	}
+
+	while ((head = *cq_head) != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+		cqe = &cqes[head & *cq_mask];
+		ud = cqe->user_data;
+		res = cqe->res;
+		cflags = cqe->flags;
+		__atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+
+		switch (UD_KIND(ud)) {
+		case UD_SEND:
+			slot = &slots[UD_INDEX(ud)];
+			fd = slot->fd;
+			gen = slot->gen;
+			slot->next_free = free_slot;
+			free_slot = UD_INDEX(ud);
+
+			// errors like a refused port are reported against the server
+			if ((res >= 0) || (fd >= max_fds) || !fds[fd].registered || (fds[fd].gen != gen)) {
+				continue;
+			}
+			event->fd = fd;
+			event->res = res;
+			event->data = NULL;
+			event->bid = -1;
+			event->stamped = 0;
+			event->readable = 0;
+			return (1);
+
+		case UD_RECV:
+			fd = UD_INDEX(ud);
+			bid = (cflags & IORING_CQE_F_BUFFER) ? (int)(cflags >> IORING_CQE_BUFFER_SHIFT) : -1;
+			current = (fd < max_fds) && fds[fd].registered && (fds[fd].gen == UD_GEN(ud));
+
+			if (current && !(cflags & IORING_CQE_F_MORE)) {
+				fds[fd].armed = 0;
+				add_rearm(fd);
+			}
+
+			if (!current || (res == -ENOBUFS) || (res == -ECANCELED)) {
+				if (bid != -1) {
+					buf_add(bid);
+				}
+				continue;
+			}
+
+			event->fd = fd;
+			event->res = res;
+			event->data = NULL;
+			event->bid = bid;
+			event->stamped = 0;
+			event->readable = 0;
+			memset(&event->addr, 0, sizeof(event->addr));
+			if ((res >= 0) && (bid != -1)) {
+				buf = buf_data + bid * buf_len;
+				out = (struct io_uring_recvmsg_out *)buf;
+				if (out->flags & MSG_TRUNC) {
+					// the rest is lost, so have the caller read
+					// the socket's packets from now on
+					buf_add(bid);
+					if (!fds[fd].large && (cancel_recv(fd) == 0)) {
+						fds[fd].large = 1;
+					}
+					event->bid = -1;
+					event->res = -EMSGSIZE;
+					return (1);
+				}
+				if (out->namelen > 0) {
+					memcpy(&event->addr, buf + sizeof(*out), (out->namelen < sizeof(event->addr)) ? out->namelen : sizeof(event->addr));
+				}
+				if (out->controllen > 0) {
+					memset(&control, 0, sizeof(control));
+					control.msg_control = buf + sizeof(*out) + recv_msg.msg_namelen;
+					control.msg_controllen = out->controllen;
+					event->stamped = timestamp_get(&control, &event->stamp);
+				}
+				event->data = buf + sizeof(*out) + recv_msg.msg_namelen + recv_msg.msg_controllen;
+				event->res = out->payloadlen;
+				if (event->res > (int)(res - (event->data - buf))) {
+					event->res = (int)(res - (event->data - buf));
+				}
+			} else if (res >= 0) {
+				// end of stream
+				event->res = 0;
+			}
+			return (1);
+
+		case UD_POLL:
+			fd = UD_INDEX(ud);
+			if ((fd >= max_fds) || !fds[fd].registered || (fds[fd].gen != UD_GEN(ud)) || (res == -ECANCELED)) {
+				continue;
+			}
+
+			// one shot, the socket is read from once it's connected
+			// or polled again once it's been read
+			fds[fd].armed = 0;
+			event->readable = fds[fd].large && !fds[fd].connecting && (res > 0);
+			if (event->readable) {
+				add_rearm(fd);
+			}
+			fds[fd].connecting = 0;
+
+			event->fd = fd;
+			event->res = res;
+			event->data = NULL;
+			event->bid = -1;
+			event->stamped = 0;
+			return (1);
+
+		default:
+			if (res < 0) {
+				debug(3, "io_uring cancel: %s", strerror(-res));
+			}
+			continue;
+		}
+	}
+
+	return (0);
+}
+
+
+void
+uring_release_buffer(int bid)
+{
+	buf_add(bid);
+}
+
+
+#endif  /* USE_IO_URING */
@@ -0,0 +1,106 @@
+/*
+ * qstat
+ * by Steve Jankowski
+ *
+ * io_uring network backend
+ *
+ * Licensed under the Artistic License, see LICENSE.txt for license terms
+ */
+#ifndef QSTAT_URING_H
+#define QSTAT_URING_H
+
+#ifdef USE_IO_URING
+
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#include "qtime.h"
+
+/**
+ * A completion for a registered socket, either a received packet or the
+ * error from a receive or send on it.
+ *
+ * Packets too big for the ring's buffers can't be received into them, so
+ * once a socket has had one, or if it's a stream, events instead say the
+ * socket is readable. A datagram which was cut short is reported as an
+ * EMSGSIZE error.
+ */
+struct uring_event {
+	int fd;
+	int res;                /* packet length or -errno */
+	char *data;             /* packet data, valid until its buffer is released */
+	struct sockaddr_in addr;
+	int bid;                /* provided buffer holding data, -1 if none */
+	int stamped;            /* set if the kernel timestamped the packet */
+	qtime_t stamp;
+	int readable;           /* no data, the caller must read the socket */
+};
+
+/**
+ * Set up the ring if it isn't already
+ *
+ * \returns 0 on success or -1 if io_uring isn't usable
+ */
+int uring_init(void);
+
+/**
+ * Tear the ring down, cancelling everything still outstanding
+ */
+void uring_close(void);
+
+/**
+ * Post a multishot receive on fd
+ */
+void uring_add(int fd);
+
+/**
+ * Wait for fd to become writable, as it does when its connect finishes
+ *
+ * That's reported as an event with no data, uring_add starts receiving.
+ */
+void uring_add_connect(int fd);
+
+/**
+ * Cancel fd's receive or poll, completions still to come for it are dropped
+ */
+void uring_remove(int fd);
+
+/**
+ * Queue a packet for fd, to addr if it's not NULL
+ *
+ * The data is copied so may be reused straight away. If it can't be
+ * queued the packet is sent immediately instead.
+ *
+ * \returns len or SOCKET_ERROR
+ */
+int uring_send(int fd, const char *data, size_t len, const struct sockaddr_in *addr);
+
+/**
+ * Pass queued submissions to the kernel without waiting
+ */
+int uring_submit(void);
+
+/**
+ * Submit anything queued and wait up to ms for a completion
+ *
+ * \returns the number of completions ready or SOCKET_ERROR
+ */
+int uring_wait(int ms);
+
+/**
+ * Take the next completion for a registered socket
+ *
+ * Stale completions and successful sends are consumed along the way.
+ *
+ * \returns 1 if event was filled in or 0 if there are none left
+ */
+int uring_next_event(struct uring_event *event);
+
+/**
+ * Hand a receive buffer from an event back to the kernel
+ */
+void uring_release_buffer(int bid);
+
+#endif  /* USE_IO_URING */
+
+#endif
@@ -415,7 +415,7 @@ deal_with_ut2004master_packet(struct qserver *server, char *rawpkt, int pktlen)
 		goto cleanup_out;
 	}
 
-	server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+	server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 
 	switch (*state) {
 	case STATE_CHALLENGE:
@@ -27,6 +27,7 @@
 
 #include "debug.h"
 #include "qstat.h"
+#include "arena.h"
 #include "packet_manip.h"
 
 int VENTRILO_COMMAND_GENERIC_INFO = 1;
@@ -269,7 +270,7 @@ send_ventrilo_request_packet(struct qserver *server)
 	int size = buildVentriloRequest((unsigned char *)buf, VENTRILO_COMMAND_DETAILED_INFO, password, server->challenge);
 
 	server->n_requests++;
-	gettimeofday(&server->packet_time1, NULL);
+	server->packet_time1 = qtime_now();
 
 	debug(2, "send status request");
 
@@ -309,7 +310,7 @@ deal_with_ventrilo_packet(struct qserver *server, char *rawpkt, int pktlen)
 
 	debug(4, "combined ventrilo packet: %s", rawpkt);
 
-	server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+	server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 
 	line = strtok_ret(rawpkt, "\n", &last_line);
 	debug(3, "processing detailed response...");
@@ -330,7 +331,7 @@ deal_with_ventrilo_packet(struct qserver *server, char *rawpkt, int pktlen)
 			while (NULL != player_info) {
 				debug(5, "player info: %s", player_info);
 				if (0 == strncmp(player_info, "NAME=", 5)) {
-					player->name = strdup(player_info + 5);
+					player->name = arena_strdup(&server->arena, player_info + 5);
 				} else if (strncmp(player_info, "PING=", 5)) {
 					player->ping = atoi(player_info + 5);
 				} else if (0 == strncmp(player_info, "CID=", 4)) {
@@ -19,6 +19,7 @@
 
 #include "debug.h"
 #include "qstat.h"
+#include "arena.h"
 #include "packet_manip.h"
 
 query_status_t
@@ -52,9 +53,9 @@ deal_with_wic_packet(struct qserver *server, char *rawpkt, int pktlen)
 	int mode = server->n_servers, slot, score;
 	char name[256], role[256];
 
-	debug(2, "processing n_requests %d, retry1 %d, n_retries %d, delta %d", server->n_requests, server->retry1, n_retries, time_delta(&packet_recv_time, &server->packet_time1));
+	debug(2, "processing n_requests %d, retry1 %d, n_retries %d, delta %d", server->n_requests, server->retry1, n_retries, time_delta(packet_recv_time, server->packet_time1));
 
-	server->ping_total += time_delta(&packet_recv_time, &server->packet_time1);
+	server->ping_total += time_delta(packet_recv_time, server->packet_time1);
 	server->n_requests++;
 
 	if (0 == pktlen) {
@@ -62,7 +63,7 @@ deal_with_wic_packet(struct qserver *server, char *rawpkt, int pktlen)
 		return (REQ_ERROR);
 	}
 
-	gettimeofday(&server->packet_time1, NULL);
+	server->packet_time1 = qtime_now();
 
 	rawpkt[pktlen] = '\0';
 	end = &rawpkt[pktlen];
@@ -113,10 +114,10 @@ deal_with_wic_packet(struct qserver *server, char *rawpkt, int pktlen)
 				struct player *player = add_player(server, server->n_player_info);
 				if (NULL != player) {
 					player->flags |= PLAYER_FLAG_DO_NOT_FREE_TEAM;
-					player->name = strdup(name);
+					player->name = arena_strdup(&server->arena, name);
 					player->score = score;
 					player->team_name = team;
-					player->tribe_tag = strdup(role);
+					player->tribe_tag = arena_strdup(&server->arena, role);
 					// Indicate if its a bot
 					player->type_flag = (0 == strcmp(name, "Computer: Balanced")) ? 1 : 0;
 				}
@@ -126,7 +127,7 @@ deal_with_wic_packet(struct qserver *server, char *rawpkt, int pktlen)
 				struct player *player = add_player(server, server->n_player_info);
 				if (NULL != player) {
 					player->flags |= PLAYER_FLAG_DO_NOT_FREE_TEAM;
-					player->name = strdup(name);
+					player->name = arena_strdup(&server->arena, name);
 					player->score = score;
 					player->team_name = team;
 					// Indicate if its a bot
@@ -0,0 +1,564 @@
+/*
+ * qstat
+ * by Steve Jankowski
+ *
+ * Worker processes
+ *
+ * Every part of a query works on process wide state, so rather than
+ * threads the servers are split between forked worker processes each
+ * running its own copy of the main loop. A worker renders each server as
+ * it completes and sends the output down a pipe, the parent writes it out
+ * between the header and footer so the document stays well formed.
+ *
+ * Licensed under the Artistic License, see LICENSE.txt for license terms
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "qstat.h"
+#include "ratelimit.h"
+#include "source.h"
+#include "worker.h"
+#include "delta.h"
+#include "debug.h"
+#include "intern.h"
+
+#ifndef _WIN32
+ #include <unistd.h>
+ #include <signal.h>
+ #include <poll.h>
+ #include <sys/wait.h>
+ #include <netinet/in.h>
+#endif
+
+extern FILE *OF;        /* output file */
+extern struct qserver *servers;
+extern struct qserver *last_server_bind;
+extern int max_simultaneous;
+extern int server_sort;
+extern int progress;
+extern int masters_only;
+extern int json_display;
+extern int json_printed;
+extern int num_servers_total;
+extern int num_servers_returned;
+extern int num_servers_timed_out;
+extern int num_servers_down;
+extern int num_players_total;
+extern int max_players_total;
+
+void do_work(void);
+void display_progress();
+void free_server(struct qserver *server);
+void free_socket_pools();
+void reset_file_descriptors();
+server_type *find_server_type_id(int type_id);
+
+int n_workers = 1;
+int worker_id = -1;
+
+/*
+ * Sent from a worker for each completed server, followed by game_len
+ * bytes of game name and output_len bytes of rendered output. The counts
+ * are the change in the totals since the previous result.
+ */
+struct worker_result {
+	int index;              /* worker_index or one of the values below */
+	int type_id;
+	unsigned int ipaddr;
+	unsigned short port;
+	int ping_total;
+	int n_requests;
+	int num_players;
+	int max_players;
+	unsigned long long fingerprint; /* for -delta, output is empty if unchanged */
+
+	int returned;
+	int timed_out;
+	int down;
+	int players_total;
+	int max_players_total;
+
+	int game_len;
+	int output_len;
+};
+
+#define WORKER_NEW_SERVER    -1 /* a server the worker added itself */
+#define WORKER_COUNTS        -2 /* only updates the totals */
+
+#ifndef _WIN32
+
+	struct worker {
+		pid_t pid;
+		int fd;
+		char *buf;
+		size_t len;
+		size_t size;
+	};
+
+	static int worker_fd = -1;
+	static struct qserver **pending;
+	static char *completed;
+	static int n_pending;
+
+
+	static void
+	worker_counts(struct worker_result *result)
+	{
+		static int returned, timed_out, down, players_total, max_players;
+
+		result->returned = num_servers_returned - returned;
+		result->timed_out = num_servers_timed_out - timed_out;
+		result->down = num_servers_down - down;
+		result->players_total = num_players_total - players_total;
+		result->max_players_total = max_players_total - max_players;
+
+		returned = num_servers_returned;
+		timed_out = num_servers_timed_out;
+		down = num_servers_down;
+		players_total = num_players_total;
+		max_players = max_players_total;
+	}
+
+
+	static int
+	write_all(int fd, const char *data, size_t len)
+	{
+		ssize_t rc;
+
+		while (len) {
+			rc = write(fd, data, len);
+			if (rc == -1) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return (-1);
+			}
+			data += rc;
+			len -= rc;
+		}
+
+		return (0);
+	}
+
+
+	static void
+	worker_send(struct worker_result *result, const char *game, const char *output)
+	{
+		if ((write_all(worker_fd, (char *)result, sizeof(*result)) == -1) ||
+		    (write_all(worker_fd, game, result->game_len) == -1) ||
+		    (write_all(worker_fd, output, result->output_len) == -1)) {
+			// the parent has gone so there's no one to report to
+			_exit(1);
+		}
+	}
+
+
+	void
+	worker_send_server(struct qserver *server)
+	{
+		struct worker_result result;
+		FILE *saved_of = OF;
+		char *output = NULL;
+		size_t output_len = 0;
+		unsigned long long fingerprint = delta_fingerprint(server);
+
+		// compared with the state inherited from the parent, which
+		// records it for the next run
+		if (delta_record(server->type, server->arg, fingerprint)) {
+			OF = open_memstream(&output, &output_len);
+			if (OF == NULL) {
+				perror("open_memstream");
+				OF = saved_of;
+				return;
+			}
+
+			// the parent adds the separators between JSON servers
+			json_printed = 0;
+			output_server(server);
+			fclose(OF);
+			OF = saved_of;
+		}
+
+		memset(&result, 0, sizeof(result));
+		result.index = (server->worker_index != -1) ? server->worker_index : WORKER_NEW_SERVER;
+		result.type_id = server->type->id;
+		result.ipaddr = server->ipaddr;
+		result.port = server->port;
+		result.ping_total = server->ping_total;
+		result.n_requests = server->n_requests;
+		result.num_players = server->num_players;
+		result.max_players = server->max_players;
+		result.fingerprint = fingerprint;
+		result.game_len = server->game ? strlen(server->game) : 0;
+		result.output_len = output_len;
+		worker_counts(&result);
+
+		worker_send(&result, server->game, output);
+		free(output);
+	}
+
+
+	static void
+	write_output(const char *output, size_t len)
+	{
+		if (len == 0) {
+			return;
+		}
+
+		if (json_display) {
+			if (json_printed) {
+				fputs(",\n", OF);
+			}
+			json_printed = 1;
+		}
+
+		fwrite(output, 1, len, OF);
+	}
+
+
+	void
+	worker_write_output(struct qserver *server)
+	{
+		write_output(server->worker_output, server->worker_output_len);
+	}
+
+
+	static void
+	worker_main(int id, int fd)
+	{
+		struct worker_result result;
+		struct qserver *server, *next_server;
+
+		worker_id = id;
+		worker_fd = fd;
+
+		// the parent has already counted the servers it queried itself
+		worker_counts(&result);
+
+		// keep just this worker's share of the servers still to query
+		for (server = servers; server != NULL; server = next_server) {
+			next_server = server->next;
+			if ((server->worker_index != -1) && ((server->worker_index % n_workers) != id)) {
+				free_server(server);
+			}
+		}
+		last_server_bind = NULL;
+
+		// limits given on the command line are for qstat as a whole
+		max_simultaneous = (max_simultaneous + n_workers - 1) / n_workers;
+
+		ratelimit_share(n_workers);
+
+		source_share(n_workers, id);
+
+		// results go to the parent as they complete, it sorts and shows progress
+		server_sort = 0;
+		progress = 0;
+
+		do_work();
+
+		memset(&result, 0, sizeof(result));
+		result.index = WORKER_COUNTS;
+		worker_counts(&result);
+		worker_send(&result, NULL, NULL);
+
+		close(fd);
+		_exit(0);
+	}
+
+
+	static void
+	handle_result(struct worker_result *result, char *game, char *output)
+	{
+		struct qserver *server = NULL;
+		server_type *type;
+		unsigned int ipaddr;
+		char arg[36];
+
+		num_servers_returned += result->returned;
+		num_servers_timed_out += result->timed_out;
+		num_servers_down += result->down;
+		num_players_total += result->players_total;
+		max_players_total += result->max_players_total;
+
+		if (result->index == WORKER_COUNTS) {
+			return;
+		}
+
+		if ((result->index >= 0) && (result->index < n_pending)) {
+			server = pending[result->index];
+			completed[result->index] = 1;
+			delta_record(server->type, server->arg, result->fingerprint);
+		} else {
+			type = find_server_type_id(result->type_id);
+			if (type != NULL) {
+				// named as add_qserver_byaddr names it
+				ipaddr = ntohl(result->ipaddr);
+				sprintf(arg, "%d.%d.%d.%d:%hu", ipaddr >> 24, (ipaddr >> 16) & 0xff, (ipaddr >> 8) & 0xff, ipaddr & 0xff, result->port);
+				delta_record(type, arg, result->fingerprint);
+				if (server_sort) {
+					server = add_qserver_byaddr(ipaddr, result->port, type, NULL);
+				}
+			}
+			if (server == NULL) {
+				num_servers_total++;
+			}
+		}
+
+		if (!server_sort || (server == NULL)) {
+			write_output(output, result->output_len);
+			if (server != NULL) {
+				free_server(server);
+			}
+			return;
+		}
+
+		// keep what's needed to sort it and write it out in finish_output
+		server->ping_total = result->ping_total;
+		server->n_requests = result->n_requests;
+		server->num_players = result->num_players;
+		server->max_players = result->max_players;
+		if (result->game_len) {
+			if ((server->game = intern_n(game, result->game_len)) != NULL) {
+				server->flags |= FLAG_DO_NOT_FREE_GAME;
+			} else {
+				server->game = (char *)malloc(result->game_len + 1);
+				memcpy(server->game, game, result->game_len);
+				server->game[result->game_len] = '\0';
+				server->flags &= ~FLAG_DO_NOT_FREE_GAME;
+			}
+		}
+		server->worker_output = (char *)malloc(result->output_len + 1);
+		memcpy(server->worker_output, output, result->output_len);
+		server->worker_output_len = result->output_len;
+	}
+
+
+	/*
+	 * Process the complete results in a worker's buffer,
+	 * returns -1 if the worker sent something we don't understand.
+	 */
+	static int
+	read_results(struct worker *worker)
+	{
+		struct worker_result result;
+		size_t used = 0, len;
+
+		while (worker->len - used >= sizeof(result)) {
+			memcpy(&result, worker->buf + used, sizeof(result));
+			if ((result.game_len < 0) || (result.output_len < 0)) {
+				return (-1);
+			}
+			len = sizeof(result) + result.game_len + result.output_len;
+			if (worker->len - used < len) {
+				break;
+			}
+			handle_result(&result, worker->buf + used + sizeof(result), worker->buf + used + sizeof(result) + result.game_len);
+			used += len;
+		}
+
+		worker->len -= used;
+		memmove(worker->buf, worker->buf + used, worker->len);
+
+		return (0);
+	}
+
+
+	static void
+	collect_results(struct worker *workers, int n)
+	{
+		struct pollfd *fds;
+		struct worker *worker;
+		int i, running = n, status;
+		ssize_t rc;
+
+		fds = (struct pollfd *)calloc(n, sizeof(struct pollfd));
+		for (i = 0; i < n; i++) {
+			fds[i].fd = workers[i].fd;
+			fds[i].events = POLLIN;
+		}
+
+		while (running) {
+			if (poll(fds, n, -1) == -1) {
+				if (errno == EINTR) {
+					continue;
+				}
+				perror("poll");
+				break;
+			}
+
+			for (i = 0; i < n; i++) {
+				worker = &workers[i];
+				if ((fds[i].fd == -1) || !fds[i].revents) {
+					continue;
+				}
+
+				if (worker->size - worker->len < PACKET_LEN) {
+					worker->size = worker->size ? worker->size * 2 : PACKET_LEN * 2;
+					worker->buf = (char *)realloc(worker->buf, worker->size);
+				}
+
+				rc = read(worker->fd, worker->buf + worker->len, worker->size - worker->len);
+				if ((rc == -1) && (errno == EINTR)) {
+					continue;
+				}
+
+				if (rc > 0) {
+					worker->len += rc;
+					if (read_results(worker) == 0) {
+						continue;
+					}
+					fprintf(stderr, "worker %d: invalid result\n", i);
+					kill(worker->pid, SIGTERM);
+				} else if (rc == -1) {
+					perror("read");
+				}
+
+				close(worker->fd);
+				fds[i].fd = -1;
+				running--;
+				if ((waitpid(worker->pid, &status, 0) != -1) && !(WIFEXITED(status) && (WEXITSTATUS(status) == 0))) {
+					fprintf(stderr, "worker %d: exited abnormally, its remaining servers are reported as timed out\n", i);
+				}
+			}
+
+			if (progress) {
+				display_progress();
+			}
+		}
+
+		for (i = 0; i < n; i++) {
+			free(workers[i].buf);
+		}
+		free(fds);
+	}
+
+
+	void
+	run_workers()
+	{
+		struct worker *workers;
+		struct qserver *server;
+		int fds[2], max_pending = 0, i, j;
+		pid_t pid;
+
+		// Masters and broadcasts add the servers which are to be shared out
+		masters_only = 1;
+		do_work();
+		masters_only = 0;
+
+		for (server = servers; server != NULL; server = server->next) {
+			if ((server->server_name == NULL) && (server->fd == -1)) {
+				if (n_pending == max_pending) {
+					max_pending = max_pending ? max_pending * 2 : 1024;
+					pending = (struct qserver **)realloc(pending, max_pending * sizeof(struct qserver *));
+				}
+				server->worker_index = n_pending;
+				pending[n_pending++] = server;
+			}
+		}
+
+		if (n_pending == 0) {
+			free(pending);
+			return;
+		}
+
+		// Nothing used to query the masters should be shared with the workers
+		free_socket_pools();
+		reset_file_descriptors();
+		fflush(OF);
+		fflush(stdout);
+
+		completed = (char *)calloc(n_pending, 1);
+		workers = (struct worker *)calloc(n_workers, sizeof(struct worker));
+		for (i = 0; i < n_workers; i++) {
+			if (pipe(fds) == -1) {
+				perror("pipe");
+				break;
+			}
+
+			pid = fork();
+			if (pid == -1) {
+				perror("fork");
+				close(fds[0]);
+				close(fds[1]);
+				break;
+			}
+
+			if (pid == 0) {
+				close(fds[0]);
+				for (j = 0; j < i; j++) {
+					close(workers[j].fd);
+				}
+				worker_main(i, fds[1]);
+			}
+
+			close(fds[1]);
+			workers[i].pid = pid;
+			workers[i].fd = fds[0];
+		}
+
+		if (i < n_workers) {
+			// Without every share running do it all here instead
+			for (j = 0; j < i; j++) {
+				kill(workers[j].pid, SIGTERM);
+				close(workers[j].fd);
+				waitpid(workers[j].pid, NULL, 0);
+			}
+			for (j = 0; j < n_pending; j++) {
+				pending[j]->worker_index = -1;
+			}
+			fprintf(stderr, "failed to start workers, querying in a single process\n");
+			do_work();
+		} else {
+			collect_results(workers, n_workers);
+
+			for (j = 0; j < n_pending; j++) {
+				if (completed[j]) {
+					continue;
+				}
+				// lost with its worker
+				server = pending[j];
+				server->server_name = TIMEOUT;
+				server->ping_total = 999999;
+				num_servers_timed_out++;
+				if (!server_sort) {
+					display_server(server);
+				}
+			}
+		}
+
+		free(workers);
+		free(completed);
+		free(pending);
+		pending = NULL;
+		n_pending = 0;
+	}
+
+
+#else /* _WIN32 */
+
+	void
+	run_workers()
+	{
+		do_work();
+	}
+
+
+	void
+	worker_send_server(struct qserver *server)
+	{
+	}
+
+
+	void
+	worker_write_output(struct qserver *server)
+	{
+	}
+
+
+#endif /* _WIN32 */
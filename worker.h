@@ -0,0 +1,39 @@
+/*
+ * qstat
+ * by Steve Jankowski
+ *
+ * Worker processes
+ *
+ * Licensed under the Artistic License, see LICENSE.txt for license terms
+ */
+#ifndef QSTAT_WORKER_H
+#define QSTAT_WORKER_H
+
+#include "qstat.h"
+
+/** \brief number of worker processes to split the servers between */
+extern int n_workers;
+
+/** \brief index of this worker process, -1 in the parent */
+extern int worker_id;
+
+/**
+ * Query all servers using n_workers processes
+ *
+ * Masters and broadcasts are queried first by the parent, the servers
+ * still to be queried are then shared out between the workers which
+ * send each result back to the parent to be written out.
+ */
+void run_workers();
+
+/**
+ * Render server and send it to the parent, used by display_server in a worker
+ */
+void worker_send_server(struct qserver *server);
+
+/**
+ * Write out the output a worker rendered for server
+ */
+void worker_write_output(struct qserver *server);
+
+#endif